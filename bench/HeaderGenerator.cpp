@@ -0,0 +1,188 @@
+#include "HeaderGenerator.h"
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+
+namespace clalua::bench
+{
+
+// xorshift32. 標準の distribution は実装毎に結果が違うので使わない
+class Random
+{
+    uint32_t m_state;
+
+public:
+    Random(uint32_t seed) : m_state(seed ? seed : 0x9e3779b9)
+    {
+    }
+
+    uint32_t Next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+
+    // [0, n)
+    int Below(int n)
+    {
+        return n > 0 ? static_cast<int>(Next() % static_cast<uint32_t>(n)) : 0;
+    }
+};
+
+// 分割した i 番目の範囲の個数
+static int Share(int total, int files, int i)
+{
+    return total / files + (i < total % files ? 1 : 0);
+}
+
+struct FileTypes
+{
+    std::vector<std::string> Structs;
+    // typedef chain の末端
+    std::vector<std::string> Typedefs;
+    std::vector<std::string> Enums;
+    std::vector<std::string> Callbacks;
+};
+
+static const char *PRIMITIVES[] = {
+    "int", "unsigned int", "float", "double", "char", "short", "long long", "unsigned char", "void *", "const char *",
+};
+
+// file から参照できる型(自分と include した file のもの)から 1 つ選ぶ
+static std::string PickType(Random &random, const std::vector<const FileTypes *> &visible)
+{
+    auto &types = *visible[random.Below(static_cast<int>(visible.size()))];
+    switch (random.Below(5))
+    {
+    case 1:
+        if (!types.Structs.empty())
+        {
+            return fmt::format("struct {} *", types.Structs[random.Below(static_cast<int>(types.Structs.size()))]);
+        }
+        break;
+    case 2:
+        if (!types.Typedefs.empty())
+        {
+            return types.Typedefs[random.Below(static_cast<int>(types.Typedefs.size()))];
+        }
+        break;
+    case 3:
+        if (!types.Enums.empty())
+        {
+            return types.Enums[random.Below(static_cast<int>(types.Enums.size()))];
+        }
+        break;
+    case 4:
+        if (!types.Callbacks.empty())
+        {
+            return types.Callbacks[random.Below(static_cast<int>(types.Callbacks.size()))];
+        }
+        break;
+    }
+    return PRIMITIVES[random.Below(static_cast<int>(std::size(PRIMITIVES)))];
+}
+
+std::vector<std::string> GenerateHeaders(const HeaderParams &params, const std::filesystem::path &dir)
+{
+    std::filesystem::create_directories(dir);
+    auto files = params.Files > 0 ? params.Files : 1;
+
+    Random random(params.Seed);
+    std::vector<FileTypes> types(files);
+    std::vector<std::string> paths;
+    for (int f = 0; f < files; ++f)
+    {
+        auto &own = types[f];
+        std::vector<const FileTypes *> visible = {&own};
+
+        fmt::memory_buffer out;
+        auto w = std::back_inserter(out);
+        fmt::format_to(w, "// generated by clalua_bench. seed={}\n#pragma once\n", params.Seed);
+        for (int i = 1; i <= params.FanOut && f - i >= 0; ++i)
+        {
+            fmt::format_to(w, "#include \"bench_{}.h\"\n", f - i);
+            visible.push_back(&types[f - i]);
+        }
+        out.push_back('\n');
+
+        for (int i = 0; i < Share(params.Macros, files, f); ++i)
+        {
+            fmt::format_to(w, "#define BENCH_F{}_MACRO{} ({} * 4 + 1)\n", f, i, i);
+        }
+        out.push_back('\n');
+
+        for (int i = 0; i < Share(params.Enums, files, f); ++i)
+        {
+            auto name = fmt::format("Enum_{}_{}", f, i);
+            fmt::format_to(w, "enum {}\n{{\n", name);
+            for (int v = 0; v < params.EnumValues; ++v)
+            {
+                fmt::format_to(w, "    {}_V{} = {},\n", name, v, v * 2);
+            }
+            fmt::format_to(w, "}};\n");
+            own.Enums.push_back("enum " + name);
+        }
+        out.push_back('\n');
+
+        // 前方宣言して相互参照できるようにする
+        auto structs = Share(params.Structs, files, f);
+        for (int i = 0; i < structs; ++i)
+        {
+            auto name = fmt::format("Struct_{}_{}", f, i);
+            fmt::format_to(w, "struct {};\n", name);
+            own.Structs.push_back(name);
+        }
+
+        for (int i = 0; i < Share(params.Callbacks, files, f); ++i)
+        {
+            auto name = fmt::format("Callback_{}_{}", f, i);
+            fmt::format_to(w, "typedef int (*{})(struct Struct_{}_{} *self, int value, void *user);\n", name, f,
+                           structs ? random.Below(structs) : 0);
+            own.Callbacks.push_back(name);
+        }
+        out.push_back('\n');
+
+        for (int i = 0; i < structs; ++i)
+        {
+            fmt::format_to(w, "struct Struct_{}_{}\n{{\n", f, i);
+            for (int j = 0; j < params.Fields; ++j)
+            {
+                fmt::format_to(w, "    {} field{};\n", PickType(random, visible), j);
+            }
+            fmt::format_to(w, "}};\n");
+
+            std::string prev = fmt::format("struct Struct_{}_{}", f, i);
+            for (int d = 0; d < params.TypedefDepth; ++d)
+            {
+                auto name = fmt::format("Struct_{}_{}_T{}", f, i, d);
+                fmt::format_to(w, "typedef {} {};\n", prev, name);
+                prev = name;
+            }
+            if (params.TypedefDepth > 0)
+            {
+                own.Typedefs.push_back(prev);
+            }
+        }
+        out.push_back('\n');
+
+        for (int i = 0; i < Share(params.Functions, files, f); ++i)
+        {
+            fmt::format_to(w, "{} Function_{}_{}(", PickType(random, visible), f, i);
+            for (int j = 0; j < params.Params; ++j)
+            {
+                fmt::format_to(w, "{}{} p{}", j ? ", " : "", PickType(random, visible), j);
+            }
+            fmt::format_to(w, ");\n");
+        }
+
+        auto path = (dir / fmt::format("bench_{}.h", f)).generic_string();
+        std::ofstream ofs(path, std::ios::binary);
+        ofs.write(out.data(), out.size());
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+} // namespace clalua::bench
@@ -0,0 +1,54 @@
+#pragma once
+#include <filesystem>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace clalua::bench
+{
+
+///
+/// 合成 header の規模
+///
+/// Files 個の header に分けて出力する。file i は file i-1 を include するので
+/// 後の file の型は前の file の型を参照できる(include fan-out は FanOut 個まで)
+///
+struct HeaderParams
+{
+    int Files = 4;
+    // 各 file が include する前の file の数
+    int FanOut = 1;
+    int Structs = 100;
+    int Fields = 8;
+    int Functions = 200;
+    int Params = 4;
+    int Enums = 20;
+    int EnumValues = 16;
+    // struct 毎の typedef の連鎖
+    int TypedefDepth = 2;
+    // 関数ポインタ typedef
+    int Callbacks = 20;
+    int Macros = 100;
+    uint32_t Seed = 1;
+
+    // Structs, Functions, Enums, Callbacks, Macros を scale 倍する
+    HeaderParams Scaled(int scale) const
+    {
+        auto copy = *this;
+        copy.Structs *= scale;
+        copy.Functions *= scale;
+        copy.Enums *= scale;
+        copy.Callbacks *= scale;
+        copy.Macros *= scale;
+        return copy;
+    }
+};
+
+///
+/// dir に header を書き出して、その path の一覧を返す
+///
+/// 同じ params からは同じ内容になる
+///
+std::vector<std::string> GenerateHeaders(const HeaderParams &params, const std::filesystem::path &dir);
+
+} // namespace clalua::bench
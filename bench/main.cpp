@@ -0,0 +1,272 @@
+//
+// clalua_bench [options]
+//
+// 合成 header を生成して parse / traverse / closure / push の各 phase を計測する
+//
+#include "ClangDeclProcessor.h"
+#include "ClangIndex.h"
+#include "HeaderGenerator.h"
+#include "LuaMemory.h"
+#include "LuaPush.h"
+#include "MemoryUsage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+using namespace clalua;
+using namespace clalua::bench;
+
+static const char *USAGE = R"(usage: clalua_bench [options]
+corpus:
+    --files N           header files (default: 4)
+    --fanout N          includes per file (default: 1)
+    --structs N         (default: 100)
+    --fields N          fields per struct (default: 8)
+    --functions N       (default: 200)
+    --params N          params per function (default: 4)
+    --enums N           (default: 20)
+    --enum-values N     (default: 16)
+    --typedef-depth N   typedef chain per struct (default: 2)
+    --callbacks N       function pointer typedefs (default: 20)
+    --macros N          (default: 100)
+    --seed N            (default: 1)
+run:
+    --scale 1,2,4       multiply structs/functions/enums/callbacks/macros (default: 1)
+    --repeat N          take the fastest of N runs (default: 3)
+    --dir PATH          where headers are written (default: temp/clalua_bench)
+)";
+
+struct BenchOptions
+{
+    HeaderParams Params;
+    std::vector<int> Scales = {1};
+    int Repeat = 3;
+    std::filesystem::path Dir = std::filesystem::temp_directory_path() / "clalua_bench";
+};
+
+static bool ParseInt(const char *src, int *value)
+{
+    char *end;
+    auto n = strtol(src, &end, 10);
+    if (end == src || *end || n < 0)
+    {
+        return false;
+    }
+    *value = static_cast<int>(n);
+    return true;
+}
+
+static bool ParseOptions(int argc, char **argv, BenchOptions *options)
+{
+    auto &p = options->Params;
+    struct IntOption
+    {
+        const char *Name;
+        int *Value;
+    } ints[] = {
+        {"--files", &p.Files},         {"--fanout", &p.FanOut},
+        {"--structs", &p.Structs},     {"--fields", &p.Fields},
+        {"--functions", &p.Functions}, {"--params", &p.Params},
+        {"--enums", &p.Enums},         {"--enum-values", &p.EnumValues},
+        {"--typedef-depth", &p.TypedefDepth}, {"--callbacks", &p.Callbacks},
+        {"--macros", &p.Macros},       {"--repeat", &options->Repeat},
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        auto arg = argv[i];
+        auto value = argv[++i];
+
+        auto found = std::find_if(std::begin(ints), std::end(ints),
+                                  [arg](const IntOption &o) { return strcmp(o.Name, arg) == 0; });
+        if (found != std::end(ints))
+        {
+            if (!ParseInt(value, found->Value))
+            {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--seed") == 0)
+        {
+            int seed;
+            if (!ParseInt(value, &seed))
+            {
+                return false;
+            }
+            p.Seed = static_cast<uint32_t>(seed);
+        }
+        else if (strcmp(arg, "--dir") == 0)
+        {
+            options->Dir = value;
+        }
+        else if (strcmp(arg, "--scale") == 0)
+        {
+            options->Scales.clear();
+            for (auto c = value; *c;)
+            {
+                char *end;
+                auto n = strtol(c, &end, 10);
+                if (end == c || n <= 0)
+                {
+                    return false;
+                }
+                options->Scales.push_back(static_cast<int>(n));
+                c = *end == ',' ? end + 1 : end;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return options->Repeat > 0 && !options->Scales.empty();
+}
+
+struct PhaseResult
+{
+    double ParseMs = 0;
+    double TraverseMs = 0;
+    double ClosureMs = 0;
+    double PushMs = 0;
+    size_t Decls = 0;
+    size_t SourceDecls = 0;
+    size_t Sources = 0;
+
+    void KeepMin(const PhaseResult &rhs)
+    {
+        ParseMs = std::min(ParseMs, rhs.ParseMs);
+        TraverseMs = std::min(TraverseMs, rhs.TraverseMs);
+        ClosureMs = std::min(ClosureMs, rhs.ClosureMs);
+        PushMs = std::min(PushMs, rhs.PushMs);
+    }
+};
+
+static double ElapsedMs(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static bool RunOnce(std::vector<std::string> &headers, PhaseResult *result)
+{
+    std::vector<std::string> includes;
+    std::vector<std::string> defines;
+
+    // parse + traverse
+    ParsePhases phases;
+    auto map = Parse(headers, includes, defines, &phases);
+    if (map.empty())
+    {
+        return false;
+    }
+    result->ParseMs = phases.ParseMs;
+    result->TraverseMs = phases.TraverseMs;
+    result->Decls = map.size();
+
+    // closure. CLALUA_parse と同じく header 直下の decl から辿る
+    auto begin = std::chrono::steady_clock::now();
+    auto processor = std::make_shared<ClangDeclProcessor>();
+    for (auto &[id, decl] : map)
+    {
+        if (std::find(headers.begin(), headers.end(), decl->path) != headers.end())
+        {
+            processor->AddDecl(decl, {});
+        }
+    }
+    result->ClosureMs = ElapsedMs(begin);
+    result->Sources = processor->SourceMap.size();
+    result->SourceDecls = 0;
+    for (auto &[path, source] : processor->SourceMap)
+    {
+        result->SourceDecls += source->Decls.size();
+    }
+
+    // push
+    auto L = luaL_newstate();
+    luaL_openlibs(L);
+    begin = std::chrono::steady_clock::now();
+    {
+        ScopedPushPhase phase(L);
+        PushSourceMap(L, processor);
+    }
+    result->PushMs = ElapsedMs(begin);
+    lua_close(L);
+    return true;
+}
+
+static double PerSecond(size_t n, double ms)
+{
+    return ms > 0 ? n * 1000.0 / ms : 0;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
+    printf("%6s %8s %8s | %10s %10s %10s %10s | %12s %12s | %8s\n", "scale", "decls", "sources", "parse ms",
+           "traverse", "closure", "push", "decls/s", "push decl/s", "peak MB");
+
+    double baseNsPerDecl = 0;
+    for (auto scale : options.Scales)
+    {
+        auto params = options.Params.Scaled(scale);
+        auto dir = options.Dir / std::to_string(scale);
+        auto headers = GenerateHeaders(params, dir);
+
+        PhaseResult best;
+        for (int i = 0; i < options.Repeat; ++i)
+        {
+            PhaseResult result;
+            if (!RunOnce(headers, &result))
+            {
+                fprintf(stderr, "fail to parse %s\n", dir.generic_string().c_str());
+                return 1;
+            }
+            if (i == 0)
+            {
+                best = result;
+            }
+            else
+            {
+                best.KeepMin(result);
+            }
+        }
+
+        auto totalMs = best.ParseMs + best.TraverseMs + best.ClosureMs + best.PushMs;
+        printf("%6d %8zu %8zu | %10.2f %10.2f %10.2f %10.2f | %12.0f %12.0f | %8.1f\n", scale, best.Decls,
+               best.Sources, best.ParseMs, best.TraverseMs, best.ClosureMs, best.PushMs,
+               PerSecond(best.Decls, totalMs), PerSecond(best.SourceDecls, best.PushMs),
+               PeakRssBytes() / (1024.0 * 1024.0));
+
+        // 線形なら 1.0 付近。大きくなっていく phase は super-linear
+        auto nsPerDecl = best.Decls ? totalMs * 1e6 / best.Decls : 0;
+        if (baseNsPerDecl == 0)
+        {
+            baseNsPerDecl = nsPerDecl;
+        }
+        else if (baseNsPerDecl > 0)
+        {
+            printf("%6s time per decl x%.2f of scale %d\n", "", nsPerDecl / baseNsPerDecl, options.Scales.front());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,377 @@
+//
+// clalua_bench_marshal [options]
+//
+// PushSource の decl 種類毎の micro benchmark。
+// libclang を通さずに graph を直接組み立てて push する
+//
+#include "ClangDeclProcessor.h"
+#include "LuaPush.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fmt/format.h>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+using namespace clalua;
+
+static const char *USAGE = R"(usage: clalua_bench_marshal [options]
+    --size N                decls per case (default: 2000)
+    --width N               fields / params / enum values / chain depth (default: 32)
+    --repeat N              take the fastest of N runs (default: 5)
+    --case NAME             run only NAME (repeatable)
+    --write-baseline PATH   write results
+    --check PATH            compare with a baseline written by --write-baseline.
+                            exit 1 if ns/decl or bytes/decl exceed it by --tolerance
+    --tolerance X           (default: 1.25)
+)";
+
+struct MarshalOptions
+{
+    int Size = 2000;
+    int Width = 32;
+    int Repeat = 5;
+    std::vector<std::string> Cases;
+    std::string WriteBaseline;
+    std::string Check;
+    double Tolerance = 1.25;
+};
+
+//
+// graph
+//
+static uint32_t g_hash = 1;
+
+template <typename T> static std::shared_ptr<T> Create(const std::string &name)
+{
+    auto hash = g_hash++;
+    return T::create(hash, "marshal.h", hash, name);
+}
+
+static std::shared_ptr<Decl> PrimitiveType(int i)
+{
+    static std::shared_ptr<Decl> primitives[] = {
+        std::make_shared<Int32>(), std::make_shared<Float>(), std::make_shared<UInt8>(),
+        std::make_shared<Double>(), std::make_shared<Int64>(), std::make_shared<Bool>(),
+    };
+    return primitives[i % std::size(primitives)];
+}
+
+// struct { field0; ... field{width} } * size
+static SourcePtr WideStructs(int size, int width)
+{
+    auto source = std::make_shared<Source>();
+    source->Path = "marshal.h";
+    for (int i = 0; i < size; ++i)
+    {
+        auto decl = Create<StructDecl>(fmt::format("Wide{}", i));
+        for (int j = 0; j < width; ++j)
+        {
+            decl->fields.push_back({static_cast<uint32_t>(j * 8), fmt::format("field{}", j), {PrimitiveType(j)}});
+        }
+        source->AddDecl(decl);
+    }
+    return source;
+}
+
+// typedef int *****(width) Chain{i}
+static SourcePtr PointerChains(int size, int width)
+{
+    auto source = std::make_shared<Source>();
+    source->Path = "marshal.h";
+    for (int i = 0; i < size; ++i)
+    {
+        std::shared_ptr<Decl> type = PrimitiveType(i);
+        for (int j = 0; j < width; ++j)
+        {
+            type = std::make_shared<Pointer>(type, j % 2 == 0);
+        }
+        auto decl = Create<Typedef>(fmt::format("Chain{}", i));
+        decl->ref.decl = type;
+        source->AddDecl(decl);
+    }
+    return source;
+}
+
+// int Function{i}(p0, ..., p{width})
+static SourcePtr ManyParams(int size, int width)
+{
+    auto source = std::make_shared<Source>();
+    source->Path = "marshal.h";
+    for (int i = 0; i < size; ++i)
+    {
+        auto decl = Create<FunctionDecl>(fmt::format("Function{}", i));
+        decl->returnType.decl = PrimitiveType(i);
+        for (int j = 0; j < width; ++j)
+        {
+            decl->params.push_back({fmt::format("p{}", j), {std::make_shared<Pointer>(PrimitiveType(j))}});
+        }
+        decl->dllExport = true;
+        source->AddDecl(decl);
+    }
+    return source;
+}
+
+// enum { V0, ... V{width} }
+static SourcePtr BigEnums(int size, int width)
+{
+    auto source = std::make_shared<Source>();
+    source->Path = "marshal.h";
+    for (int i = 0; i < size; ++i)
+    {
+        auto decl = Create<EnumDecl>(fmt::format("Enum{}", i));
+        for (int j = 0; j < width; ++j)
+        {
+            decl->values.push_back({fmt::format("Enum{}_V{}", i, j), static_cast<uint32_t>(j)});
+        }
+        source->AddDecl(decl);
+    }
+    return source;
+}
+
+// width 個の struct を size 個の typedef / pointer が参照する
+static SourcePtr SharedTypes(int size, int width)
+{
+    auto source = std::make_shared<Source>();
+    source->Path = "marshal.h";
+    std::vector<std::shared_ptr<StructDecl>> shared;
+    for (int j = 0; j < width; ++j)
+    {
+        auto decl = Create<StructDecl>(fmt::format("Shared{}", j));
+        for (int k = 0; k < 8; ++k)
+        {
+            decl->fields.push_back({static_cast<uint32_t>(k * 8), fmt::format("field{}", k), {PrimitiveType(k)}});
+        }
+        shared.push_back(decl);
+        source->AddDecl(decl);
+    }
+    for (int i = 0; i < size; ++i)
+    {
+        auto target = shared[i % shared.size()];
+        auto decl = Create<Typedef>(fmt::format("SharedRef{}", i));
+        if (i % 2)
+        {
+            decl->ref.decl = std::make_shared<Pointer>(target);
+        }
+        else
+        {
+            decl->ref.decl = target;
+        }
+        source->AddDecl(decl);
+    }
+    return source;
+}
+
+struct Case
+{
+    const char *Name;
+    std::function<SourcePtr(int, int)> Build;
+};
+
+static const Case CASES[] = {
+    {"wide_struct", WideStructs},   {"pointer_chain", PointerChains}, {"many_params", ManyParams},
+    {"big_enum", BigEnums},         {"shared_types", SharedTypes},
+};
+
+//
+// measure
+//
+struct Result
+{
+    double NsPerDecl = 0;
+    double BytesPerDecl = 0;
+    // 結果を捨てた後の full collect
+    double GcMs = 0;
+};
+
+static size_t HeapBytes(lua_State *L)
+{
+    return static_cast<size_t>(lua_gc(L, LUA_GCCOUNT)) * 1024 + static_cast<size_t>(lua_gc(L, LUA_GCCOUNTB));
+}
+
+static Result MeasureOnce(const SourcePtr &source)
+{
+    auto L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_gc(L, LUA_GCCOLLECT);
+    lua_gc(L, LUA_GCSTOP);
+
+    auto decls = source->Decls.size();
+    auto heap = HeapBytes(L);
+    auto begin = std::chrono::steady_clock::now();
+    PushSource(L, source);
+    auto end = std::chrono::steady_clock::now();
+
+    Result result;
+    result.NsPerDecl = std::chrono::duration<double, std::nano>(end - begin).count() / decls;
+    result.BytesPerDecl = static_cast<double>(HeapBytes(L) - heap) / decls;
+
+    lua_pop(L, 1);
+    lua_gc(L, LUA_GCRESTART);
+    begin = std::chrono::steady_clock::now();
+    lua_gc(L, LUA_GCCOLLECT);
+    result.GcMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    lua_close(L);
+    return result;
+}
+
+static Result Measure(const SourcePtr &source, int repeat)
+{
+    auto best = MeasureOnce(source);
+    for (int i = 1; i < repeat; ++i)
+    {
+        auto result = MeasureOnce(source);
+        best.NsPerDecl = std::min(best.NsPerDecl, result.NsPerDecl);
+        best.GcMs = std::min(best.GcMs, result.GcMs);
+        // heap は毎回同じ
+    }
+    return best;
+}
+
+//
+// baseline
+//
+static std::map<std::string, Result> ReadBaseline(const std::string &path)
+{
+    std::map<std::string, Result> baseline;
+    std::ifstream ifs(path);
+    std::string name;
+    Result result;
+    while (ifs >> name >> result.NsPerDecl >> result.BytesPerDecl >> result.GcMs)
+    {
+        baseline[name] = result;
+    }
+    return baseline;
+}
+
+static bool ParseOptions(int argc, char **argv, MarshalOptions *options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        std::string arg = argv[i];
+        auto value = argv[++i];
+        if (arg == "--size")
+        {
+            options->Size = atoi(value);
+        }
+        else if (arg == "--width")
+        {
+            options->Width = atoi(value);
+        }
+        else if (arg == "--repeat")
+        {
+            options->Repeat = atoi(value);
+        }
+        else if (arg == "--case")
+        {
+            options->Cases.push_back(value);
+        }
+        else if (arg == "--write-baseline")
+        {
+            options->WriteBaseline = value;
+        }
+        else if (arg == "--check")
+        {
+            options->Check = value;
+        }
+        else if (arg == "--tolerance")
+        {
+            options->Tolerance = atof(value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return options->Size > 0 && options->Width > 0 && options->Repeat > 0 && options->Tolerance > 0;
+}
+
+int main(int argc, char **argv)
+{
+    MarshalOptions options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
+    std::map<std::string, Result> baseline;
+    if (!options.Check.empty())
+    {
+        baseline = ReadBaseline(options.Check);
+        if (baseline.empty())
+        {
+            fprintf(stderr, "fail to read baseline: %s\n", options.Check.c_str());
+            return 1;
+        }
+    }
+
+    FILE *out = nullptr;
+    if (!options.WriteBaseline.empty())
+    {
+        out = fopen(options.WriteBaseline.c_str(), "wb");
+        if (!out)
+        {
+            fprintf(stderr, "fail to open %s\n", options.WriteBaseline.c_str());
+            return 1;
+        }
+    }
+
+    printf("%-16s %8s %12s %14s %10s\n", "case", "decls", "ns/decl", "bytes/decl", "gc ms");
+    bool regressed = false;
+    for (auto &c : CASES)
+    {
+        if (!options.Cases.empty() &&
+            std::find(options.Cases.begin(), options.Cases.end(), c.Name) == options.Cases.end())
+        {
+            continue;
+        }
+
+        auto source = c.Build(options.Size, options.Width);
+        auto result = Measure(source, options.Repeat);
+        printf("%-16s %8zu %12.1f %14.1f %10.2f", c.Name, source->Decls.size(), result.NsPerDecl,
+               result.BytesPerDecl, result.GcMs);
+
+        auto found = baseline.find(c.Name);
+        if (found != baseline.end())
+        {
+            auto ns = result.NsPerDecl / found->second.NsPerDecl;
+            auto bytes = result.BytesPerDecl / found->second.BytesPerDecl;
+            printf("  x%.2f time x%.2f bytes", ns, bytes);
+            if (ns > options.Tolerance || bytes > options.Tolerance)
+            {
+                printf("  REGRESSION");
+                regressed = true;
+            }
+        }
+        printf("\n");
+
+        if (out)
+        {
+            fprintf(out, "%s %f %f %f\n", c.Name, result.NsPerDecl, result.BytesPerDecl, result.GcMs);
+        }
+    }
+
+    if (out)
+    {
+        fclose(out);
+    }
+    return regressed ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 #include "ClangCursorTraverser.h"
 #include "ClangDecl.h"
+#include "ParseProgress.h"
 #include "enum_name.h"
 #include <clang-c/Index.h>
 #include <filesystem>
@@ -219,6 +220,30 @@ struct Source
     std::vector<uint8_t> data;
 };
 
+// uuid("...") or the macros of the windows sdk. the first token is the attr or the macro name
+static std::string getIID(const CXCursor &cursor)
+{
+    ScopedCXTokens tokens(cursor);
+    if (tokens.size() < 3)
+    {
+        return {};
+    }
+    auto name = tokens.spelling(0);
+    auto head = name.str_view();
+    if (head != "uuid" && head != "MIDL_INTERFACE" && head != "DX_DECLARE_INTERFACE" &&
+        head != "DWRITE_DECLARE_INTERFACE")
+    {
+        return {};
+    }
+    auto literal = tokens.spelling(2);
+    auto value = literal.str_view();
+    if (value.size() < 2 || value.front() != '"' || value.back() != '"')
+    {
+        return {};
+    }
+    return std::string(value.substr(1, value.size() - 2));
+}
+
 auto D3D11_KEY = "MIDL_INTERFACE(\"";
 auto D2D1_KEY = "DX_DECLARE_INTERFACE(\"";
 auto DWRITE_KEY = "DWRITE_DECLARE_INTERFACE(\"";
@@ -243,9 +268,21 @@ auto DWRITE_KEY = "DWRITE_DECLARE_INTERFACE(\"";
 //     }
 // }
 
+template <typename T> static std::shared_ptr<T> createDecl(const CXCursor &cursor)
+{
+    auto hash = clang_hashCursor(cursor);
+    auto location = Location::get(cursor);
+    ScopedCXString spelling(clang_getCursorSpelling(cursor));
+    return T::create(hash, location.path(), location.line, spelling.str_view());
+}
+
 class TraverserImpl
 {
 public:
+    TraverserImpl(ParseProgress *progress = nullptr) : m_progress(progress)
+    {
+    }
+
     void TraverseChildren(const CXCursor &cursor, const Context &context)
     {
         processChildren(cursor, std::bind(&TraverserImpl::traverse, this, std::placeholders::_1, context));
@@ -253,6 +290,8 @@ public:
     std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> m_declMap;
 
 private:
+    ParseProgress *m_progress = nullptr;
+
     // std::unordered_map<std::string, std::shared_ptr<Source>> m_sourceMap;
 
     // std::shared_ptr<Source> getOrCreateSource(const CXCursor &cursor)
@@ -301,6 +340,16 @@ private:
         return std::dynamic_pointer_cast<T>(found->second);
     }
 
+    // new decl. counts the progress
+    template <typename T> std::shared_ptr<T> newDecl(const CXCursor &cursor)
+    {
+        if (m_progress)
+        {
+            m_progress->Decl();
+        }
+        return createDecl<T>(cursor);
+    }
+
     std::shared_ptr<Decl> typeToDecl(const CXCursor &cursor)
     {
         auto cursorType = clang_getCursorType(cursor);
@@ -379,8 +428,9 @@ private:
         if (type.kind == CXType_FunctionProto)
         {
             auto resultType = clang_getResultType(type);
-            // auto dummy = Context();
-            auto decl = parseFunction(cursor, resultType);
+            // function type. no namespace
+            auto dummy = Context();
+            auto decl = parseFunction(cursor, resultType, dummy);
             return decl;
         }
 
@@ -452,6 +502,10 @@ private:
 
     CXChildVisitResult traverse(const CXCursor &cursor, const Context &context)
     {
+        if (m_progress)
+        {
+            m_progress->Cursor();
+        }
         switch (cursor.kind)
         {
         case CXCursor_InclusionDirective:
@@ -498,10 +552,8 @@ private:
             auto decl = getDecl<Namespace>(cursor);
             if (!decl)
             {
-                auto hash = clang_hashCursor(cursor);
-                auto location = Location::get(cursor);
-                ScopedCXString spelling(clang_getCursorSpelling(cursor));
-                decl = Namespace::create(hash, location.path(), location.line, spelling.str_view());
+                decl = newDecl<Namespace>(cursor);
+                decl->namespaceDecl = context.namespaceDecl;
                 pushDecl(cursor, decl);
             }
             auto child = context.enterNamespace(decl);
@@ -528,12 +580,12 @@ private:
         break;
 
         case CXCursor_TypedefDecl:
-            parseTypedef(cursor);
+            parseTypedef(cursor, context);
             break;
 
         case CXCursor_FunctionDecl:
         {
-            auto decl = parseFunction(cursor, clang_getCursorResultType(cursor));
+            auto decl = parseFunction(cursor, clang_getCursorResultType(cursor), context);
             if (decl)
             {
                 // auto header = getOrCreateHeader(cursor);
@@ -552,7 +604,7 @@ private:
             break;
 
         case CXCursor_EnumDecl:
-            parseEnum(cursor);
+            parseEnum(cursor, context);
             break;
 
         case CXCursor_VarDecl:
@@ -565,12 +617,10 @@ private:
         return CXChildVisit_Continue;
     }
 
-    void parseTypedef(CXCursor cursor)
+    void parseTypedef(CXCursor cursor, const Context &context)
     {
-        auto hash = clang_hashCursor(cursor);
-        auto location = Location::get(cursor);
-        ScopedCXString spelling(clang_getCursorSpelling(cursor));
-        auto decl = Typedef::create(hash, location.path(), location.line, spelling.str_view());
+        auto decl = newDecl<Typedef>(cursor);
+        decl->namespaceDecl = context.namespaceDecl;
         pushDecl(cursor, decl);
 
         auto underlying = clang_getTypedefDeclUnderlyingType(cursor);
@@ -579,12 +629,10 @@ private:
         decl->ref = {type, isConst != 0};
     }
 
-    void parseEnum(const CXCursor &cursor)
+    void parseEnum(const CXCursor &cursor, const Context &context)
     {
-        auto hash = clang_hashCursor(cursor);
-        auto location = Location::get(cursor);
-        ScopedCXString spelling(clang_getCursorSpelling(cursor));
-        auto decl = EnumDecl::create(hash, location.path(), location.line, spelling.str_view());
+        auto decl = newDecl<EnumDecl>(cursor);
+        decl->namespaceDecl = context.namespaceDecl;
         processChildren(cursor, [&decl](const CXCursor &child) {
             switch (child.kind)
             {
@@ -609,12 +657,9 @@ private:
         // header.types ~= decl;
     }
 
-    std::shared_ptr<FunctionDecl> parseFunction(const CXCursor &cursor, const CXType &retType)
+    std::shared_ptr<FunctionDecl> parseFunction(const CXCursor &cursor, const CXType &retType, const Context &context)
     {
-        auto hash = clang_hashCursor(cursor);
-        auto location = Location::get(cursor);
-        ScopedCXString spelling(clang_getCursorSpelling(cursor));
-        auto decl = FunctionDecl::create(hash, location.path(), location.line, spelling.str_view());
+        auto decl = newDecl<FunctionDecl>(cursor);
         // decl->returnType = {retDecl, }
         //, TypeRef(retDecl), params, dllExport, context.isExternC);
         decl->isVariadic = clang_Cursor_isVariadic(cursor) != 0;
@@ -676,7 +721,7 @@ private:
 
         auto retDecl = typeToDecl(retType, cursor);
 
-        // decl.namespace = context.namespace;
+        decl->namespaceDecl = context.namespaceDecl;
 
         return decl;
     }
@@ -687,14 +732,11 @@ private:
         if (!decl)
         {
             // first time
-            auto hash = clang_hashCursor(cursor);
-            auto location = Location::get(cursor);
-            ScopedCXString spelling(clang_getCursorSpelling(cursor));
-            decl = StructDecl::create(hash, location.path(), location.line, spelling.str_view());
+            decl = newDecl<StructDecl>(cursor);
             pushDecl(cursor, decl);
         }
 
-        // decl.namespace = context.namespace;
+        decl->namespaceDecl = context.namespaceDecl;
         decl->isUnion = isUnion;
         decl->isForwardDecl = isForwardDeclaration(cursor);
         if (decl->isForwardDecl)
@@ -710,10 +752,7 @@ private:
                 if (!defDecl)
                 {
                     // create
-                    auto defHash = clang_hashCursor(defCursor);
-                    auto defLocation = Location::get(defCursor);
-                    ScopedCXString defSpelling(clang_getCursorSpelling(defCursor));
-                    defDecl = StructDecl::create(defHash, defLocation.path(), defLocation.line, defSpelling.str_view());
+                    defDecl = newDecl<StructDecl>(defCursor);
                     pushDecl(defCursor, defDecl);
                 }
                 decl->definition = defDecl;
@@ -748,21 +787,25 @@ private:
         }
 
         case CXCursor_UnexposedAttr:
-            // {
-            //     auto src = getSource(child);
-            //     auto uuid = getUUID(src);
-            //     if (!uuid.empty())
-            //     {
-            //         decl.iid = uuid;
-            //     }
-            // }
-            break;
+        {
+            auto iid = getIID(child);
+            if (!iid.empty())
+            {
+                structDecl->iid = iid;
+            }
+        }
+        break;
 
         case CXCursor_CXXMethod:
         {
-            auto method = parseFunction(child, clang_getCursorResultType(child));
+            auto method = parseFunction(child, clang_getCursorResultType(child), context);
             if (!method->hasBody)
             {
+                if (clang_CXXMethod_isVirtual(child))
+                {
+                    structDecl->isInterface = true;
+                }
+                structDecl->methods.push_back(method);
                 // CXCursor *p;
                 // uint32_t n;
                 // ulong[] hashes;
@@ -823,6 +866,15 @@ private:
 
         case CXCursor_CXXBaseSpecifier:
         {
+            structDecl->base = typeToDecl(child);
+            if (auto base = std::dynamic_pointer_cast<StructDecl>(structDecl->base))
+            {
+                if (base->definition)
+                {
+                    base = base->definition;
+                }
+                structDecl->isInterface = structDecl->isInterface || base->isInterface;
+            }
             // Decl referenced = getReferenceType(child);
             // while (true)
             // {
@@ -874,11 +926,11 @@ private:
     }
 };
 
-std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Traverse(const CXCursor &cursor)
+std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Traverse(const CXCursor &cursor, ParseProgress *progress)
 {
-    TraverserImpl impl;
+    TraverserImpl impl(progress);
     impl.TraverseChildren(cursor, {});
     return impl.m_declMap;
 }
 
-} // namespace clalua
\ No newline at end of file
+} // namespace clalua
\ No newline at end of file
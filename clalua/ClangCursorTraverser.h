@@ -7,6 +7,9 @@ namespace clalua
 {
 
 struct UserDecl;
-std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Traverse(const CXCursor &cursor);
+class ParseProgress;
+// progress: cursor と decl を数える
+std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Traverse(const CXCursor &cursor,
+                                                                 ParseProgress *progress = nullptr);
 
 } // namespace clalua
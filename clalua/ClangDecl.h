@@ -118,12 +118,26 @@ struct Array : public Decl
     }
 };
 
+struct Namespace;
+
 struct UserDecl : public Decl
 {
     uint32_t hash;
     std::string path;
     uint32_t line;
     std::string name;
+    // enclosing namespace or struct. empty at the top level
+    std::weak_ptr<Namespace> namespaceDecl;
+    // ResolveDecls: {namespace}::{name}
+    std::string qualifiedName;
+    // ResolveDecls: named enclosing namespaces / structs joined with ::. empty at the top level
+    std::string namespaceKey;
+    // ResolveDecls: 0 is the top level. ids are in namespaceKey order
+    uint32_t namespaceId = 0;
+    // ComputeFingerprints: structural hash. 0: not computed
+    uint64_t fingerprint = 0;
+    // ComputeFingerprints: fingerprint and those of every decl reachable from this
+    uint64_t deepFingerprint = 0;
 
     UserDecl(uint32_t hash, const std::string_view &path, const uint32_t line, const std::string_view &name)
         : hash(hash), path(path), line(line), name(name)
@@ -142,6 +156,9 @@ struct Typedef : public UserDecl
 {
     using UserDecl::UserDecl;
     TypeReference ref;
+    // ResolveDecls: the first non typedef of the ref chain and the number of typedefs to it
+    std::shared_ptr<Decl> resolved;
+    uint32_t typedefDepth = 0;
 
     static std::shared_ptr<Typedef> create(uint32_t hash, const std::string_view &path, const uint32_t line,
                                            const std::string_view &name)
@@ -216,6 +233,13 @@ struct StructDecl : public Namespace
     bool isForwardDecl = false;
     std::shared_ptr<StructDecl> definition;
     std::vector<StructField> fields;
+    // COM interface. has virtual methods or an interface base
+    bool isInterface = false;
+    // __declspec(uuid("...")), MIDL_INTERFACE("...")
+    std::string iid;
+    std::shared_ptr<Decl> base;
+    // methods without body(vtable order)
+    std::vector<std::shared_ptr<FunctionDecl>> methods;
 
     static std::shared_ptr<StructDecl> create(uint32_t hash, const std::string_view &path, const uint32_t line,
                                               const std::string_view &name)
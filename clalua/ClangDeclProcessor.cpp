@@ -1,4 +1,6 @@
 #include "ClangDeclProcessor.h"
+#include "ParseProgress.h"
+#include <algorithm>
 
 namespace clalua
 {
@@ -47,7 +49,10 @@ void ClangDeclProcessor::AddDecl(const std::shared_ptr<Decl> &decl, const Proces
     context.PushIfNotContains(source);
 
     // add decl
-    source->AddDecl(userDecl);
+    if (source->AddDecl(userDecl) && Progress)
+    {
+        Progress->ClosureDecl();
+    }
 
     // recursive AddDecl
     {
@@ -83,28 +88,121 @@ void ClangDeclProcessor::AddDecl(const std::shared_ptr<Decl> &decl, const Proces
             //     }
             // }
 
-            // if (structDecl->base)
-            // {
-            //     addDecl(_decl ~structDecl.base, from);
-            // }
+            if (structDecl->base)
+            {
+                AddDecl(structDecl->base, context.Create(userDecl));
+            }
 
             for (auto &field : structDecl->fields)
             {
                 AddDecl(field.ref.decl, context.Create(userDecl));
             }
 
-            // for (auto &method : structDecl->methods)
-            // {
-            //     addDecl(_decl ~method.ret.type, from);
-            //     foreach (param; method.params)
-            //     {
-            //         addDecl(_decl ~param.typeref.type, from);
-            //     }
-            // }
+            for (auto &method : structDecl->methods)
+            {
+                AddDecl(method->returnType.decl, context.Create(userDecl));
+                for (auto &param : method->params)
+                {
+                    AddDecl(param.ref.decl, context.Create(userDecl));
+                }
+            }
 
             return;
         }
     }
 }
 
+// the UserDecl under pointers, references and arrays
+static UserDecl *UsedDecl(const std::shared_ptr<Decl> &type)
+{
+    auto current = type.get();
+    for (int depth = 0; current && depth < 64; ++depth)
+    {
+        if (auto pointer = dynamic_cast<Pointer *>(current))
+        {
+            current = pointer->pointee.decl.get();
+        }
+        else if (auto reference = dynamic_cast<Reference *>(current))
+        {
+            current = reference->pointee.get();
+        }
+        else if (auto array = dynamic_cast<Array *>(current))
+        {
+            current = array->pointee.get();
+        }
+        else
+        {
+            return dynamic_cast<UserDecl *>(current);
+        }
+    }
+    return nullptr;
+}
+
+void ClangDeclProcessor::CountUses()
+{
+    UseCounts.clear();
+    auto use = [this](const std::shared_ptr<Decl> &type) {
+        if (auto used = UsedDecl(type))
+        {
+            ++UseCounts[used];
+        }
+    };
+    for (auto &[path, source] : SourceMap)
+    {
+        for (auto &decl : source->Decls)
+        {
+            if (auto typedefDecl = dynamic_cast<Typedef *>(decl.get()))
+            {
+                use(typedefDecl->ref.decl);
+            }
+            else if (auto functionDecl = dynamic_cast<FunctionDecl *>(decl.get()))
+            {
+                use(functionDecl->returnType.decl);
+                for (auto &param : functionDecl->params)
+                {
+                    use(param.ref.decl);
+                }
+            }
+            else if (auto structDecl = dynamic_cast<StructDecl *>(decl.get()))
+            {
+                for (auto &field : structDecl->fields)
+                {
+                    use(field.ref.decl);
+                }
+            }
+        }
+    }
+}
+
+uint32_t ClangDeclProcessor::UseCount(const UserDecl *decl) const
+{
+    auto found = UseCounts.find(decl);
+    return found == UseCounts.end() ? 0 : found->second;
+}
+
+void ClangDeclProcessor::SortByNamespace()
+{
+    for (auto &[path, source] : SourceMap)
+    {
+        // 関数だけ並べ替えて元の関数の位置に戻す。型の順番(_anonymous_N の番号)は変えない
+        std::vector<size_t> slots;
+        std::vector<std::shared_ptr<UserDecl>> functions;
+        for (size_t i = 0; i < source->Decls.size(); ++i)
+        {
+            if (dynamic_cast<FunctionDecl *>(source->Decls[i].get()))
+            {
+                slots.push_back(i);
+                functions.push_back(source->Decls[i]);
+            }
+        }
+        std::stable_sort(functions.begin(), functions.end(),
+                         [](auto &lhs, auto &rhs) { return lhs->namespaceId < rhs->namespaceId; });
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            source->Decls[slots[i]] = functions[i];
+        }
+        source->SortedByNamespace = true;
+    }
+}
+
 } // namespace clalua
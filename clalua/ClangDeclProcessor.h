@@ -1,6 +1,7 @@
 #pragma once
 #include "ClangDecl.h"
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <filesystem>
 
@@ -17,6 +18,8 @@ struct Source
 
     std::vector<std::string> Imports;
     std::vector<std::shared_ptr<UserDecl>> Decls;
+    // ClangDeclProcessor::SortByNamespace
+    bool SortedByNamespace = false;
 
     void AddImport(const std::string &path)
     {
@@ -76,13 +79,36 @@ struct ProcessorContext
     }
 };
 
+class DeclIndex;
+class ParseProgress;
+
 class ClangDeclProcessor
 {
     std::shared_ptr<Source> GetOrCreateSource(const std::string &path);
 
+    std::once_flag m_indexOnce;
+    std::shared_ptr<DeclIndex> m_index;
+
 public:
     std::unordered_map<std::string, SourcePtr> SourceMap;
+    // counts AddDecl while building the closure. nullptr after that
+    ParseProgress *Progress = nullptr;
     void AddDecl(const std::shared_ptr<Decl> &decl, const ProcessorContext &context);
+
+    // stable sort the functions in Decls of each source by namespaceId(ResolveDecls).
+    // other decls keep their positions
+    void SortByNamespace();
+
+    // CountUses: references from decls of the closure(through pointer, reference, array).
+    // closure 毎に持つ. ClangSession の closure は同じ TU の UserDecl を共有する
+    std::unordered_map<const UserDecl *, uint32_t> UseCounts;
+
+    // UseCounts of the closure. one pass over SourceMap
+    void CountUses();
+    uint32_t UseCount(const UserDecl *decl) const;
+
+    // clalua.query. built on the first call(thread safe). SourceMap must not change after that
+    const DeclIndex &Index();
 };
 
 } // namespace clalua
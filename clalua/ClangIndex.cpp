@@ -1,6 +1,12 @@
 #include "ClangIndex.h"
 #include "ClangCursorTraverser.h"
+#include "ClangTU.h"
+#include "DeclResolve.h"
+#include "MemoryUsage.h"
+#include "ParseProgress.h"
+#include "Trace.h"
 #include <clang-c/Index.h>
+#include <chrono>
 #include <fmt/format.h>
 #include <functional>
 #include <tcb/span.hpp>
@@ -8,6 +14,117 @@
 namespace clalua
 {
 
+std::vector<CXUnsavedFile> ClangMainFile::UnsavedFiles() const
+{
+    std::vector<CXUnsavedFile> files;
+    if (!Unsaved.empty())
+    {
+        files.push_back(CXUnsavedFile{Path.c_str(), Unsaved.c_str(), static_cast<unsigned long>(Unsaved.size())});
+    }
+    return files;
+}
+
+ClangMainFile MakeMainFile(tcb::span<std::string> headers)
+{
+    if (headers.size() == 1)
+    {
+        return {headers[0], ""};
+    }
+
+    std::string sb;
+    for (auto &header : headers)
+    {
+        sb += fmt::format("#include \"{0}\"\n", header);
+    }
+    // use unsaved files
+    return {"__tmp__dclangen__.h", sb};
+}
+
+std::vector<std::string> ClangParams(tcb::span<std::string> includes, tcb::span<std::string> defines)
+{
+    std::vector<std::string> params = {
+        "-x",
+        "c++",
+        "-target",
+        "x86_64-windows-msvc",
+        "-fms-compatibility-version=18",
+        "-fdeclspec",
+        "-fms-compatibility",
+    };
+    for (auto &include : includes)
+    {
+        params.push_back(fmt::format("-I{0}", include));
+    }
+    for (auto &define : defines)
+    {
+        params.push_back(fmt::format("-D{0}", define));
+    }
+    return params;
+}
+
+CXTranslationUnit ParseTU(CXIndex index, const ClangMainFile &main, tcb::span<std::string> params, unsigned options)
+{
+    std::vector<const char *> c_params;
+    for (auto &param : params)
+    {
+        c_params.push_back(param.c_str());
+    }
+    auto files = main.UnsavedFiles();
+    return clang_parseTranslationUnit(index, main.Path.c_str(), c_params.data(), static_cast<int>(c_params.size()),
+                                      files.data(), static_cast<unsigned>(files.size()), options);
+}
+
+void GetTuMemory(CXTranslationUnit tu, ParsePhases *phases)
+{
+    auto usage = clang_getCXTUResourceUsage(tu);
+    phases->TuMemory.clear();
+    phases->TuMemoryBytes = 0;
+    for (unsigned i = 0; i < usage.numEntries; ++i)
+    {
+        auto &entry = usage.entries[i];
+        phases->TuMemory.emplace_back(clang_getTUResourceUsageName(entry.kind), entry.amount);
+        phases->TuMemoryBytes += entry.amount;
+    }
+    clang_disposeCXTUResourceUsage(usage);
+}
+
+static double ElapsedMs(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+size_t CountIncludedFiles(CXTranslationUnit tu)
+{
+    size_t count = 0;
+    clang_getInclusions(
+        tu, [](CXFile, CXSourceLocation *, unsigned, CXClientData data) { ++*static_cast<size_t *>(data); }, &count);
+    return count;
+}
+
+std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> TraverseTU(CXTranslationUnit tu, ParsePhases *phases,
+                                                                   ParseProgress *progress)
+{
+    if (progress)
+    {
+        progress->SetFiles(CountIncludedFiles(tu));
+        progress->Phase("traverse");
+    }
+    auto begin = std::chrono::steady_clock::now();
+    std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> map;
+    {
+        TraceScope scope("clang.traverse");
+        auto cursor = clang_getTranslationUnitCursor(tu);
+        map = Traverse(cursor, progress);
+        ResolveDecls(map);
+    }
+    if (phases)
+    {
+        phases->TraverseMs = ElapsedMs(begin);
+        phases->TraversePeakRss = PeakRssBytes();
+    }
+    return map;
+}
+
 struct ClangIndexImpl
 {
     CXIndex m_index = nullptr;
@@ -28,84 +145,39 @@ struct ClangIndexImpl
 
     bool Parse(tcb::span<std::string> headers, tcb::span<std::string> includes, tcb::span<std::string> defines)
     {
-        std::vector<std::string> params = {
-            "-x",
-            "c++",
-            "-target",
-            "x86_64-windows-msvc",
-            "-fms-compatibility-version=18",
-            "-fdeclspec",
-            "-fms-compatibility",
-        };
-        for (auto &include : includes)
-        {
-            params.push_back(fmt::format("-I{0}", include));
-        }
-        for (auto &define : defines)
-        {
-            params.push_back(fmt::format("-D{0}", define));
-        }
-
+        auto params = ClangParams(includes, defines);
         // LOGD << params;
-        if (!getTU(headers, params))
-        {
-            return false;
-        }
-
-        return true;
-    }
-
-    CXCursor GetRootCursor()
-    {
-        return clang_getTranslationUnitCursor(m_tu);
-    }
-
-private:
-    bool getTU(tcb::span<std::string> headers, tcb::span<std::string> params)
-    {
-        std::vector<const char *> c_params;
-        for (auto &param : params)
-        {
-            c_params.push_back(param.c_str());
-        }
-
         auto options = CXTranslationUnit_DetailedPreprocessingRecord
             // | CXTranslationUnit_SkipFunctionBodies
             ;
-        if (headers.size() == 1)
-        {
-            m_tu = clang_parseTranslationUnit(m_index, headers[0].c_str(), c_params.data(), params.size(), nullptr, 0,
-                                              options);
-        }
-        else
-        {
-            std::string sb;
-            for (auto &header : headers)
-            {
-                sb += fmt::format("#include \"{0}\"\n", header);
-            }
-
-            // use unsaved files
-            std::vector<CXUnsavedFile> files;
-            files.push_back(CXUnsavedFile{"__tmp__dclangen__.h", sb.c_str(), static_cast<unsigned long>(sb.size())});
-
-            m_tu = clang_parseTranslationUnit(m_index, "__tmp__dclangen__.h", c_params.data(), params.size(),
-                                              files.data(), files.size(), options);
-        }
+        m_tu = ParseTU(m_index, MakeMainFile(headers), params, options);
         return m_tu != nullptr;
     }
 };
 
-std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Parse(tcb::span<std::string> headers, tcb::span<std::string> includes, tcb::span<std::string> defines)
+std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Parse(tcb::span<std::string> headers, tcb::span<std::string> includes, tcb::span<std::string> defines, ParsePhases *phases, ParseProgress *progress)
 {
+    if (progress)
+    {
+        progress->Phase("parse");
+    }
     ClangIndexImpl impl;
-    if (!impl.Parse(headers, includes, defines))
+    auto begin = std::chrono::steady_clock::now();
     {
-        return {};
+        TraceScope scope("clang.parse");
+        auto parse = [&] { return impl.Parse(headers, includes, defines); };
+        if (!(progress ? progress->Run(parse) : parse()))
+        {
+            return {};
+        }
     }
-
-    auto cursor = impl.GetRootCursor();
-    return Traverse(cursor);
+    if (phases)
+    {
+        phases->ParseMs = ElapsedMs(begin);
+        phases->ParsePeakRss = PeakRssBytes();
+        GetTuMemory(impl.m_tu, phases);
+    }
+    return TraverseTU(impl.m_tu, phases, progress);
 }
 
 } // namespace clalua
@@ -3,12 +3,27 @@
 #include <string>
 #include <unordered_map>
 #include <memory>
+#include <vector>
 
 namespace clalua
 {
 struct UserDecl;
+class ParseProgress;
 
-std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Parse(tcb::span<std::string> headers, tcb::span<std::string> include_dirs, tcb::span<std::string> defines);
+// Parse の内訳
+struct ParsePhases
+{
+    double ParseMs = 0;
+    double TraverseMs = 0;
+    // peak RSS at the end of each phase
+    size_t ParsePeakRss = 0;
+    size_t TraversePeakRss = 0;
+    // clang_getCXTUResourceUsage. kind name => bytes
+    std::vector<std::pair<std::string, size_t>> TuMemory;
+    size_t TuMemoryBytes = 0;
+};
+
+std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Parse(tcb::span<std::string> headers, tcb::span<std::string> include_dirs, tcb::span<std::string> defines, ParsePhases *phases = nullptr, ParseProgress *progress = nullptr);
 
 inline std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Parse(const std::string &header, const std::string &include_dir)
 {
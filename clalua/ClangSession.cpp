@@ -0,0 +1,317 @@
+#include "ClangSession.h"
+#include "ClangTU.h"
+#include "Hash.h"
+#include "MemoryUsage.h"
+#include "Trace.h"
+#include "clalua.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace clalua
+{
+
+const char *SessionParseName(SessionParse status)
+{
+    switch (status)
+    {
+    case SessionParse::Parsed:
+        return "parsed";
+    case SessionParse::Reparsed:
+        return "reparsed";
+    case SessionParse::Reused:
+        return "reused";
+    case SessionParse::Closure:
+        return "closure";
+    }
+    return "";
+}
+
+struct FileStamp
+{
+    std::string Path;
+    std::filesystem::file_time_type MTime;
+    uintmax_t Size = 0;
+    // of the contents clang parsed
+    uint64_t Hash = 0;
+};
+
+// mtime の精度(FAT: 2秒)の分、parse 開始より前に更新された file も信用しない
+static constexpr auto MTIME_SLACK = std::chrono::seconds(2);
+
+struct ClangSession::Entry
+{
+    CXTranslationUnit Tu = nullptr;
+    ClangMainFile Main;
+    std::vector<FileStamp> Files;
+    // parse を始めた時刻. これより後の mtime は記録しない
+    std::filesystem::file_time_type ParseBegin;
+    // traverse 結果. closure を作りなおす
+    std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> Map;
+    ParsePhases Phases;
+    // ParseInput::ClosureKey => graph
+    std::unordered_map<std::string, ParsedGraphPtr> Graphs;
+    uint64_t LastUse = 0;
+
+    ~Entry()
+    {
+        if (Tu)
+        {
+            clang_disposeTranslationUnit(Tu);
+        }
+    }
+
+    static void OnInclusion(CXFile file, CXSourceLocation *, unsigned, CXClientData data)
+    {
+        auto entry = static_cast<Entry *>(data);
+        auto name = clang_getFileName(file);
+        std::string path = clang_getCString(name);
+        clang_disposeString(name);
+        if (!entry->Main.Unsaved.empty() && path == entry->Main.Path)
+        {
+            // unsaved file
+            return;
+        }
+
+        FileStamp stamp;
+        stamp.Path = path;
+        std::error_code ec;
+        stamp.MTime = std::filesystem::last_write_time(path, ec);
+        if (ec || stamp.MTime + MTIME_SLACK >= entry->ParseBegin)
+        {
+            // parse 中に書き換えられたかもしれない. 次は内容(Hash)を比べる
+            stamp.MTime = std::filesystem::file_time_type::min();
+        }
+        stamp.Size = std::filesystem::file_size(path, ec);
+        size_t size = 0;
+        if (auto contents = clang_getFileContents(entry->Tu, file, &size))
+        {
+            stamp.Hash = Fnv1a(contents, size);
+        }
+        entry->Files.push_back(std::move(stamp));
+    }
+
+    void StampFiles()
+    {
+        Files.clear();
+        clang_getInclusions(Tu, &Entry::OnInclusion, this);
+    }
+
+    // true if a file is changed. updates the mtime of touched files
+    bool Changed()
+    {
+        for (auto &stamp : Files)
+        {
+            std::error_code ec;
+            auto mtime = std::filesystem::last_write_time(stamp.Path, ec);
+            if (ec)
+            {
+                return true;
+            }
+            auto size = std::filesystem::file_size(stamp.Path, ec);
+            if (ec || size != stamp.Size)
+            {
+                return true;
+            }
+            if (mtime == stamp.MTime)
+            {
+                continue;
+            }
+
+            std::ifstream ifs(stamp.Path, std::ios::binary);
+            std::ostringstream ss;
+            ss << ifs.rdbuf();
+            if (!ifs || Fnv1a(ss.str()) != stamp.Hash)
+            {
+                return true;
+            }
+            // touched only
+            stamp.MTime = mtime;
+        }
+        return false;
+    }
+};
+
+static double ElapsedMs(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+ClangSession::ClangSession(size_t maxTus) : m_index(clang_createIndex(0, 1)), m_maxTus(maxTus ? maxTus : 1)
+{
+}
+
+ClangSession::~ClangSession()
+{
+    // TU を先に
+    m_entries.clear();
+    clang_disposeIndex(m_index);
+}
+
+ParsedGraphPtr ClangSession::Parse(const ParseInput &input, SessionParse *status)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto tuKey = input.TuKey();
+    auto closureKey = input.ClosureKey();
+    auto &entry = m_entries[tuKey];
+    if (entry && entry->Tu)
+    {
+        entry->LastUse = ++m_clock;
+        if (!entry->Changed())
+        {
+            auto found = entry->Graphs.find(closureKey);
+            if (found != entry->Graphs.end())
+            {
+                ++m_stats.Reused;
+                *status = SessionParse::Reused;
+                return found->second;
+            }
+
+            // 同じ TU の別の sort / prune. traverse 結果から closure だけ作る
+            auto graph = std::make_shared<ParsedGraph>();
+            graph->Phases = entry->Phases;
+            graph->Phases.ParseMs = 0;
+            graph->Phases.TraverseMs = 0;
+            BuildClosure(entry->Map, input, graph.get());
+            entry->Graphs[closureKey] = graph;
+            ++m_stats.Closures;
+            *status = SessionParse::Closure;
+            return graph;
+        }
+    }
+
+    auto graph = std::make_shared<ParsedGraph>();
+    if (input.Progress)
+    {
+        input.Progress->Phase("parse");
+    }
+    auto begin = std::chrono::steady_clock::now();
+    auto parseBegin = std::filesystem::file_time_type::clock::now();
+    {
+        TraceScope scope("clang.parse");
+        auto reparsed = false;
+        if (entry && entry->Tu)
+        {
+            auto files = entry->Main.UnsavedFiles();
+            auto reparse = [&] {
+                return clang_reparseTranslationUnit(entry->Tu, static_cast<unsigned>(files.size()), files.data(),
+                                                    clang_defaultReparseOptions(entry->Tu));
+            };
+            if ((input.Progress ? input.Progress->Run(reparse) : reparse()) == 0)
+            {
+                reparsed = true;
+            }
+            else
+            {
+                // the TU is invalid after a failure
+                clang_disposeTranslationUnit(entry->Tu);
+                entry->Tu = nullptr;
+            }
+        }
+        if (reparsed)
+        {
+            ++m_stats.Reparsed;
+            *status = SessionParse::Reparsed;
+        }
+        else
+        {
+            auto headers = input.Headers;
+            auto includes = input.Includes;
+            auto defines = input.Defines;
+            entry = std::make_unique<Entry>();
+            entry->Main = MakeMainFile(headers);
+            auto params = ClangParams(includes, defines);
+            // 2回目からは #include の preamble を使いまわす
+            auto parse = [&] {
+                return ParseTU(m_index, entry->Main, params,
+                               CXTranslationUnit_DetailedPreprocessingRecord |
+                                   CXTranslationUnit_CreatePreambleOnFirstParse);
+            };
+            entry->Tu = input.Progress ? input.Progress->Run(parse) : parse();
+            ++m_stats.Parsed;
+            *status = SessionParse::Parsed;
+        }
+    }
+    if (!entry->Tu)
+    {
+        m_entries.erase(tuKey);
+        return graph;
+    }
+    graph->Phases.ParseMs = ElapsedMs(begin);
+    graph->Phases.ParsePeakRss = PeakRssBytes();
+    GetTuMemory(entry->Tu, &graph->Phases);
+
+    entry->ParseBegin = parseBegin;
+    entry->StampFiles();
+    entry->Map = TraverseTU(entry->Tu, &graph->Phases, input.Progress);
+    entry->Phases = graph->Phases;
+    BuildClosure(entry->Map, input, graph.get());
+    entry->Graphs.clear();
+    entry->Graphs[closureKey] = graph;
+    entry->LastUse = ++m_clock;
+    Evict();
+    return graph;
+}
+
+void ClangSession::Evict()
+{
+    while (m_entries.size() > m_maxTus)
+    {
+        auto oldest = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            if (it->second->LastUse < oldest->second->LastUse)
+            {
+                oldest = it;
+            }
+        }
+        m_entries.erase(oldest);
+        ++m_stats.Evicted;
+    }
+}
+
+void ClangSession::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+SessionStats ClangSession::Stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto stats = m_stats;
+    stats.Tus = m_entries.size();
+    return stats;
+}
+
+static std::mutex g_sessionMutex;
+static std::shared_ptr<ClangSession> g_session;
+
+std::shared_ptr<ClangSession> GetDefaultSession()
+{
+    std::lock_guard<std::mutex> lock(g_sessionMutex);
+    return g_session;
+}
+
+void EnableDefaultSession(bool enable, size_t maxTus)
+{
+    std::lock_guard<std::mutex> lock(g_sessionMutex);
+    if (!enable)
+    {
+        // parse 中の thread が持っていれば、そちらが最後に解放する
+        g_session.reset();
+    }
+    else if (!g_session)
+    {
+        g_session = std::make_shared<ClangSession>(maxTus);
+    }
+}
+
+} // namespace clalua
+
+void clalua_parse_session(int max_tus)
+{
+    clalua::EnableDefaultSession(max_tus > 0, static_cast<size_t>(max_tus));
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "ParseCache.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace clalua
+{
+
+enum class SessionParse
+{
+    // new TU
+    Parsed,
+    // an included file changed. clang_reparseTranslationUnit(reuses the preamble)
+    Reparsed,
+    // nothing changed. the graph of the last parse
+    Reused,
+    // nothing changed. the closure is built for a new sort / prune from the last traversal
+    Closure,
+};
+const char *SessionParseName(SessionParse status);
+
+struct SessionStats
+{
+    size_t Tus = 0;
+    size_t Parsed = 0;
+    size_t Reparsed = 0;
+    size_t Reused = 0;
+    size_t Closures = 0;
+    size_t Evicted = 0;
+};
+
+///
+/// CXIndex と TU を保持して、同じ ParseInput の parse を再利用する
+///
+/// TU は Headers, Includes, Defines(ParseInput::TuKey)毎。
+/// closure は TU の traverse 結果から sort, prune(ParseInput::ClosureKey)毎に作って覚えておく。
+///
+/// TU 毎に include された file の mtime, size, hash(clang が読んだ内容)を覚えておき、
+/// 次の Parse で
+/// - 全部同じなら前回の graph をそのまま返す
+/// - mtime が変わっても内容が同じなら mtime だけ更新する
+/// - 内容が変わっていたら clang_reparseTranslationUnit して traverse しなおす
+/// parse 中に更新された file は mtime を記録しないので、次の Parse で内容を比べる
+///
+/// MaxTus を超えたら一番使っていない TU を捨てる。thread safe(Parse は直列)
+///
+class ClangSession
+{
+    struct Entry;
+
+    void *m_index = nullptr;
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> m_entries;
+    uint64_t m_clock = 0;
+    size_t m_maxTus;
+    SessionStats m_stats;
+
+    void Evict();
+
+public:
+    explicit ClangSession(size_t maxTus = 8);
+    ~ClangSession();
+    ClangSession(const ClangSession &) = delete;
+    ClangSession &operator=(const ClangSession &) = delete;
+
+    // no Processor if libclang fails to parse
+    ParsedGraphPtr Parse(const ParseInput &input, SessionParse *status);
+
+    // dispose all TUs
+    void Clear();
+
+    SessionStats Stats();
+};
+
+// clalua_parse_session. nullptr if disabled
+std::shared_ptr<ClangSession> GetDefaultSession();
+void EnableDefaultSession(bool enable, size_t maxTus);
+
+} // namespace clalua
@@ -0,0 +1,36 @@
+#pragma once
+#include "ClangIndex.h"
+#include <clang-c/Index.h>
+#include <string>
+#include <vector>
+
+namespace clalua
+{
+
+// clang_parseTranslationUnit の main file
+struct ClangMainFile
+{
+    std::string Path;
+    // headers が複数なら #include を並べた unsaved file. empty: Path を disk から読む
+    std::string Unsaved;
+
+    std::vector<CXUnsavedFile> UnsavedFiles() const;
+};
+ClangMainFile MakeMainFile(tcb::span<std::string> headers);
+
+std::vector<std::string> ClangParams(tcb::span<std::string> includes, tcb::span<std::string> defines);
+
+CXTranslationUnit ParseTU(CXIndex index, const ClangMainFile &main, tcb::span<std::string> params,
+                          unsigned options);
+
+// clang_getCXTUResourceUsage
+void GetTuMemory(CXTranslationUnit tu, ParsePhases *phases);
+
+// clang_getInclusions. files read by the TU
+size_t CountIncludedFiles(CXTranslationUnit tu);
+
+// Traverse and ResolveDecls. phases: TraverseMs, TraversePeakRss
+std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> TraverseTU(CXTranslationUnit tu, ParsePhases *phases,
+                                                                   ParseProgress *progress = nullptr);
+
+} // namespace clalua
@@ -0,0 +1,576 @@
+#include "DeclFingerprint.h"
+#include "ClangDeclProcessor.h"
+#include "DeclIndex.h"
+#include "DeclResolve.h"
+#include "Hash.h"
+#include "LuaPush.h"
+#include "Trace.h"
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+static const uint64_t FNV_BASIS = 14695981039346656037ull;
+
+class FingerprintBuilder
+{
+    uint64_t m_hash = FNV_BASIS;
+
+public:
+    void Add(std::string_view src)
+    {
+        // 区切り込み
+        m_hash = Fnv1a(src, m_hash);
+        m_hash = Fnv1a("\0", 1, m_hash);
+    }
+
+    void Add(uint64_t value)
+    {
+        m_hash = Fnv1a(&value, sizeof(value), m_hash);
+    }
+
+    uint64_t Hash() const
+    {
+        // 0 は未計算
+        return m_hash ? m_hash : 1;
+    }
+};
+
+static std::string_view KeyName(const UserDecl &decl)
+{
+    return decl.qualifiedName.empty() ? std::string_view(decl.name) : std::string_view(decl.qualifiedName);
+}
+
+std::string DeclKey(const UserDecl &decl)
+{
+    auto name = KeyName(decl);
+    if (name.empty())
+    {
+        return "";
+    }
+    std::string key = DeclClass(decl);
+    key += ' ';
+    key += name;
+    return key;
+}
+
+static uint64_t Fingerprint(UserDecl &decl, int depth);
+
+static void AddType(FingerprintBuilder &builder, const std::shared_ptr<Decl> &type, int depth)
+{
+    if (!type)
+    {
+        builder.Add("null");
+        return;
+    }
+    builder.Add(DeclClass(*type));
+    if (auto pointer = std::dynamic_pointer_cast<Pointer>(type))
+    {
+        builder.Add(pointer->pointee.isConst ? 1 : 0);
+        AddType(builder, pointer->pointee.decl, depth);
+    }
+    else if (auto reference = std::dynamic_pointer_cast<Reference>(type))
+    {
+        AddType(builder, reference->pointee, depth);
+    }
+    else if (auto array = std::dynamic_pointer_cast<Array>(type))
+    {
+        builder.Add(static_cast<uint64_t>(array->size));
+        AddType(builder, array->pointee, depth);
+    }
+    else if (auto userDecl = std::dynamic_pointer_cast<UserDecl>(type))
+    {
+        auto name = KeyName(*userDecl);
+        if (!name.empty() && !std::dynamic_pointer_cast<FunctionDecl>(userDecl))
+        {
+            // 名前で参照する。中身の変更は参照先の fingerprint に出る
+            builder.Add(name);
+        }
+        else
+        {
+            // 無名の struct, 関数型(名前は field や引数のもの)
+            builder.Add(Fingerprint(*userDecl, depth + 1));
+        }
+    }
+}
+
+static void AddRef(FingerprintBuilder &builder, const TypeReference &ref, int depth)
+{
+    builder.Add(ref.isConst ? 1 : 0);
+    AddType(builder, ref.decl, depth);
+}
+
+// return type, params. functions and methods
+static void AddSignature(FingerprintBuilder &builder, const FunctionDecl &functionDecl, int depth)
+{
+    AddRef(builder, functionDecl.returnType, depth);
+    builder.Add(functionDecl.params.size());
+    for (auto &param : functionDecl.params)
+    {
+        builder.Add(param.name);
+        AddRef(builder, param.ref, depth);
+    }
+    builder.Add(functionDecl.isVariadic ? 1 : 0);
+}
+
+static uint64_t Fingerprint(UserDecl &decl, int depth)
+{
+    if (decl.fingerprint)
+    {
+        return decl.fingerprint;
+    }
+    if (depth > 64)
+    {
+        // 無名の decl の循環
+        return 1;
+    }
+
+    FingerprintBuilder builder;
+    builder.Add(DeclClass(decl));
+    builder.Add(KeyName(decl));
+    if (auto typedefDecl = dynamic_cast<Typedef *>(&decl))
+    {
+        AddRef(builder, typedefDecl->ref, depth);
+    }
+    else if (auto functionDecl = dynamic_cast<FunctionDecl *>(&decl))
+    {
+        AddSignature(builder, *functionDecl, depth);
+        builder.Add(functionDecl->dllExport ? 1 : 0);
+    }
+    else if (auto enumDecl = dynamic_cast<EnumDecl *>(&decl))
+    {
+        builder.Add(enumDecl->values.size());
+        for (auto &value : enumDecl->values)
+        {
+            builder.Add(value.name);
+            builder.Add(value.value);
+        }
+    }
+    else if (auto structDecl = dynamic_cast<StructDecl *>(&decl))
+    {
+        builder.Add(structDecl->isUnion ? 1 : 0);
+        builder.Add(structDecl->isForwardDecl ? 1 : 0);
+        if (structDecl->isForwardDecl && structDecl->definition && structDecl->definition.get() != structDecl)
+        {
+            builder.Add(Fingerprint(*structDecl->definition, depth + 1));
+        }
+        builder.Add(structDecl->fields.size());
+        for (auto &field : structDecl->fields)
+        {
+            builder.Add(field.offset);
+            builder.Add(field.name);
+            AddRef(builder, field.ref, depth);
+        }
+        builder.Add(structDecl->isInterface ? 1 : 0);
+        builder.Add(structDecl->iid);
+        AddType(builder, structDecl->base, depth);
+        builder.Add(structDecl->methods.size());
+        for (auto &method : structDecl->methods)
+        {
+            builder.Add(method->name);
+            AddSignature(builder, *method, depth);
+        }
+    }
+    decl.fingerprint = builder.Hash();
+    return decl.fingerprint;
+}
+
+// the UserDecl under pointers, references and arrays
+static UserDecl *ReferencedDecl(const std::shared_ptr<Decl> &type)
+{
+    auto current = type.get();
+    for (int depth = 0; current && depth < 64; ++depth)
+    {
+        if (auto pointer = dynamic_cast<Pointer *>(current))
+        {
+            current = pointer->pointee.decl.get();
+        }
+        else if (auto reference = dynamic_cast<Reference *>(current))
+        {
+            current = reference->pointee.get();
+        }
+        else if (auto array = dynamic_cast<Array *>(current))
+        {
+            current = array->pointee.get();
+        }
+        else
+        {
+            return dynamic_cast<UserDecl *>(current);
+        }
+    }
+    return nullptr;
+}
+
+///
+/// deepFingerprint. 参照の graph の強連結成分(Tarjan)毎に
+/// hash(成分の fingerprint(sorted), 参照先の成分の hash(sorted))
+///
+class DeepFingerprints
+{
+    static constexpr uint32_t UNVISITED = UINT32_MAX;
+
+    std::unordered_map<UserDecl *, uint32_t> m_ids;
+    std::vector<UserDecl *> m_nodes;
+    std::vector<std::vector<uint32_t>> m_edges;
+
+    std::vector<uint32_t> m_index;
+    std::vector<uint32_t> m_low;
+    std::vector<bool> m_onStack;
+    std::vector<uint32_t> m_stack;
+    std::vector<uint32_t> m_component;
+    std::vector<uint64_t> m_componentHash;
+    uint32_t m_counter = 0;
+
+    uint32_t Id(UserDecl *decl)
+    {
+        auto [found, inserted] = m_ids.try_emplace(decl, static_cast<uint32_t>(m_nodes.size()));
+        if (inserted)
+        {
+            m_nodes.push_back(decl);
+        }
+        return found->second;
+    }
+
+    void AddEdge(uint32_t from, const std::shared_ptr<Decl> &type)
+    {
+        if (auto to = ReferencedDecl(type))
+        {
+            auto id = Id(to);
+            m_edges[from].push_back(id);
+        }
+    }
+
+    void AddEdges(uint32_t id)
+    {
+        auto decl = m_nodes[id];
+        if (auto typedefDecl = dynamic_cast<Typedef *>(decl))
+        {
+            AddEdge(id, typedefDecl->ref.decl);
+        }
+        else if (auto functionDecl = dynamic_cast<FunctionDecl *>(decl))
+        {
+            AddEdge(id, functionDecl->returnType.decl);
+            for (auto &param : functionDecl->params)
+            {
+                AddEdge(id, param.ref.decl);
+            }
+        }
+        else if (auto structDecl = dynamic_cast<StructDecl *>(decl))
+        {
+            AddEdge(id, structDecl->definition);
+            for (auto &field : structDecl->fields)
+            {
+                AddEdge(id, field.ref.decl);
+            }
+            AddEdge(id, structDecl->base);
+            // method は decl map に無いので struct から参照する
+            for (auto &method : structDecl->methods)
+            {
+                AddEdge(id, method->returnType.decl);
+                for (auto &param : method->params)
+                {
+                    AddEdge(id, param.ref.decl);
+                }
+            }
+        }
+    }
+
+    void Visit(uint32_t root)
+    {
+        // (node, next edge)
+        std::vector<std::pair<uint32_t, size_t>> calls;
+        auto enter = [this, &calls](uint32_t v) {
+            m_index[v] = m_low[v] = m_counter++;
+            m_stack.push_back(v);
+            m_onStack[v] = true;
+            calls.push_back({v, 0});
+        };
+        enter(root);
+        while (!calls.empty())
+        {
+            auto u = calls.back().first;
+            auto &next = calls.back().second;
+            if (next < m_edges[u].size())
+            {
+                auto w = m_edges[u][next++];
+                if (m_index[w] == UNVISITED)
+                {
+                    enter(w);
+                }
+                else if (m_onStack[w])
+                {
+                    m_low[u] = std::min(m_low[u], m_index[w]);
+                }
+                continue;
+            }
+
+            calls.pop_back();
+            if (!calls.empty())
+            {
+                auto parent = calls.back().first;
+                m_low[parent] = std::min(m_low[parent], m_low[u]);
+            }
+            if (m_low[u] == m_index[u])
+            {
+                PopComponent(u);
+            }
+        }
+    }
+
+    // 参照先の成分は全部先に終わっている
+    void PopComponent(uint32_t root)
+    {
+        auto component = static_cast<uint32_t>(m_componentHash.size());
+        std::vector<uint32_t> members;
+        while (true)
+        {
+            auto v = m_stack.back();
+            m_stack.pop_back();
+            m_onStack[v] = false;
+            m_component[v] = component;
+            members.push_back(v);
+            if (v == root)
+            {
+                break;
+            }
+        }
+
+        std::vector<uint64_t> fingerprints;
+        std::vector<uint64_t> successors;
+        for (auto v : members)
+        {
+            fingerprints.push_back(Fingerprint(*m_nodes[v], 0));
+            for (auto w : m_edges[v])
+            {
+                if (m_component[w] != component)
+                {
+                    successors.push_back(m_componentHash[m_component[w]]);
+                }
+            }
+        }
+        std::sort(fingerprints.begin(), fingerprints.end());
+        std::sort(successors.begin(), successors.end());
+        successors.erase(std::unique(successors.begin(), successors.end()), successors.end());
+
+        FingerprintBuilder builder;
+        for (auto fingerprint : fingerprints)
+        {
+            builder.Add(fingerprint);
+        }
+        builder.Add("->");
+        for (auto successor : successors)
+        {
+            builder.Add(successor);
+        }
+        auto hash = builder.Hash();
+        m_componentHash.push_back(hash);
+
+        for (auto v : members)
+        {
+            FingerprintBuilder deep;
+            deep.Add(m_nodes[v]->fingerprint);
+            deep.Add(hash);
+            m_nodes[v]->deepFingerprint = deep.Hash();
+        }
+    }
+
+public:
+    explicit DeepFingerprints(const ClangDeclProcessor &graph)
+    {
+        for (auto &[path, source] : graph.SourceMap)
+        {
+            for (auto &decl : source->Decls)
+            {
+                Id(decl.get());
+            }
+        }
+        // 参照先を辿って node を増やす
+        for (uint32_t id = 0; id < m_nodes.size(); ++id)
+        {
+            m_edges.emplace_back();
+            AddEdges(id);
+        }
+
+        m_index.assign(m_nodes.size(), UNVISITED);
+        m_low.assign(m_nodes.size(), 0);
+        m_onStack.assign(m_nodes.size(), false);
+        m_component.assign(m_nodes.size(), UNVISITED);
+        for (uint32_t id = 0; id < m_nodes.size(); ++id)
+        {
+            if (m_index[id] == UNVISITED)
+            {
+                Visit(id);
+            }
+        }
+    }
+};
+
+void ComputeFingerprints(const ClangDeclProcessor &graph)
+{
+    TraceScope scope("fingerprint");
+    for (auto &[path, source] : graph.SourceMap)
+    {
+        for (auto &decl : source->Decls)
+        {
+            Fingerprint(*decl, 0);
+        }
+    }
+    DeepFingerprints deep(graph);
+}
+
+struct KeyedDecl
+{
+    std::shared_ptr<UserDecl> Decl;
+    // 同じ key の decl(overload, 再宣言)の fingerprint を順番に依らず合わせる
+    uint64_t Fingerprint = 0;
+};
+
+static std::vector<std::pair<std::string, KeyedDecl>> KeyDecls(ClangDeclProcessor &graph,
+                                                             std::unordered_map<std::string, size_t> *indexOf)
+{
+    std::vector<std::pair<std::string, KeyedDecl>> keyed;
+    for (auto &decl : graph.Index().Decls)
+    {
+        if (auto structDecl = std::dynamic_pointer_cast<StructDecl>(decl))
+        {
+            if (structDecl->isForwardDecl && structDecl->definition)
+            {
+                // definition の方で比べる
+                continue;
+            }
+        }
+        auto key = DeclKey(*decl);
+        if (key.empty())
+        {
+            continue;
+        }
+        auto [found, inserted] = indexOf->try_emplace(key, keyed.size());
+        if (inserted)
+        {
+            keyed.push_back({key, {decl, 0}});
+        }
+        keyed[found->second].second.Fingerprint += decl->fingerprint;
+    }
+    return keyed;
+}
+
+DeclDiff DiffGraphs(ClangDeclProcessor &before, ClangDeclProcessor &after)
+{
+    TraceScope scope("diff");
+    std::unordered_map<std::string, size_t> beforeIndex;
+    auto beforeDecls = KeyDecls(before, &beforeIndex);
+    std::unordered_map<std::string, size_t> afterIndex;
+    auto afterDecls = KeyDecls(after, &afterIndex);
+
+    DeclDiff diff;
+    for (auto &[key, decl] : afterDecls)
+    {
+        auto found = beforeIndex.find(key);
+        if (found == beforeIndex.end())
+        {
+            diff.Added.push_back(decl.Decl);
+        }
+        else if (beforeDecls[found->second].second.Fingerprint != decl.Fingerprint)
+        {
+            diff.Changed.push_back({beforeDecls[found->second].second.Decl, decl.Decl});
+        }
+    }
+    for (auto &[key, decl] : beforeDecls)
+    {
+        if (afterIndex.find(key) == afterIndex.end())
+        {
+            diff.Removed.push_back(decl.Decl);
+        }
+    }
+    return diff;
+}
+
+//
+// lua
+//
+static void CheckGraph(lua_State *L, int index)
+{
+    luaL_checktype(L, index, LUA_TTABLE);
+    if (!GetSourceMapGraph(L, index))
+    {
+        luaL_argerror(L, index, "not a sourceMap of clalua.parse");
+    }
+}
+
+// sourceMap の source.types の table. 無ければ(source.types から消されていた) push しなおす
+static void PushDeclOf(lua_State *L, int decls, const std::shared_ptr<UserDecl> &decl,
+                       const ClangDeclProcessor &graph)
+{
+    if (lua_rawgetp(L, decls, decl.get()) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        PushUserDecl(L, decl, graph);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, decls, decl.get());
+    }
+}
+
+static void PushDeclList(lua_State *L, int decls, const std::vector<std::shared_ptr<UserDecl>> &list,
+                         const ClangDeclProcessor &graph)
+{
+    lua_createtable(L, static_cast<int>(list.size()), 0);
+    lua_Integer i = 1;
+    for (auto &decl : list)
+    {
+        PushDeclOf(L, decls, decl, graph);
+        lua_rawseti(L, -2, i++);
+    }
+}
+
+int CLALUA_diff(lua_State *L)
+{
+    CheckGraph(L, 1);
+    CheckGraph(L, 2);
+
+    DeclDiff diff;
+    // sourceMap(1, 2) が保持している
+    const ClangDeclProcessor *beforeGraph;
+    const ClangDeclProcessor *afterGraph;
+    {
+        auto before = GetSourceMapGraph(L, 1);
+        auto after = GetSourceMapGraph(L, 2);
+        beforeGraph = before.get();
+        afterGraph = after.get();
+        diff = DiffGraphs(*before, *after);
+
+        PushDeclTables(L, 1, *before);
+        PushDeclTables(L, 2, *after);
+    }
+    auto beforeDecls = lua_gettop(L) - 1;
+    auto afterDecls = lua_gettop(L);
+
+    lua_createtable(L, 0, 3);
+    PushDeclList(L, afterDecls, diff.Added, *afterGraph);
+    lua_setfield(L, -2, "added");
+    PushDeclList(L, beforeDecls, diff.Removed, *beforeGraph);
+    lua_setfield(L, -2, "removed");
+
+    lua_createtable(L, static_cast<int>(diff.Changed.size()), 0);
+    lua_Integer i = 1;
+    for (auto &[before, after] : diff.Changed)
+    {
+        lua_createtable(L, 0, 2);
+        PushDeclOf(L, beforeDecls, before, *beforeGraph);
+        lua_setfield(L, -2, "old");
+        PushDeclOf(L, afterDecls, after, *afterGraph);
+        lua_setfield(L, -2, "new");
+        lua_rawseti(L, -2, i++);
+    }
+    lua_setfield(L, -2, "changed");
+    return 1;
+}
+
+} // namespace clalua
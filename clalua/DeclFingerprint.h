@@ -0,0 +1,54 @@
+#pragma once
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct lua_State;
+
+namespace clalua
+{
+struct UserDecl;
+class ClangDeclProcessor;
+
+///
+/// UserDecl::fingerprint を計算する(BuildClosure の後に 1 回)
+///
+/// kind, qualifiedName と
+/// * typedef: ref の型
+/// * function: 戻り値と引数(name, 型), variadic, dllExport
+/// * enum: values(name, value)
+/// * struct: union, forward declaration(definition の fingerprint), fields(offset, name, 型)
+///
+/// 型は Pointer, Reference, Array, const と primitive を辿り、名前のある UserDecl は kind と名前だけ入れる。
+/// 無名の decl と関数型は中身の fingerprint を入れる。path と line は入れない(移動しただけなら同じ)
+///
+/// UserDecl::deepFingerprint は参照先(Pointer 等の先, forward declaration の definition)を推移的に含める。
+/// 強連結成分毎にまとめるので循環しても線形
+///
+void ComputeFingerprints(const ClangDeclProcessor &graph);
+
+// "{kind} {qualifiedName}". empty: 無名(diff しない)
+std::string DeclKey(const UserDecl &decl);
+
+struct DeclDiff
+{
+    std::vector<std::shared_ptr<UserDecl>> Added;
+    std::vector<std::shared_ptr<UserDecl>> Removed;
+    // old, new
+    std::vector<std::pair<std::shared_ptr<UserDecl>, std::shared_ptr<UserDecl>>> Changed;
+};
+
+// DeclKey で対応させて fingerprint を比べる。DeclIndex の順
+DeclDiff DiffGraphs(ClangDeclProcessor &before, ClangDeclProcessor &after);
+
+///
+/// clalua.diff(before, after)
+/// => {added = {decl...}, removed = {decl...}, changed = {{old = decl, new = decl}...}}
+///
+/// before, after は clalua.parse の sourceMap。decl はそれぞれの source.types の table
+///
+int CLALUA_diff(lua_State *L);
+
+} // namespace clalua
@@ -0,0 +1,253 @@
+#include "DeclIndex.h"
+#include "ClangDeclProcessor.h"
+#include "DeclResolve.h"
+#include "LuaPush.h"
+#include "Trace.h"
+#include <algorithm>
+#include <filesystem>
+#include <unordered_set>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+DeclIndex::DeclIndex(const ClangDeclProcessor &graph)
+{
+    // SourceMap(unordered_map)の順は実行毎に変わるので key 順にする
+    std::vector<const std::pair<const std::string, SourcePtr> *> sources;
+    sources.reserve(graph.SourceMap.size());
+    for (auto &kv : graph.SourceMap)
+    {
+        sources.push_back(&kv);
+    }
+    std::sort(sources.begin(), sources.end(), [](auto lhs, auto rhs) { return lhs->first < rhs->first; });
+
+    std::unordered_set<const UserDecl *> used;
+    for (auto kv : sources)
+    {
+        for (auto &decl : kv->second->Decls)
+        {
+            if (used.insert(decl.get()).second)
+            {
+                Decls.push_back(decl);
+            }
+        }
+    }
+
+    for (uint32_t id = 0; id < Decls.size(); ++id)
+    {
+        auto &decl = *Decls[id];
+        m_byName[decl.name].push_back(id);
+        m_byKind[DeclClass(decl)].push_back(id);
+        m_byFile[decl.path].push_back(id);
+        auto stem = std::filesystem::path(decl.path).stem().string();
+        if (stem != decl.path)
+        {
+            m_byFile[stem].push_back(id);
+        }
+    }
+
+    m_sorted.resize(Decls.size());
+    for (uint32_t id = 0; id < Decls.size(); ++id)
+    {
+        m_sorted[id] = id;
+    }
+    std::sort(m_sorted.begin(), m_sorted.end(), [this](uint32_t lhs, uint32_t rhs) {
+        auto &l = Decls[lhs]->name;
+        auto &r = Decls[rhs]->name;
+        return l != r ? l < r : lhs < rhs;
+    });
+}
+
+static bool Contains(const std::unordered_map<std::string, std::vector<uint32_t>> &map, const std::string &key,
+                     uint32_t id)
+{
+    auto found = map.find(key);
+    // ids are ascending
+    return found != map.end() && std::binary_search(found->second.begin(), found->second.end(), id);
+}
+
+bool DeclIndex::Match(uint32_t id, const DeclQuery &query) const
+{
+    auto &decl = *Decls[id];
+    if (!query.Name.empty() && decl.name != query.Name)
+    {
+        return false;
+    }
+    if (!query.Prefix.empty() && std::string_view(decl.name).substr(0, query.Prefix.size()) != query.Prefix)
+    {
+        return false;
+    }
+    if (!query.Kind.empty() && query.Kind != DeclClass(decl))
+    {
+        return false;
+    }
+    if (!query.File.empty() && !Contains(m_byFile, query.File, id))
+    {
+        return false;
+    }
+    return true;
+}
+
+std::vector<uint32_t> DeclIndex::Query(const DeclQuery &query) const
+{
+    // 一番絞れる索引から候補を取って、残りの条件で filter する
+    static const Ids s_empty;
+    const Ids *candidates = nullptr;
+    Ids prefixed;
+    if (!query.Name.empty())
+    {
+        auto found = m_byName.find(query.Name);
+        candidates = found != m_byName.end() ? &found->second : &s_empty;
+    }
+    else if (!query.Prefix.empty())
+    {
+        auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), query.Prefix,
+                                   [this](uint32_t id, const std::string &prefix) { return Decls[id]->name < prefix; });
+        for (; it != m_sorted.end(); ++it)
+        {
+            if (std::string_view(Decls[*it]->name).substr(0, query.Prefix.size()) != query.Prefix)
+            {
+                break;
+            }
+            prefixed.push_back(*it);
+        }
+        std::sort(prefixed.begin(), prefixed.end());
+        candidates = &prefixed;
+    }
+    else if (!query.File.empty())
+    {
+        auto found = m_byFile.find(query.File);
+        candidates = found != m_byFile.end() ? &found->second : &s_empty;
+    }
+    else if (!query.Kind.empty())
+    {
+        auto found = m_byKind.find(query.Kind);
+        candidates = found != m_byKind.end() ? &found->second : &s_empty;
+    }
+
+    std::vector<uint32_t> result;
+    if (candidates)
+    {
+        for (auto id : *candidates)
+        {
+            if (Match(id, query))
+            {
+                result.push_back(id);
+            }
+        }
+    }
+    else
+    {
+        result = m_sorted;
+        std::sort(result.begin(), result.end());
+    }
+    return result;
+}
+
+const DeclIndex &ClangDeclProcessor::Index()
+{
+    std::call_once(m_indexOnce, [this]() {
+        TraceScope scope("query.index");
+        m_index = std::make_shared<DeclIndex>(*this);
+    });
+    return *m_index;
+}
+
+//
+// lua
+//
+static std::string GetStringField(lua_State *L, int index, const char *key)
+{
+    lua_getfield(L, index, key);
+    std::string value = lua_isstring(L, -1) ? lua_tostring(L, -1) : "";
+    lua_pop(L, 1);
+    return value;
+}
+
+void PushDeclTables(lua_State *L, int sourceMap, const ClangDeclProcessor &graph)
+{
+    lua_getmetatable(L, sourceMap);
+    if (lua_getfield(L, -1, "__decls") == LUA_TTABLE)
+    {
+        lua_remove(L, -2);
+        return;
+    }
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+    auto decls = lua_gettop(L);
+    for (auto &[key, source] : graph.SourceMap)
+    {
+        if (lua_getfield(L, sourceMap, key.c_str()) == LUA_TTABLE)
+        {
+            if (lua_getfield(L, -1, "types") == LUA_TTABLE)
+            {
+                lua_Integer i = 1;
+                for (auto &decl : source->Decls)
+                {
+                    if (lua_rawgeti(L, -1, i++) == LUA_TTABLE)
+                    {
+                        lua_rawsetp(L, decls, decl.get());
+                    }
+                    else
+                    {
+                        lua_pop(L, 1);
+                    }
+                }
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pushvalue(L, decls);
+    lua_setfield(L, -3, "__decls");
+    lua_remove(L, -2);
+}
+
+int CLALUA_query(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    auto graph = GetSourceMapGraph(L, 1);
+    if (!graph)
+    {
+        return luaL_argerror(L, 1, "not a sourceMap of clalua.parse");
+    }
+
+    DeclQuery query;
+    query.Name = GetStringField(L, 2, "name");
+    query.Prefix = GetStringField(L, 2, "prefix");
+    query.Kind = GetStringField(L, 2, "kind");
+    query.File = GetStringField(L, 2, "file");
+
+    auto &index = graph->Index();
+    auto ids = index.Query(query);
+
+    PushDeclTables(L, 1, *graph);
+    auto decls = lua_gettop(L);
+    lua_createtable(L, static_cast<int>(ids.size()), 0);
+    lua_Integer i = 1;
+    for (auto id : ids)
+    {
+        auto &decl = index.Decls[id];
+        if (lua_rawgetp(L, decls, decl.get()) != LUA_TTABLE)
+        {
+            // source.types から消されていた
+            lua_pop(L, 1);
+            PushUserDecl(L, decl, *graph);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, decls, decl.get());
+        }
+        lua_rawseti(L, -2, i++);
+    }
+    return 1;
+}
+
+} // namespace clalua
@@ -0,0 +1,67 @@
+#pragma once
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct lua_State;
+
+namespace clalua
+{
+struct UserDecl;
+class ClangDeclProcessor;
+
+struct DeclQuery
+{
+    // empty: any
+    std::string Name;
+    std::string Prefix;
+    std::string Kind;
+    // decl->path or its stem(lua.h => lua)
+    std::string File;
+};
+
+///
+/// SourceMap の UserDecl の索引
+///
+/// * name, kind, file(path と stem)は hash
+/// * prefix は name で sort した配列を二分探索
+///
+/// 結果は Decls の順(SourceMap の key 順, source.types 順)
+///
+class DeclIndex
+{
+    using Ids = std::vector<uint32_t>;
+    std::unordered_map<std::string_view, Ids> m_byName;
+    std::unordered_map<std::string_view, Ids> m_byKind;
+    std::unordered_map<std::string, Ids> m_byFile;
+    // sorted by name
+    Ids m_sorted;
+
+public:
+    std::vector<std::shared_ptr<UserDecl>> Decls;
+
+    explicit DeclIndex(const ClangDeclProcessor &graph);
+    DeclIndex(const DeclIndex &) = delete;
+    DeclIndex &operator=(const DeclIndex &) = delete;
+
+    std::vector<uint32_t> Query(const DeclQuery &query) const;
+
+private:
+    bool Match(uint32_t id, const DeclQuery &query) const;
+};
+
+///
+/// clalua.query(sourceMap, {name = , prefix = , kind = , file = })
+/// => {decl...}
+///
+/// decl は sourceMap の source.types の table そのもの
+///
+int CLALUA_query(lua_State *L);
+
+// push sourceMap.metatable.__decls: lightuserdata(UserDecl*) => source.types[i]
+void PushDeclTables(lua_State *L, int sourceMap, const ClangDeclProcessor &graph);
+
+} // namespace clalua
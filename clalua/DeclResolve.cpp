@@ -0,0 +1,190 @@
+#include "DeclResolve.h"
+#include "ClangDecl.h"
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clalua
+{
+
+const char *DeclClass(const Decl &decl)
+{
+    // 派生を先に判定する(StructDecl : Namespace, Void : Primitive)
+    if (dynamic_cast<const Typedef *>(&decl))
+    {
+        return "TypeDef";
+    }
+    if (dynamic_cast<const EnumDecl *>(&decl))
+    {
+        return "Enum";
+    }
+    if (dynamic_cast<const StructDecl *>(&decl))
+    {
+        return "Struct";
+    }
+    if (dynamic_cast<const FunctionDecl *>(&decl))
+    {
+        return "Function";
+    }
+    if (dynamic_cast<const Namespace *>(&decl))
+    {
+        return "Namespace";
+    }
+    if (dynamic_cast<const UserDecl *>(&decl))
+    {
+        return "UserDecl";
+    }
+    if (dynamic_cast<const Pointer *>(&decl))
+    {
+        return "Pointer";
+    }
+    if (dynamic_cast<const Reference *>(&decl))
+    {
+        return "Reference";
+    }
+    if (dynamic_cast<const Array *>(&decl))
+    {
+        return "Array";
+    }
+    if (dynamic_cast<const Void *>(&decl))
+    {
+        return "Void";
+    }
+    if (dynamic_cast<const Bool *>(&decl))
+    {
+        return "Bool";
+    }
+    if (dynamic_cast<const Int8 *>(&decl))
+    {
+        return "Int8";
+    }
+    if (dynamic_cast<const Int16 *>(&decl))
+    {
+        return "Int16";
+    }
+    if (dynamic_cast<const Int32 *>(&decl))
+    {
+        return "Int32";
+    }
+    if (dynamic_cast<const Int64 *>(&decl))
+    {
+        return "Int64";
+    }
+    if (dynamic_cast<const UInt8 *>(&decl))
+    {
+        return "UInt8";
+    }
+    if (dynamic_cast<const UInt16 *>(&decl))
+    {
+        return "UInt16";
+    }
+    if (dynamic_cast<const UInt32 *>(&decl))
+    {
+        return "UInt32";
+    }
+    if (dynamic_cast<const UInt64 *>(&decl))
+    {
+        return "UInt64";
+    }
+    if (dynamic_cast<const Float *>(&decl))
+    {
+        return "Float";
+    }
+    if (dynamic_cast<const Double *>(&decl))
+    {
+        return "Double";
+    }
+    if (dynamic_cast<const LongDouble *>(&decl))
+    {
+        return "LongDouble";
+    }
+    return "Unknown";
+}
+
+static void ResolveQualifiedName(UserDecl &decl)
+{
+    std::vector<const std::string *> names;
+    for (auto ns = decl.namespaceDecl.lock(); ns; ns = ns->namespaceDecl.lock())
+    {
+        if (!ns->name.empty())
+        {
+            names.push_back(&ns->name);
+        }
+        if (names.size() > 256)
+        {
+            // 循環
+            break;
+        }
+    }
+
+    decl.namespaceKey.clear();
+    for (auto it = names.rbegin(); it != names.rend(); ++it)
+    {
+        if (!decl.namespaceKey.empty())
+        {
+            decl.namespaceKey += "::";
+        }
+        decl.namespaceKey += **it;
+    }
+
+    if (decl.name.empty())
+    {
+        // 無名
+        decl.qualifiedName.clear();
+    }
+    else if (decl.namespaceKey.empty())
+    {
+        decl.qualifiedName = decl.name;
+    }
+    else
+    {
+        decl.qualifiedName = decl.namespaceKey + "::" + decl.name;
+    }
+}
+
+static void ResolveTypedef(Typedef &decl)
+{
+    decl.typedefDepth = 1;
+    auto current = decl.ref.decl;
+    while (auto typedefDecl = std::dynamic_pointer_cast<Typedef>(current))
+    {
+        if (typedefDecl.get() == &decl || decl.typedefDepth > 256)
+        {
+            // 循環
+            break;
+        }
+        ++decl.typedefDepth;
+        current = typedefDecl->ref.decl;
+    }
+    decl.resolved = current;
+}
+
+void ResolveDecls(const std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> &map)
+{
+    for (auto &[hash, decl] : map)
+    {
+        ResolveQualifiedName(*decl);
+        if (auto typedefDecl = std::dynamic_pointer_cast<Typedef>(decl))
+        {
+            ResolveTypedef(*typedefDecl);
+        }
+    }
+
+    // namespaceKey の順に id を振る(入力が同じなら実行毎に同じ id)
+    std::vector<std::string_view> keys;
+    keys.push_back("");
+    for (auto &[hash, decl] : map)
+    {
+        keys.push_back(decl->namespaceKey);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    for (auto &[hash, decl] : map)
+    {
+        decl->namespaceId =
+            static_cast<uint32_t>(std::lower_bound(keys.begin(), keys.end(), decl->namespaceKey) - keys.begin());
+    }
+}
+
+} // namespace clalua
@@ -0,0 +1,23 @@
+#pragma once
+#include <memory>
+#include <stdint.h>
+#include <unordered_map>
+
+namespace clalua
+{
+struct Decl;
+struct UserDecl;
+
+// lua の class 名(Struct, TypeDef, Enum, Function, Namespace, Pointer, Reference, Array, Int32 ...)
+const char *DeclClass(const Decl &decl);
+
+///
+/// Traverse の後に 1 回だけ計算する
+///
+/// * UserDecl::qualifiedName: namespaceDecl を辿って :: でつなぐ(無名の namespace / struct は飛ばす。無名の decl は空)
+/// * Typedef::resolved, typedefDepth: ref を typedef でなくなるまで辿る
+/// * UserDecl::namespaceKey, namespaceId: namespaceKey を sort した順の id(0 は top level)
+///
+void ResolveDecls(const std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> &map);
+
+} // namespace clalua
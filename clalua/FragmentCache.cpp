@@ -0,0 +1,142 @@
+#include "FragmentCache.h"
+#include "Hash.h"
+#include "OutputDir.h"
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+
+namespace clalua
+{
+
+static constexpr std::string_view MAGIC = "clalua.fragments 1\n";
+
+static std::string SaltString(uint64_t salt)
+{
+    return std::string(reinterpret_cast<const char *>(&salt), sizeof(salt));
+}
+
+static void WriteString(std::string &out, std::string_view s)
+{
+    auto size = static_cast<uint32_t>(s.size());
+    char header[4] = {
+        static_cast<char>(size),
+        static_cast<char>(size >> 8),
+        static_cast<char>(size >> 16),
+        static_cast<char>(size >> 24),
+    };
+    out.append(header, sizeof(header));
+    out.append(s);
+}
+
+// false if truncated
+static bool ReadString(std::string_view &src, std::string *s)
+{
+    if (src.size() < 4)
+    {
+        return false;
+    }
+    auto p = reinterpret_cast<const uint8_t *>(src.data());
+    auto size = static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 |
+                static_cast<uint32_t>(p[3]) << 24;
+    src.remove_prefix(4);
+    if (src.size() < size)
+    {
+        return false;
+    }
+    s->assign(src.data(), size);
+    src.remove_prefix(size);
+    return true;
+}
+
+FragmentCache::FragmentCache(const std::filesystem::path &path, std::string_view salt) : m_path(path), m_salt(Fnv1a(salt))
+{
+    Load();
+}
+
+void FragmentCache::Load()
+{
+    std::ifstream ifs(m_path, std::ios::binary);
+    if (!ifs)
+    {
+        return;
+    }
+    std::ostringstream ss;
+    ss << ifs.rdbuf();
+    auto data = ss.str();
+    std::string_view src(data);
+    if (src.substr(0, MAGIC.size()) != MAGIC)
+    {
+        return;
+    }
+    src.remove_prefix(MAGIC.size());
+
+    std::string salt;
+    if (!ReadString(src, &salt) || salt != SaltString(m_salt))
+    {
+        // generator changed
+        return;
+    }
+    while (!src.empty())
+    {
+        std::string key;
+        std::string text;
+        if (!ReadString(src, &key) || !ReadString(src, &text))
+        {
+            // broken file. start over
+            m_old.clear();
+            return;
+        }
+        m_old.insert_or_assign(std::move(key), std::move(text));
+    }
+    Loaded = m_old.size();
+}
+
+bool FragmentCache::Get(const std::string &key, std::string *text)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_new.find(key);
+    if (found != m_new.end())
+    {
+        ++Hits;
+        *text = found->second;
+        return true;
+    }
+    auto old = m_old.find(key);
+    if (old == m_old.end())
+    {
+        ++Misses;
+        return false;
+    }
+    ++Hits;
+    *text = old->second;
+    m_new.insert({key, std::move(old->second)});
+    m_old.erase(old);
+    return true;
+}
+
+void FragmentCache::Put(const std::string &key, std::string_view text)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_new.insert_or_assign(key, std::string(text));
+}
+
+bool FragmentCache::Save()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string out(MAGIC);
+    WriteString(out, SaltString(m_salt));
+    for (auto &[key, text] : m_new)
+    {
+        WriteString(out, key);
+        WriteString(out, text);
+    }
+    return WriteFile(m_path, out, true);
+}
+
+size_t FragmentCache::Stored()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_new.size();
+}
+
+} // namespace clalua
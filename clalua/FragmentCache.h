@@ -0,0 +1,57 @@
+#pragma once
+#include <filesystem>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace clalua
+{
+
+///
+/// decl 毎に生成したテキストの cache
+///
+/// key は生成側が決める(deepFingerprint など、入力が同じなら同じになるもの)。
+/// salt(生成 script の内容など。hash して保存する)が前回と違えば読み込んだ内容は全部捨てる。
+/// Save は今回 Get で当たったものと Put したものだけ書くので、使われなくなった key は消える
+///
+/// clalua.emit の worker からも使うので thread safe
+///
+class FragmentCache
+{
+    std::filesystem::path m_path;
+    uint64_t m_salt;
+    std::mutex m_mutex;
+    // loaded
+    std::unordered_map<std::string, std::string> m_old;
+    // used in this run
+    std::unordered_map<std::string, std::string> m_new;
+
+    void Load();
+
+public:
+    size_t Loaded = 0;
+    size_t Hits = 0;
+    size_t Misses = 0;
+
+    FragmentCache(const std::filesystem::path &path, std::string_view salt);
+    FragmentCache(const FragmentCache &) = delete;
+    FragmentCache &operator=(const FragmentCache &) = delete;
+
+    const std::filesystem::path &Path() const
+    {
+        return m_path;
+    }
+
+    // false if not found
+    bool Get(const std::string &key, std::string *text);
+    void Put(const std::string &key, std::string_view text);
+
+    // return false if failed
+    bool Save();
+
+    size_t Stored();
+};
+
+} // namespace clalua
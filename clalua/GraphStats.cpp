@@ -0,0 +1,136 @@
+#include "GraphStats.h"
+#include "ClangDecl.h"
+#include <string>
+#include <unordered_set>
+
+namespace clalua
+{
+
+// make_shared の control block
+static const size_t CONTROL_BLOCK = 2 * sizeof(long) + sizeof(void *);
+
+class GraphCounter
+{
+    GraphStats &m_stats;
+    std::unordered_set<const Decl *> m_visited;
+
+public:
+    GraphCounter(GraphStats &stats) : m_stats(stats)
+    {
+    }
+
+    void String(const std::string &src)
+    {
+        ++m_stats.Strings;
+        m_stats.StringBytes += src.size();
+        // SSO を超えた分は heap
+        if (src.capacity() >= sizeof(std::string))
+        {
+            m_stats.NativeBytes += src.capacity() + 1;
+        }
+    }
+
+    template <typename T> void Vector(const std::vector<T> &src)
+    {
+        m_stats.NativeBytes += src.capacity() * sizeof(T);
+    }
+
+    void Visit(const std::shared_ptr<Decl> &decl)
+    {
+        if (!decl || !m_visited.insert(decl.get()).second)
+        {
+            return;
+        }
+        m_stats.NativeBytes += CONTROL_BLOCK;
+
+        if (auto userDecl = std::dynamic_pointer_cast<UserDecl>(decl))
+        {
+            String(userDecl->name);
+            String(userDecl->path);
+            if (auto typedefDecl = std::dynamic_pointer_cast<Typedef>(decl))
+            {
+                ++m_stats.Typedefs;
+                m_stats.NativeBytes += sizeof(Typedef);
+                Visit(typedefDecl->ref.decl);
+            }
+            else if (auto enumDecl = std::dynamic_pointer_cast<EnumDecl>(decl))
+            {
+                ++m_stats.Enums;
+                m_stats.NativeBytes += sizeof(EnumDecl);
+                Vector(enumDecl->values);
+                for (auto &value : enumDecl->values)
+                {
+                    String(value.name);
+                }
+            }
+            else if (auto structDecl = std::dynamic_pointer_cast<StructDecl>(decl))
+            {
+                ++m_stats.Structs;
+                m_stats.NativeBytes += sizeof(StructDecl);
+                Vector(structDecl->fields);
+                for (auto &field : structDecl->fields)
+                {
+                    String(field.name);
+                    Visit(field.ref.decl);
+                }
+                Visit(structDecl->definition);
+            }
+            else if (auto functionDecl = std::dynamic_pointer_cast<FunctionDecl>(decl))
+            {
+                ++m_stats.Functions;
+                m_stats.NativeBytes += sizeof(FunctionDecl);
+                Visit(functionDecl->returnType.decl);
+                Vector(functionDecl->params);
+                for (auto &param : functionDecl->params)
+                {
+                    String(param.name);
+                    Visit(param.ref.decl);
+                }
+            }
+            else
+            {
+                ++m_stats.OtherUserDecls;
+                m_stats.NativeBytes += sizeof(Namespace);
+            }
+        }
+        else if (auto pointer = std::dynamic_pointer_cast<Pointer>(decl))
+        {
+            ++m_stats.Pointers;
+            m_stats.NativeBytes += sizeof(Pointer);
+            Visit(pointer->pointee.decl);
+        }
+        else if (auto reference = std::dynamic_pointer_cast<Reference>(decl))
+        {
+            ++m_stats.References;
+            m_stats.NativeBytes += sizeof(Reference);
+            Visit(reference->pointee);
+        }
+        else if (auto array = std::dynamic_pointer_cast<Array>(decl))
+        {
+            ++m_stats.Arrays;
+            m_stats.NativeBytes += sizeof(Array);
+            Visit(array->pointee);
+        }
+        else
+        {
+            ++m_stats.Primitives;
+            m_stats.NativeBytes += sizeof(Primitive);
+        }
+    }
+};
+
+GraphStats CountGraph(const std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> &map)
+{
+    GraphStats stats;
+    GraphCounter counter(stats);
+    for (auto &[hash, decl] : map)
+    {
+        counter.Visit(decl);
+    }
+    // map itself
+    stats.NativeBytes += map.bucket_count() * sizeof(void *) +
+                         map.size() * (sizeof(std::pair<uint32_t, std::shared_ptr<UserDecl>>) + sizeof(void *));
+    return stats;
+}
+
+} // namespace clalua
@@ -0,0 +1,37 @@
+#pragma once
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+namespace clalua
+{
+struct UserDecl;
+
+///
+/// Traverse が作った graph の件数と native のメモリ量(概算)
+///
+/// 型(Pointer, Array 等)は参照毎に作られるので、到達した instance を 1 回ずつ数える
+///
+struct GraphStats
+{
+    size_t Structs = 0;
+    size_t Typedefs = 0;
+    size_t Enums = 0;
+    size_t Functions = 0;
+    size_t OtherUserDecls = 0;
+    size_t Pointers = 0;
+    size_t References = 0;
+    size_t Arrays = 0;
+    size_t Primitives = 0;
+
+    // name, path, field / param / enum value name
+    size_t Strings = 0;
+    size_t StringBytes = 0;
+    // decl objects + vectors + heap strings + shared_ptr control blocks
+    size_t NativeBytes = 0;
+};
+
+GraphStats CountGraph(const std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> &map);
+
+} // namespace clalua
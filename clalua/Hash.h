@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+
+namespace clalua
+{
+
+// FNV-1a 64bit
+inline uint64_t Fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    auto p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t Fnv1a(std::string_view src, uint64_t hash = 14695981039346656037ull)
+{
+    return Fnv1a(src.data(), src.size(), hash);
+}
+
+} // namespace clalua
@@ -0,0 +1,620 @@
+#include "LuaEmitter.h"
+#include "LuaMemory.h"
+#include "LuaPush.h"
+#include "LuaWriter.h"
+#include "ScriptCache.h"
+#include "Trace.h"
+#include "clalua.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fmt/format.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+namespace clalua
+{
+
+///
+/// lua_State 間で値を複写する
+///
+/// * nil, boolean, number, string
+/// * table(循環参照可. metatable は複写しない)
+/// * lua function(lua_dump して upvalue を複写する. _ENV は複写先の global になる)
+///   複数の closure が共有する upvalue は複写先でも共有する(lua_upvalueid, lua_upvaluejoin)
+///
+/// 失敗した場合、複写先の stack は不定なので lua_State ごと捨てること
+///
+class LuaCopy
+{
+    lua_State *m_src;
+    lua_State *m_dst;
+    // dst registry: src pointer => dst value
+    int m_cache;
+    // dst registry: src upvalue id => {dst function, upvalue index}
+    int m_upvalues;
+
+    LuaCopy(const LuaCopy &) = delete;
+    LuaCopy &operator=(const LuaCopy &) = delete;
+
+public:
+    std::string Error;
+
+    LuaCopy(lua_State *src, lua_State *dst) : m_src(src), m_dst(dst)
+    {
+        lua_newtable(m_dst);
+        m_cache = luaL_ref(m_dst, LUA_REGISTRYINDEX);
+        lua_newtable(m_dst);
+        m_upvalues = luaL_ref(m_dst, LUA_REGISTRYINDEX);
+    }
+    ~LuaCopy()
+    {
+        luaL_unref(m_dst, LUA_REGISTRYINDEX, m_upvalues);
+        luaL_unref(m_dst, LUA_REGISTRYINDEX, m_cache);
+    }
+
+    // push copy of src[index] to dst
+    bool Copy(int index)
+    {
+        index = lua_absindex(m_src, index);
+        if (!lua_checkstack(m_dst, 8) || !lua_checkstack(m_src, 4))
+        {
+            Error = "stack overflow";
+            return false;
+        }
+
+        switch (lua_type(m_src, index))
+        {
+        case LUA_TNIL:
+            lua_pushnil(m_dst);
+            return true;
+
+        case LUA_TBOOLEAN:
+            lua_pushboolean(m_dst, lua_toboolean(m_src, index));
+            return true;
+
+        case LUA_TNUMBER:
+            if (lua_isinteger(m_src, index))
+            {
+                lua_pushinteger(m_dst, lua_tointeger(m_src, index));
+            }
+            else
+            {
+                lua_pushnumber(m_dst, lua_tonumber(m_src, index));
+            }
+            return true;
+
+        case LUA_TSTRING:
+        {
+            size_t len;
+            auto s = lua_tolstring(m_src, index, &len);
+            lua_pushlstring(m_dst, s, len);
+            return true;
+        }
+
+        case LUA_TTABLE:
+            return CopyTable(index);
+
+        case LUA_TFUNCTION:
+            return CopyFunction(index);
+
+        case LUA_TUSERDATA:
+            // OutputDir, FragmentCache は native 側で共有する
+            if (auto outdir = TestOutputDir(m_src, index))
+            {
+                PushOutputDir(m_dst, outdir);
+                return true;
+            }
+            if (auto fragments = TestFragmentCache(m_src, index))
+            {
+                PushFragmentCache(m_dst, fragments);
+                return true;
+            }
+            [[fallthrough]];
+
+        default:
+            Error = fmt::format("can not copy {}", luaL_typename(m_src, index));
+            return false;
+        }
+    }
+
+private:
+    bool PushCached(int index)
+    {
+        lua_rawgeti(m_dst, LUA_REGISTRYINDEX, m_cache);
+        lua_rawgetp(m_dst, -1, lua_topointer(m_src, index));
+        lua_remove(m_dst, -2);
+        if (lua_isnil(m_dst, -1))
+        {
+            lua_pop(m_dst, 1);
+            return false;
+        }
+        return true;
+    }
+
+    void SetCache(int index)
+    {
+        // dst top is the copied value
+        lua_rawgeti(m_dst, LUA_REGISTRYINDEX, m_cache);
+        lua_pushvalue(m_dst, -2);
+        lua_rawsetp(m_dst, -2, lua_topointer(m_src, index));
+        lua_pop(m_dst, 1);
+    }
+
+    bool CopyTable(int index)
+    {
+        if (PushCached(index))
+        {
+            return true;
+        }
+
+        lua_newtable(m_dst);
+        SetCache(index);
+        auto table = lua_gettop(m_dst);
+
+        lua_pushnil(m_src);
+        while (lua_next(m_src, index))
+        {
+            if (!Copy(-2) || !Copy(-1))
+            {
+                lua_pop(m_src, 2);
+                return false;
+            }
+            lua_rawset(m_dst, table);
+            lua_pop(m_src, 1);
+        }
+        return true;
+    }
+
+    static int DumpWriter(lua_State *, const void *p, size_t sz, void *ud)
+    {
+        auto buffer = static_cast<std::string *>(ud);
+        buffer->append(static_cast<const char *>(p), sz);
+        return 0;
+    }
+
+    // 複写済みの closure と共有している upvalue なら、その upvalue に join する
+    bool JoinUpvalue(void *id, int function, int n)
+    {
+        lua_rawgeti(m_dst, LUA_REGISTRYINDEX, m_upvalues);
+        if (lua_rawgetp(m_dst, -1, id) != LUA_TTABLE)
+        {
+            lua_pop(m_dst, 2);
+            return false;
+        }
+        lua_rawgeti(m_dst, -1, 1);
+        lua_rawgeti(m_dst, -2, 2);
+        auto shared = static_cast<int>(lua_tointeger(m_dst, -1));
+        lua_upvaluejoin(m_dst, function, n, -2, shared);
+        lua_pop(m_dst, 4);
+        return true;
+    }
+
+    void AddUpvalue(void *id, int function, int n)
+    {
+        lua_rawgeti(m_dst, LUA_REGISTRYINDEX, m_upvalues);
+        lua_createtable(m_dst, 2, 0);
+        lua_pushvalue(m_dst, function);
+        lua_rawseti(m_dst, -2, 1);
+        lua_pushinteger(m_dst, n);
+        lua_rawseti(m_dst, -2, 2);
+        lua_rawsetp(m_dst, -2, id);
+        lua_pop(m_dst, 1);
+    }
+
+    bool CopyFunction(int index)
+    {
+        if (PushCached(index))
+        {
+            return true;
+        }
+
+        if (lua_iscfunction(m_src, index))
+        {
+            Error = "can not copy C function";
+            return false;
+        }
+
+        std::string chunk;
+        lua_pushvalue(m_src, index);
+        lua_dump(m_src, &DumpWriter, &chunk, 0);
+        lua_pop(m_src, 1);
+        if (luaL_loadbufferx(m_dst, chunk.data(), chunk.size(), "=copy", "b") != LUA_OK)
+        {
+            Error = lua_tostring(m_dst, -1);
+            return false;
+        }
+        SetCache(index);
+        auto function = lua_gettop(m_dst);
+
+        for (int i = 1;; ++i)
+        {
+            auto name = lua_getupvalue(m_src, index, i);
+            if (!name)
+            {
+                break;
+            }
+            auto id = lua_upvalueid(m_src, index, i);
+            if (JoinUpvalue(id, function, i))
+            {
+                lua_pop(m_src, 1);
+                continue;
+            }
+            if (strcmp(name, "_ENV") == 0)
+            {
+                lua_pushglobaltable(m_dst);
+            }
+            else if (!Copy(-1))
+            {
+                Error = fmt::format("upvalue {}: {}", name, Error);
+                lua_pop(m_src, 1);
+                return false;
+            }
+            lua_pop(m_src, 1);
+            lua_setupvalue(m_dst, function, i);
+            AddUpvalue(id, function, i);
+        }
+        return true;
+    }
+};
+
+static bool CopyValue(lua_State *src, int index, lua_State *dst, std::string *error)
+{
+    LuaCopy copy(src, dst);
+    if (!copy.Copy(index))
+    {
+        *error = copy.Error;
+        return false;
+    }
+    return true;
+}
+
+static std::string ErrorMessage(lua_State *L)
+{
+    auto message = lua_tostring(L, -1);
+    return message ? message : "(error object is not a string)";
+}
+
+static int Traceback(lua_State *L)
+{
+    auto message = lua_tostring(L, 1);
+    luaL_traceback(L, L, message ? message : "(error object is not a string)", 1);
+    return 1;
+}
+
+struct EmitWorker
+{
+    // same allocator mode as the parent state
+    std::unique_ptr<LuaAllocator> Allocator;
+    // stack: [1] traceback, [2] args, [3] results
+    lua_State *L = nullptr;
+    std::string Error;
+    std::string ErrorPath;
+
+    EmitWorker(LuaAllocator *parent)
+    {
+        if (parent)
+        {
+            Allocator = std::make_unique<LuaAllocator>(parent->GetMode());
+            L = Allocator->NewState();
+        }
+        else
+        {
+            L = luaL_newstate();
+        }
+        luaL_openlibs(L);
+        lua_pushcfunction(L, Traceback);
+    }
+    ~EmitWorker()
+    {
+        lua_close(L);
+    }
+
+    EmitWorker(const EmitWorker &) = delete;
+    EmitWorker &operator=(const EmitWorker &) = delete;
+
+    bool Require(const std::string &module)
+    {
+        lua_getglobal(L, "require");
+        lua_pushstring(L, module.c_str());
+        if (lua_pcall(L, 1, 1, 1) != LUA_OK)
+        {
+            Error = ErrorMessage(L);
+            return false;
+        }
+        return true;
+    }
+};
+
+struct EmitOption
+{
+    std::string Module;
+    std::string Entry = "EmitSource";
+    std::vector<std::string> Preload = {"predefine"};
+    int Jobs = 0;
+};
+
+static std::string GetStringField(lua_State *L, int index, const char *key, const std::string &defaultValue)
+{
+    lua_getfield(L, index, key);
+    std::string value = lua_isstring(L, -1) ? lua_tostring(L, -1) : defaultValue;
+    lua_pop(L, 1);
+    return value;
+}
+
+static std::unique_ptr<EmitWorker> CreateWorker(lua_State *L, std::string *error)
+{
+    auto worker = std::make_unique<EmitWorker>(LuaAllocator::Get(L));
+    auto W = worker->L;
+
+    // worker は出力を組み立てるだけなので emit の GC mode にする
+    auto policy = GetGcPolicy(L);
+    *GetGcPolicy(W) = *policy;
+    SetGcMode(W, policy->Emit);
+
+    lua_getglobal(L, "package");
+    lua_getglobal(W, "package");
+    for (auto key : {"path", "cpath"})
+    {
+        lua_getfield(L, -1, key);
+        if (lua_isstring(L, -1))
+        {
+            lua_pushstring(W, lua_tostring(L, -1));
+            lua_setfield(W, -2, key);
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(W, 1);
+    lua_pop(L, 1);
+
+    // bytecode cache / embedded modules
+    CopyScriptCache(L, W);
+
+    // package.preload の C function (clalua_static の lfs など)
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    luaL_getsubtable(W, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1))
+        {
+            if (lua_getupvalue(L, -1, 1))
+            {
+                // upvalue は state をまたげない
+                lua_pop(L, 1);
+            }
+            else
+            {
+                lua_pushcfunction(W, lua_tocfunction(L, -1));
+                lua_setfield(W, -2, lua_tostring(L, -2));
+            }
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(W, 1);
+    lua_pop(L, 1);
+
+    lua_pushboolean(W, 1);
+    lua_setglobal(W, "CLALUA_WORKER");
+    luaL_requiref(W, "clalua", luaopen_clalua, 1);
+    lua_pop(W, 1);
+
+    // [2] args
+    lua_getfield(L, 2, "args");
+    if (lua_istable(L, -1))
+    {
+        if (!CopyValue(L, -1, W, error))
+        {
+            *error = "args: " + *error;
+            lua_pop(L, 1);
+            return nullptr;
+        }
+    }
+    else
+    {
+        lua_newtable(W);
+    }
+    lua_pop(L, 1);
+
+    // [3] results
+    lua_newtable(W);
+
+    return worker;
+}
+
+static void RunWorker(EmitWorker &worker, const EmitOption &option, const ClangDeclProcessor &graph,
+                      const std::vector<std::pair<std::string, SourcePtr>> &sources, std::atomic<size_t> &next,
+                      std::atomic<bool> &failed)
+{
+    auto W = worker.L;
+
+    for (auto &preload : option.Preload)
+    {
+        if (!worker.Require(preload))
+        {
+            failed = true;
+            return;
+        }
+        lua_pop(W, 1);
+    }
+    if (!worker.Require(option.Module))
+    {
+        failed = true;
+        return;
+    }
+    lua_getfield(W, -1, option.Entry.c_str());
+    if (!lua_isfunction(W, -1))
+    {
+        worker.Error = fmt::format("{}.{} is not function", option.Module, option.Entry);
+        failed = true;
+        return;
+    }
+    auto entry = lua_gettop(W);
+    auto argc = static_cast<int>(lua_rawlen(W, 2));
+
+    while (!failed)
+    {
+        auto i = next++;
+        if (i >= sources.size())
+        {
+            break;
+        }
+        auto &[path, source] = sources[i];
+        TraceScope scope("emit.source", path);
+
+        lua_pushvalue(W, entry);
+        lua_pushstring(W, path.c_str());
+        try
+        {
+            PushSource(W, source, graph);
+        }
+        catch (...)
+        {
+            worker.ErrorPath = path;
+            worker.Error = "fail to push source";
+            failed = true;
+            return;
+        }
+        for (int j = 1; j <= argc; ++j)
+        {
+            lua_rawgeti(W, 2, j);
+        }
+        if (lua_pcall(W, 2 + argc, 1, 1) != LUA_OK)
+        {
+            worker.ErrorPath = path;
+            worker.Error = ErrorMessage(W);
+            failed = true;
+            return;
+        }
+        lua_setfield(W, 3, path.c_str());
+    }
+}
+
+// push results or error message
+static bool EmitSources(lua_State *L)
+{
+    auto graph = GetSourceMapGraph(L, 1);
+    if (!graph)
+    {
+        lua_pushstring(L, "clalua.emit: sourceMap from clalua.parse expected");
+        return false;
+    }
+    TraceScope scope("emit");
+
+    EmitOption option;
+    option.Module = GetStringField(L, 2, "module", "");
+    if (option.Module.empty())
+    {
+        lua_pushstring(L, "clalua.emit: module required");
+        return false;
+    }
+    option.Entry = GetStringField(L, 2, "entry", option.Entry);
+    lua_getfield(L, 2, "preload");
+    if (lua_istable(L, -1))
+    {
+        option.Preload.clear();
+        auto n = static_cast<lua_Integer>(lua_rawlen(L, -1));
+        for (lua_Integer i = 1; i <= n; ++i)
+        {
+            lua_rawgeti(L, -1, i);
+            if (lua_isstring(L, -1))
+            {
+                option.Preload.push_back(lua_tostring(L, -1));
+            }
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, 2, "jobs");
+    option.Jobs = static_cast<int>(lua_tointeger(L, -1));
+    lua_pop(L, 1);
+
+    // 実行順に依らないように path で並べる
+    std::vector<std::pair<std::string, SourcePtr>> sources(graph->SourceMap.begin(), graph->SourceMap.end());
+    std::sort(sources.begin(), sources.end(), [](auto &lhs, auto &rhs) { return lhs.first < rhs.first; });
+
+    auto jobs = option.Jobs > 0 ? option.Jobs : static_cast<int>(std::thread::hardware_concurrency());
+    jobs = std::max(1, std::min(jobs, static_cast<int>(sources.size())));
+
+    // worker の lua_State はこの thread で用意する
+    std::vector<std::unique_ptr<EmitWorker>> workers;
+    for (int i = 0; i < jobs; ++i)
+    {
+        std::string error;
+        auto worker = CreateWorker(L, &error);
+        if (!worker)
+        {
+            lua_pushfstring(L, "clalua.emit: %s", error.c_str());
+            return false;
+        }
+        workers.push_back(std::move(worker));
+    }
+
+    {
+        std::atomic<size_t> next = 0;
+        std::atomic<bool> failed = false;
+        std::vector<std::thread> threads;
+        for (auto &worker : workers)
+        {
+            threads.emplace_back([&, worker = worker.get()]() { RunWorker(*worker, option, *graph, sources, next, failed); });
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    for (auto &worker : workers)
+    {
+        if (!worker->Error.empty())
+        {
+            auto path = worker->ErrorPath.empty() ? option.Module : worker->ErrorPath;
+            lua_pushfstring(L, "clalua.emit: %s: %s", path.c_str(), worker->Error.c_str());
+            return false;
+        }
+    }
+
+    // {[path] = result}
+    lua_newtable(L);
+    auto results = lua_gettop(L);
+    for (auto &worker : workers)
+    {
+        std::string error;
+        if (!CopyValue(worker->L, 3, L, &error))
+        {
+            lua_settop(L, results - 1);
+            lua_pushfstring(L, "clalua.emit: results: %s", error.c_str());
+            return false;
+        }
+        lua_pushnil(L);
+        while (lua_next(L, -2))
+        {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_settable(L, results);
+        }
+        lua_pop(L, 1);
+    }
+    return true;
+}
+
+int CLALUA_emit(lua_State *L)
+{
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (!EmitSources(L))
+    {
+        return lua_error(L);
+    }
+    return 1;
+}
+
+} // namespace clalua
@@ -0,0 +1,23 @@
+#pragma once
+
+struct lua_State;
+
+namespace clalua
+{
+
+///
+/// clalua.emit(sourceMap, {
+///     module = "dlang",       -- require する generator
+///     entry = "EmitSource",   -- module[entry](path, source, table.unpack(args))
+///     args = {...},           -- 各 worker の lua_State に複写される
+///     preload = {"predefine"},
+///     jobs = 4,               -- 省略時は hardware_concurrency
+/// })
+/// => {[path] = entry の戻り値}
+///
+/// source 毎の出力を worker thread に分配する。worker 毎に lua_State を作り、
+/// native の graph(read only) から source を push して entry を呼ぶ。
+///
+int CLALUA_emit(lua_State *L);
+
+} // namespace clalua
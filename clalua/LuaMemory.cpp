@@ -0,0 +1,289 @@
+#include "LuaMemory.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+LuaAllocator::~LuaAllocator()
+{
+    for (auto chunk : m_chunks)
+    {
+        std::free(chunk);
+    }
+}
+
+static int Panic(lua_State *L)
+{
+    auto message = lua_tostring(L, -1);
+    std::fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n",
+                 message ? message : "error object is not a string");
+    return 0;
+}
+
+lua_State *LuaAllocator::NewState()
+{
+    auto L = lua_newstate(&LuaAllocator::Alloc, this);
+    if (L)
+    {
+        lua_atpanic(L, &Panic);
+    }
+    return L;
+}
+
+LuaAllocator *LuaAllocator::Get(lua_State *L)
+{
+    void *ud = nullptr;
+    if (lua_getallocf(L, &ud) != &LuaAllocator::Alloc)
+    {
+        return nullptr;
+    }
+    return static_cast<LuaAllocator *>(ud);
+}
+
+void *LuaAllocator::Alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    auto self = static_cast<LuaAllocator *>(ud);
+    if (!ptr)
+    {
+        // osize is the type of object
+        osize = 0;
+    }
+
+    if (nsize == 0)
+    {
+        if (ptr)
+        {
+            ++self->m_stats.Frees;
+            self->m_stats.Bytes -= osize;
+            self->Free(ptr, osize);
+        }
+        return nullptr;
+    }
+
+    void *p = ptr ? self->Reallocate(ptr, osize, nsize) : self->Allocate(nsize);
+    if (p)
+    {
+        self->m_stats.Bytes += nsize;
+        self->m_stats.Bytes -= osize;
+        if (self->m_stats.Bytes > self->m_stats.PeakBytes)
+        {
+            self->m_stats.PeakBytes = self->m_stats.Bytes;
+        }
+    }
+    return p;
+}
+
+void *LuaAllocator::PoolAllocate(size_t sizeClass)
+{
+    ++m_stats.PoolAllocs;
+    if (auto block = m_free[sizeClass])
+    {
+        m_free[sizeClass] = block->Next;
+        return block;
+    }
+
+    auto size = (sizeClass + 1) * GRANULE;
+    if (m_cursor + size > m_end)
+    {
+        auto chunk = static_cast<char *>(std::malloc(CHUNK_SIZE));
+        if (!chunk)
+        {
+            return nullptr;
+        }
+        m_chunks.push_back(chunk);
+        ++m_stats.Chunks;
+        m_cursor = chunk;
+        m_end = chunk + CHUNK_SIZE;
+    }
+    auto p = m_cursor;
+    m_cursor += size;
+    return p;
+}
+
+void *LuaAllocator::Allocate(size_t size)
+{
+    ++m_stats.Allocs;
+    if (m_mode == Mode::Pool && size <= MAX_SMALL)
+    {
+        return PoolAllocate(SizeClass(size));
+    }
+    return std::malloc(size);
+}
+
+void LuaAllocator::Free(void *ptr, size_t size)
+{
+    if (m_mode == Mode::Pool && size <= MAX_SMALL)
+    {
+        auto sizeClass = SizeClass(size);
+        auto block = static_cast<FreeBlock *>(ptr);
+        block->Next = m_free[sizeClass];
+        m_free[sizeClass] = block;
+        return;
+    }
+    std::free(ptr);
+}
+
+void *LuaAllocator::Reallocate(void *ptr, size_t osize, size_t nsize)
+{
+    ++m_stats.Reallocs;
+    if (m_mode == Mode::System || (osize > MAX_SMALL && nsize > MAX_SMALL))
+    {
+        return std::realloc(ptr, nsize);
+    }
+
+    if (osize <= MAX_SMALL && nsize <= MAX_SMALL && SizeClass(osize) == SizeClass(nsize))
+    {
+        // same block
+        return ptr;
+    }
+
+    // move between pool and malloc, or between size classes
+    void *p = nsize <= MAX_SMALL ? PoolAllocate(SizeClass(nsize)) : std::malloc(nsize);
+    if (!p)
+    {
+        return nullptr;
+    }
+    std::memcpy(p, ptr, osize < nsize ? osize : nsize);
+    Free(ptr, osize);
+    return p;
+}
+
+//
+// GC
+//
+static const char *GC_POLICY_KEY = "clalua.GcPolicy";
+
+static const char *GC_MODE_NAMES[] = {"incremental", "generational", "stop", nullptr};
+
+GcPolicy *GetGcPolicy(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, GC_POLICY_KEY);
+    auto policy = static_cast<GcPolicy *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    if (!policy)
+    {
+        policy = new (lua_newuserdata(L, sizeof(GcPolicy))) GcPolicy;
+        lua_setfield(L, LUA_REGISTRYINDEX, GC_POLICY_KEY);
+    }
+    return policy;
+}
+
+void SetGcMode(lua_State *L, GcMode mode)
+{
+    switch (mode)
+    {
+    case GcMode::Stop:
+        lua_gc(L, LUA_GCSTOP);
+        break;
+
+    case GcMode::Generational:
+        lua_gc(L, LUA_GCRESTART);
+        lua_gc(L, LUA_GCGEN, 0, 0);
+        break;
+
+    default:
+        lua_gc(L, LUA_GCRESTART);
+        lua_gc(L, LUA_GCINC, 0, 0, 0);
+        break;
+    }
+}
+
+static int64_t NowMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+ScopedPushPhase::ScopedPushPhase(lua_State *l)
+    : L(l), m_policy(GetGcPolicy(l)), m_begin(NowMicroseconds()), m_beginKB(lua_gc(l, LUA_GCCOUNT))
+{
+    SetGcMode(L, m_policy->Push);
+}
+
+ScopedPushPhase::~ScopedPushPhase()
+{
+    m_policy->LastPushMode = m_policy->Push;
+    m_policy->LastPushMs = (NowMicroseconds() - m_begin) / 1000.0;
+    auto kb = lua_gc(L, LUA_GCCOUNT);
+    m_policy->LastPushKB = kb > m_beginKB ? kb - m_beginKB : 0;
+    SetGcMode(L, m_policy->Emit);
+}
+
+static void OptGcMode(lua_State *L, int index, const char *key, GcMode *mode)
+{
+    lua_getfield(L, index, key);
+    if (!lua_isnil(L, -1))
+    {
+        *mode = static_cast<GcMode>(luaL_checkoption(L, -1, nullptr, GC_MODE_NAMES));
+    }
+    lua_pop(L, 1);
+}
+
+int CLALUA_gc(lua_State *L)
+{
+    auto policy = GetGcPolicy(L);
+    if (lua_istable(L, 1))
+    {
+        OptGcMode(L, 1, "push", &policy->Push);
+        OptGcMode(L, 1, "emit", &policy->Emit);
+        SetGcMode(L, policy->Emit);
+    }
+
+    lua_createtable(L, 0, 3);
+    lua_pushstring(L, GC_MODE_NAMES[static_cast<int>(policy->Push)]);
+    lua_setfield(L, -2, "push");
+    lua_pushstring(L, GC_MODE_NAMES[static_cast<int>(policy->Emit)]);
+    lua_setfield(L, -2, "emit");
+
+    lua_createtable(L, 0, 3);
+    lua_pushstring(L, GC_MODE_NAMES[static_cast<int>(policy->LastPushMode)]);
+    lua_setfield(L, -2, "mode");
+    lua_pushnumber(L, policy->LastPushMs);
+    lua_setfield(L, -2, "ms");
+    lua_pushinteger(L, policy->LastPushKB);
+    lua_setfield(L, -2, "kb");
+    lua_setfield(L, -2, "last_push");
+    return 1;
+}
+
+int CLALUA_alloc_stats(lua_State *L)
+{
+    auto allocator = LuaAllocator::Get(L);
+    if (!allocator)
+    {
+        return 0;
+    }
+    auto &stats = allocator->Stats();
+
+    lua_createtable(L, 0, 8);
+    lua_pushstring(L, allocator->GetMode() == LuaAllocator::Mode::Pool ? "pool" : "system");
+    lua_setfield(L, -2, "mode");
+    lua_pushinteger(L, stats.Allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_pushinteger(L, stats.Reallocs);
+    lua_setfield(L, -2, "reallocs");
+    lua_pushinteger(L, stats.Frees);
+    lua_setfield(L, -2, "frees");
+    lua_pushinteger(L, stats.PoolAllocs);
+    lua_setfield(L, -2, "pool_allocs");
+    lua_pushinteger(L, stats.Chunks);
+    lua_setfield(L, -2, "chunks");
+    lua_pushinteger(L, stats.Bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, stats.PeakBytes);
+    lua_setfield(L, -2, "peak_bytes");
+    return 1;
+}
+
+} // namespace clalua
@@ -0,0 +1,155 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct lua_State;
+
+namespace clalua
+{
+
+struct AllocStats
+{
+    size_t Allocs = 0;
+    size_t Reallocs = 0;
+    size_t Frees = 0;
+    // size <= LuaAllocator::MAX_SMALL
+    size_t PoolAllocs = 0;
+    size_t Chunks = 0;
+    size_t Bytes = 0;
+    size_t PeakBytes = 0;
+};
+
+///
+/// lua_Alloc
+///
+/// * System: realloc/free(統計だけ取る)
+/// * Pool: MAX_SMALL 以下の block を 16byte 刻みの size class の free list から取る。
+///         chunk は state を閉じるまで解放しない
+///
+/// lua_State 毎に作る(thread safe ではない)
+///
+class LuaAllocator
+{
+public:
+    enum class Mode
+    {
+        System,
+        Pool,
+    };
+
+    static constexpr size_t GRANULE = 16;
+    static constexpr size_t MAX_SMALL = 256;
+    static constexpr size_t CLASSES = MAX_SMALL / GRANULE;
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock *Next;
+    };
+
+    Mode m_mode;
+    AllocStats m_stats;
+    FreeBlock *m_free[CLASSES] = {};
+    std::vector<void *> m_chunks;
+    char *m_cursor = nullptr;
+    char *m_end = nullptr;
+
+    LuaAllocator(const LuaAllocator &) = delete;
+    LuaAllocator &operator=(const LuaAllocator &) = delete;
+
+public:
+    LuaAllocator(Mode mode) : m_mode(mode)
+    {
+    }
+    ~LuaAllocator();
+
+    Mode GetMode() const
+    {
+        return m_mode;
+    }
+
+    const AllocStats &Stats() const
+    {
+        return m_stats;
+    }
+
+    // lua_newstate(Alloc, this)
+    lua_State *NewState();
+
+    // LuaAllocator of L. nullptr if L is not created by LuaAllocator
+    static LuaAllocator *Get(lua_State *L);
+
+    static void *Alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+private:
+    static size_t SizeClass(size_t size)
+    {
+        return (size + GRANULE - 1) / GRANULE - 1;
+    }
+    void *Allocate(size_t size);
+    void *Reallocate(void *ptr, size_t osize, size_t nsize);
+    void Free(void *ptr, size_t size);
+    void *PoolAllocate(size_t sizeClass);
+};
+
+///
+/// GC の phase 毎の mode
+///
+/// * push: CLALUA_parse が graph を Lua の table に展開する間。
+///         作った table はほぼ全部生き残るので、止めるか世代別にする
+/// * emit: それ以外(script が出力を組み立てる間)
+///
+enum class GcMode
+{
+    Incremental,
+    Generational,
+    Stop,
+};
+
+struct GcPolicy
+{
+    GcMode Push = GcMode::Stop;
+    GcMode Emit = GcMode::Incremental;
+
+    // 直前の push phase
+    GcMode LastPushMode = GcMode::Incremental;
+    double LastPushMs = 0;
+    size_t LastPushKB = 0;
+};
+
+// registry に置く。無ければ作る
+GcPolicy *GetGcPolicy(lua_State *L);
+void SetGcMode(lua_State *L, GcMode mode);
+
+// push phase の間 policy.Push にして、抜けるときに policy.Emit に戻す
+class ScopedPushPhase
+{
+    lua_State *L;
+    GcPolicy *m_policy;
+    int64_t m_begin;
+    int m_beginKB;
+
+public:
+    ScopedPushPhase(lua_State *L);
+    ~ScopedPushPhase();
+};
+
+///
+/// clalua.gc({push = mode, emit = mode})
+/// => {push = mode, emit = mode, last_push = {mode = mode, ms = n, kb = n}}
+///
+/// mode: "incremental" | "generational" | "stop"
+///
+int CLALUA_gc(lua_State *L);
+
+///
+/// clalua.alloc_stats()
+/// => {mode = "pool" | "system", allocs = n, reallocs = n, frees = n, pool_allocs = n, chunks = n, bytes = n,
+///     peak_bytes = n}
+///    nil if the state was not created by clalua_newstate
+///
+int CLALUA_alloc_stats(lua_State *L);
+
+} // namespace clalua
@@ -0,0 +1,222 @@
+#include "LuaProfiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <fmt/format.h>
+#include <iterator>
+#include <new>
+#include <vector>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+static const char *PROFILER_META = "clalua.LuaProfiler";
+// registry key
+static const char PROFILER_KEY = 0;
+
+// max frames per sample
+static const int MAX_DEPTH = 64;
+
+LuaProfiler *LuaProfiler::Get(lua_State *L)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &PROFILER_KEY);
+    auto profiler = static_cast<LuaProfiler *>(luaL_testudata(L, -1, PROFILER_META));
+    lua_pop(L, 1);
+    return profiler;
+}
+
+void LuaProfiler::Hook(lua_State *L, lua_Debug *)
+{
+    if (auto profiler = Get(L))
+    {
+        profiler->Sample(L);
+    }
+}
+
+void LuaProfiler::Start(lua_State *L)
+{
+    lua_sethook(L, &LuaProfiler::Hook, LUA_MASKCOUNT, Period);
+}
+
+void LuaProfiler::Stop(lua_State *L)
+{
+    lua_sethook(L, nullptr, 0, 0);
+}
+
+static void FrameName(lua_Debug &ar, std::string *out)
+{
+    out->clear();
+    if (*ar.what == 'm')
+    {
+        out->append("main chunk");
+    }
+    else if (ar.name)
+    {
+        out->append(ar.name);
+    }
+    else
+    {
+        out->append("?");
+    }
+    if (*ar.what != 'C')
+    {
+        fmt::format_to(std::back_inserter(*out), "@{}:{}", ar.short_src, ar.linedefined);
+    }
+    // collapsed stack の区切り
+    std::replace(out->begin(), out->end(), ';', ':');
+    std::replace(out->begin(), out->end(), ' ', '_');
+}
+
+void LuaProfiler::Sample(lua_State *L)
+{
+    ++m_samples;
+
+    // leaf to root
+    auto &frames = m_frames;
+    if (frames.size() < MAX_DEPTH)
+    {
+        frames.resize(MAX_DEPTH);
+    }
+    int depth = 0;
+    lua_Debug ar;
+    for (int level = 0; depth < MAX_DEPTH && lua_getstack(L, level, &ar); ++level)
+    {
+        if (!lua_getinfo(L, "Sn", &ar))
+        {
+            break;
+        }
+        FrameName(ar, &frames[depth++]);
+    }
+    if (depth == 0)
+    {
+        return;
+    }
+
+    auto &stack = m_stack;
+    stack.clear();
+    for (int i = depth - 1; i >= 0; --i)
+    {
+        stack += frames[i];
+        if (i)
+        {
+            stack += ';';
+        }
+    }
+    ++m_stacks[stack];
+
+    ++m_functions[frames[0]].Self;
+    // 再帰を 1 回だけ数える
+    for (int i = 0; i < depth; ++i)
+    {
+        if (std::find(frames.begin(), frames.begin() + i, frames[i]) == frames.begin() + i)
+        {
+            ++m_functions[frames[i]].Total;
+        }
+    }
+}
+
+bool LuaProfiler::WriteCollapsed(const std::string &path) const
+{
+    auto fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        return false;
+    }
+    for (auto &[stack, count] : m_stacks)
+    {
+        fprintf(fp, "%s %zu\n", stack.c_str(), count);
+    }
+    return fclose(fp) == 0;
+}
+
+std::string LuaProfiler::TopTable(size_t top) const
+{
+    std::vector<std::pair<std::string_view, FunctionStats>> functions(m_functions.begin(), m_functions.end());
+    std::sort(functions.begin(), functions.end(), [](auto &lhs, auto &rhs) {
+        if (lhs.second.Self != rhs.second.Self)
+        {
+            return lhs.second.Self > rhs.second.Self;
+        }
+        return lhs.first < rhs.first;
+    });
+
+    fmt::memory_buffer out;
+    fmt::format_to(std::back_inserter(out), "{} samples (every {} instructions)\n", m_samples, Period);
+    fmt::format_to(std::back_inserter(out), "{:>8} {:>6} {:>8} {:>6}  {}\n", "self", "%", "total", "%", "function");
+    auto percent = [this](size_t n) { return m_samples ? 100.0 * n / m_samples : 0.0; };
+    for (size_t i = 0; i < functions.size() && i < top; ++i)
+    {
+        auto &[name, stats] = functions[i];
+        fmt::format_to(std::back_inserter(out), "{:>8} {:>6.2f} {:>8} {:>6.2f}  {}\n", stats.Self,
+                       percent(stats.Self), stats.Total, percent(stats.Total), name);
+    }
+    return fmt::to_string(out);
+}
+
+//
+// lua
+//
+static int Profiler_gc(lua_State *L)
+{
+    auto profiler = static_cast<LuaProfiler *>(luaL_checkudata(L, 1, PROFILER_META));
+    profiler->~LuaProfiler();
+    return 0;
+}
+
+int CLALUA_profile_begin(lua_State *L)
+{
+    auto period = static_cast<int>(luaL_optinteger(L, 1, 1000));
+    luaL_argcheck(L, period > 0, 1, "period must be positive");
+    if (LuaProfiler::Get(L))
+    {
+        return luaL_error(L, "clalua.profile_begin: already started");
+    }
+
+    auto profiler = new (lua_newuserdata(L, sizeof(LuaProfiler))) LuaProfiler;
+    profiler->Period = period;
+    if (luaL_newmetatable(L, PROFILER_META))
+    {
+        lua_pushcfunction(L, Profiler_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &PROFILER_KEY);
+
+    profiler->Start(L);
+    return 0;
+}
+
+int CLALUA_profile_end(lua_State *L)
+{
+    auto path = luaL_optstring(L, 1, nullptr);
+    auto top = static_cast<size_t>(luaL_optinteger(L, 2, 20));
+    auto profiler = LuaProfiler::Get(L);
+    if (!profiler)
+    {
+        return luaL_error(L, "clalua.profile_end: not started");
+    }
+    profiler->Stop(L);
+
+    bool written = !path || profiler->WriteCollapsed(path);
+    {
+        auto table = profiler->TopTable(top);
+        lua_pushlstring(L, table.data(), table.size());
+    }
+
+    // release profiler
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &PROFILER_KEY);
+
+    if (!written)
+    {
+        return luaL_error(L, "clalua.profile_end: fail to write %s", path);
+    }
+    return 1;
+}
+
+} // namespace clalua
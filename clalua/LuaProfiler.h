@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct lua_State;
+struct lua_Debug;
+
+namespace clalua
+{
+
+///
+/// lua_sethook の count hook で Lua の call stack を採取する
+///
+/// * Period 命令毎に 1 sample
+/// * native(C function)の中にいる間は sample されない。
+///   clalua.parse などの時間は trace(--trace)で見る
+///
+class LuaProfiler
+{
+    struct FunctionStats
+    {
+        size_t Self = 0;
+        size_t Total = 0;
+    };
+
+    size_t m_samples = 0;
+    // root;...;leaf => samples
+    std::unordered_map<std::string, size_t> m_stacks;
+    std::unordered_map<std::string, FunctionStats> m_functions;
+    // sample 毎の作業領域
+    std::vector<std::string> m_frames;
+    std::string m_stack;
+
+public:
+    int Period = 1000;
+
+    size_t Samples() const
+    {
+        return m_samples;
+    }
+
+    void Start(lua_State *L);
+    void Stop(lua_State *L);
+    void Sample(lua_State *L);
+
+    // flamegraph.pl / speedscope の collapsed stack
+    bool WriteCollapsed(const std::string &path) const;
+    // self 順の上位 top 件
+    std::string TopTable(size_t top) const;
+
+    // profiler of L. nullptr if not started
+    static LuaProfiler *Get(lua_State *L);
+
+private:
+    static void Hook(lua_State *L, lua_Debug *ar);
+};
+
+// clalua.profile_begin([period])
+int CLALUA_profile_begin(lua_State *L);
+///
+/// clalua.profile_end([path [, top]])
+/// => top N table(string)
+///
+/// path: write collapsed stacks
+///
+int CLALUA_profile_end(lua_State *L);
+
+} // namespace clalua
@@ -0,0 +1,428 @@
+#include "LuaPush.h"
+#include "DeclResolve.h"
+#include "Trace.h"
+#include <cassert>
+#include <new>
+#include <iostream>
+#include <typeinfo>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+static const char *GRAPH_META = "clalua.Graph";
+
+static void PushRef(lua_State *L, const clalua::TypeReference &ref, const clalua::ClangDeclProcessor &graph)
+{
+    lua_newtable(L);
+
+    lua_pushstring(L, "type");
+    PushDecl(L, ref.decl, graph);
+    lua_settable(L, -3);
+}
+
+static void PushTypedefDecl(lua_State *L, const std::shared_ptr<clalua::Typedef> &decl, const clalua::ClangDeclProcessor &graph)
+{
+    lua_pushstring(L, "class");
+    lua_pushstring(L, "TypeDef");
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "ref");
+    PushRef(L, decl->ref, graph);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "typedefDepth");
+    lua_pushinteger(L, decl->typedefDepth);
+    lua_settable(L, -3);
+
+    // resolved: ref.type(.ref.type)... の typedefDepth 段目。push 済みの table を共有する
+    lua_getfield(L, -1, "ref");
+    lua_getfield(L, -1, "type");
+    lua_remove(L, -2);
+    for (uint32_t i = 1; i < decl->typedefDepth && lua_istable(L, -1); ++i)
+    {
+        lua_getfield(L, -1, "ref");
+        lua_remove(L, -2);
+        if (!lua_istable(L, -1))
+        {
+            break;
+        }
+        lua_getfield(L, -1, "type");
+        lua_remove(L, -2);
+    }
+    lua_setfield(L, -2, "resolved");
+}
+
+static void PushEnumDecl(lua_State *L, const std::shared_ptr<clalua::EnumDecl> &decl)
+{
+    lua_pushstring(L, "class");
+    lua_pushstring(L, "Enum");
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "values");
+    lua_newtable(L);
+    // TODO:
+    lua_settable(L, -3);
+}
+
+static void PushField(lua_State *L, const clalua::StructField &field, const clalua::ClangDeclProcessor &graph)
+{
+    lua_newtable(L);
+
+    // name
+    lua_pushstring(L, "name");
+    lua_pushstring(L, field.name.c_str());
+    lua_settable(L, -3);
+
+    // offset
+    lua_pushstring(L, "offset");
+    lua_pushinteger(L, field.offset);
+    lua_settable(L, -3);
+
+    // ref
+    lua_pushstring(L, "ref");
+    PushRef(L, field.ref, graph);
+    lua_settable(L, -3);
+}
+
+static void PushStructDecl(lua_State *L, const std::shared_ptr<clalua::StructDecl> &decl,
+                           const clalua::ClangDeclProcessor &graph)
+{
+    lua_pushstring(L, "class");
+    lua_pushstring(L, "Struct");
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "fields");
+    lua_newtable(L);
+    // int i = 1;
+    // for (auto &field : decl->fields)
+    // {
+    //     PushField(L, field);
+    //     lua_rawseti(L, -2, i++);
+    // }
+    lua_settable(L, -3);
+
+    if (decl->isInterface)
+    {
+        lua_pushstring(L, "isInterface");
+        lua_pushboolean(L, 1);
+        lua_settable(L, -3);
+
+        lua_pushstring(L, "methods");
+        lua_createtable(L, static_cast<int>(decl->methods.size()), 0);
+        lua_Integer i = 1;
+        for (auto &method : decl->methods)
+        {
+            PushDecl(L, method, graph);
+            lua_rawseti(L, -2, i++);
+        }
+        lua_settable(L, -3);
+    }
+
+    if (!decl->iid.empty())
+    {
+        lua_pushstring(L, "iid");
+        lua_pushstring(L, decl->iid.c_str());
+        lua_settable(L, -3);
+    }
+
+    if (decl->base)
+    {
+        lua_pushstring(L, "base");
+        PushDecl(L, decl->base, graph);
+        lua_settable(L, -3);
+    }
+}
+
+static void PushFunctionDecl(lua_State *L, const std::shared_ptr<clalua::FunctionDecl> &decl)
+{
+    lua_pushstring(L, "class");
+    lua_pushstring(L, "Function");
+    lua_settable(L, -3);
+}
+
+// {"ns", "inner"}
+static void PushNamespace(lua_State *L, const std::string &key)
+{
+    lua_newtable(L);
+    lua_Integer i = 1;
+    size_t begin = 0;
+    while (begin < key.size())
+    {
+        auto end = key.find("::", begin);
+        if (end == std::string::npos)
+        {
+            end = key.size();
+        }
+        lua_pushlstring(L, key.data() + begin, end - begin);
+        lua_rawseti(L, -2, i++);
+        begin = end + 2;
+    }
+}
+
+void PushUserDecl(lua_State *L, const std::shared_ptr<clalua::UserDecl> &decl, const clalua::ClangDeclProcessor &graph)
+{
+    lua_newtable(L);
+
+    lua_pushstring(L, "name");
+    lua_pushstring(L, decl->name.c_str());
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "hash");
+    lua_pushinteger(L, decl->hash);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "useCount");
+    lua_pushinteger(L, graph.UseCount(decl.get()));
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "qualifiedName");
+    lua_pushstring(L, decl->qualifiedName.empty() ? decl->name.c_str() : decl->qualifiedName.c_str());
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "namespace");
+    PushNamespace(L, decl->namespaceKey);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "namespaceKey");
+    lua_pushlstring(L, decl->namespaceKey.data(), decl->namespaceKey.size());
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "namespaceId");
+    lua_pushinteger(L, decl->namespaceId);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "fingerprint");
+    lua_pushinteger(L, static_cast<lua_Integer>(decl->fingerprint));
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "deepFingerprint");
+    lua_pushinteger(L, static_cast<lua_Integer>(decl->deepFingerprint));
+    lua_settable(L, -3);
+
+    // typedef を剥がした後の class
+    lua_pushstring(L, "canonical");
+    if (auto typedefDecl = std::dynamic_pointer_cast<clalua::Typedef>(decl))
+    {
+        lua_pushstring(L, typedefDecl->resolved ? clalua::DeclClass(*typedefDecl->resolved) : "TypeDef");
+    }
+    else
+    {
+        lua_pushstring(L, clalua::DeclClass(*decl));
+    }
+    lua_settable(L, -3);
+
+    if (auto typedefDecl = std::dynamic_pointer_cast<clalua::Typedef>(decl))
+    {
+        PushTypedefDecl(L, typedefDecl, graph);
+    }
+    else if (auto enumDecl = std::dynamic_pointer_cast<clalua::EnumDecl>(decl))
+    {
+        PushEnumDecl(L, enumDecl);
+    }
+    else if (auto structDecl = std::dynamic_pointer_cast<clalua::StructDecl>(decl))
+    {
+        PushStructDecl(L, structDecl, graph);
+    }
+    else if (auto functionDecl = std::dynamic_pointer_cast<clalua::FunctionDecl>(decl))
+    {
+        // PushFunctionDecl(L, functionDecl);
+    }
+    else
+    {
+        std::cout << "unknown UserDecl: " << decl->name << std::endl;
+    }
+}
+
+template <typename T>
+bool PushPrim(lua_State *L, const std::shared_ptr<clalua::Primitive> &decl)
+{
+    auto t = std::dynamic_pointer_cast<T>(decl);
+    if (!t)
+    {
+        return false;
+    }
+
+    lua_newtable(L);
+
+    lua_pushstring(L, "class");
+    lua_pushstring(L, clalua::DeclClass(*t));
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "name");
+    lua_pushstring(L, typeid(T).name());
+    lua_settable(L, -3);
+
+    return true;
+}
+
+void PushDecl(lua_State *L, const std::shared_ptr<clalua::Decl> &decl, const clalua::ClangDeclProcessor &graph)
+{
+    if (auto userDecl = std::dynamic_pointer_cast<clalua::UserDecl>(decl))
+    {
+        PushUserDecl(L, userDecl, graph);
+    }
+    else if (auto primitive = std::dynamic_pointer_cast<clalua::Primitive>(decl))
+    {
+        if (PushPrim<clalua::Void>(L, primitive))
+            return;
+        else if (PushPrim<clalua::Bool>(L, primitive))
+            return;
+        else if (PushPrim<clalua::Int8>(L, primitive))
+            return;
+        else if (PushPrim<clalua::Int16>(L, primitive))
+            return;
+        else if (PushPrim<clalua::Int32>(L, primitive))
+            return;
+        else if (PushPrim<clalua::Int64>(L, primitive))
+            return;
+        else if (PushPrim<clalua::UInt8>(L, primitive))
+            return;
+        else if (PushPrim<clalua::UInt16>(L, primitive))
+            return;
+        else if (PushPrim<clalua::UInt32>(L, primitive))
+            return;
+        else if (PushPrim<clalua::UInt64>(L, primitive))
+            return;
+        else if (PushPrim<clalua::Float>(L, primitive))
+            return;
+        else if (PushPrim<clalua::Double>(L, primitive))
+            return;
+        else
+        {
+            throw "unknown primitive";
+        }
+    }
+    else if (auto pointer = std::dynamic_pointer_cast<clalua::Pointer>(decl))
+    {
+        lua_newtable(L);
+        lua_pushstring(L, "class");
+        lua_pushstring(L, "Pointer");
+        lua_settable(L, -3);
+
+        lua_pushstring(L, "ref");
+        PushRef(L, pointer->pointee, graph);
+        lua_settable(L, -3);
+    }
+    else if (auto reference = std::dynamic_pointer_cast<clalua::Reference>(decl))
+    {
+        lua_newtable(L);
+        lua_pushstring(L, "class");
+        lua_pushstring(L, "Reference");
+        lua_settable(L, -3);
+    }
+    else if (auto array = std::dynamic_pointer_cast<clalua::Array>(decl))
+    {
+        lua_newtable(L);
+        lua_pushstring(L, "class");
+        lua_pushstring(L, "Array");
+        lua_settable(L, -3);
+    }
+    else
+    {
+        // lua_pushstring(L, "__unknown__");
+        std::cout << "unknown: " << typeid(decl).name() << std::endl;
+    }
+}
+
+// return {decls, macros}
+int PushSource(lua_State *L, const clalua::SourcePtr &source, const clalua::ClangDeclProcessor &graph)
+{
+    auto top = lua_gettop(L);
+    lua_newtable(L);
+
+    {
+        lua_pushstring(L, "name");
+        lua_pushstring(L, source->Name().c_str());
+        lua_settable(L, -3);
+    }
+
+    if (source->SortedByNamespace)
+    {
+        lua_pushstring(L, "sorted");
+        lua_pushstring(L, "namespace");
+        lua_settable(L, -3);
+    }
+
+    // decls
+    {
+        lua_pushstring(L, "types");
+        lua_newtable(L);
+        {
+            int i = 1;
+            for (auto decl : source->Decls)
+            {
+                PushDecl(L, decl, graph);
+                lua_rawseti(L, -2, i++);
+            }
+        }
+        lua_settable(L, -3);
+    }
+
+    // macros
+    {
+        lua_pushstring(L, "macros");
+        lua_newtable(L);
+        lua_settable(L, -3);
+    }
+
+    // std::cerr << "top: " << (lua_gettop(L) - top) << std::endl;
+    assert(lua_gettop(L) - top == 1);
+    return 1;
+}
+
+
+static int Graph_gc(lua_State *L)
+{
+    using GraphPtr = std::shared_ptr<clalua::ClangDeclProcessor>;
+    auto graph = static_cast<GraphPtr *>(luaL_checkudata(L, 1, GRAPH_META));
+    graph->~GraphPtr();
+    return 0;
+}
+
+void PushSourceMap(lua_State *L, const std::shared_ptr<clalua::ClangDeclProcessor> &graph)
+{
+    lua_newtable(L);
+
+    for (auto [key, value] : graph->SourceMap)
+    {
+        // std::cout << key << ": " << value->Decls.size() << ::std::endl;
+        clalua::TraceScope scope("marshal.source", key);
+        lua_pushstring(L, key.c_str());
+        PushSource(L, value, *graph);
+        lua_settable(L, -3);
+    }
+
+    // metatable
+    lua_newtable(L);
+    {
+        auto p = lua_newuserdata(L, sizeof(std::shared_ptr<clalua::ClangDeclProcessor>));
+        new (p) std::shared_ptr<clalua::ClangDeclProcessor>(graph);
+        if (luaL_newmetatable(L, GRAPH_META))
+        {
+            lua_pushcfunction(L, Graph_gc);
+            lua_setfield(L, -2, "__gc");
+        }
+        lua_setmetatable(L, -2);
+    }
+    lua_setfield(L, -2, "__graph");
+    lua_setmetatable(L, -2);
+}
+
+std::shared_ptr<clalua::ClangDeclProcessor> GetSourceMapGraph(lua_State *L, int index)
+{
+    if (!lua_getmetatable(L, index))
+    {
+        return nullptr;
+    }
+    lua_getfield(L, -1, "__graph");
+    auto graph = static_cast<std::shared_ptr<clalua::ClangDeclProcessor> *>(luaL_testudata(L, -1, GRAPH_META));
+    lua_pop(L, 2);
+    if (!graph)
+    {
+        return nullptr;
+    }
+    return *graph;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "ClangDeclProcessor.h"
+#include <memory>
+
+struct lua_State;
+
+// graph: the closure of the decl(useCount)
+void PushDecl(lua_State *L, const std::shared_ptr<clalua::Decl> &decl, const clalua::ClangDeclProcessor &graph);
+void PushUserDecl(lua_State *L, const std::shared_ptr<clalua::UserDecl> &decl,
+                  const clalua::ClangDeclProcessor &graph);
+int PushSource(lua_State *L, const clalua::SourcePtr &source, const clalua::ClangDeclProcessor &graph);
+
+///
+/// return map<path, source>
+///
+/// graph は sourceMap の metatable.__graph に保持する(clalua.emit 等が参照する)
+///
+void PushSourceMap(lua_State *L, const std::shared_ptr<clalua::ClangDeclProcessor> &graph);
+std::shared_ptr<clalua::ClangDeclProcessor> GetSourceMapGraph(lua_State *L, int index);
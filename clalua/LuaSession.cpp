@@ -0,0 +1,171 @@
+#include "LuaSession.h"
+#include "ClangSession.h"
+#include <new>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+static const char *SESSION_META = "clalua.Session";
+
+//
+// userdata は shared_ptr<ClangSession> を保持する。close で reset
+//
+static std::shared_ptr<ClangSession> &CheckSession(lua_State *L)
+{
+    return *static_cast<std::shared_ptr<ClangSession> *>(luaL_checkudata(L, 1, SESSION_META));
+}
+
+static ClangSession &CheckOpenSession(lua_State *L)
+{
+    auto &session = CheckSession(L);
+    if (!session)
+    {
+        luaL_error(L, "session is closed");
+    }
+    return *session;
+}
+
+// s:parse(headers, includes, defines, externC, isD [, option])
+static int Session_parse(lua_State *L)
+{
+    CheckOpenSession(L);
+    lua_settop(L, 7);
+
+    // option を複写して session = s
+    lua_createtable(L, 0, 4);
+    if (lua_istable(L, 7))
+    {
+        lua_pushnil(L);
+        while (lua_next(L, 7))
+        {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_settable(L, -4);
+        }
+    }
+    lua_pushvalue(L, 1);
+    lua_setfield(L, -2, "session");
+    lua_replace(L, 7);
+
+    lua_remove(L, 1);
+    return CLALUA_parse(L);
+}
+
+// s:stats() => {tus, parsed, reparsed, reused, closures, evicted}
+static int Session_stats(lua_State *L)
+{
+    auto stats = CheckOpenSession(L).Stats();
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.Tus));
+    lua_setfield(L, -2, "tus");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.Parsed));
+    lua_setfield(L, -2, "parsed");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.Reparsed));
+    lua_setfield(L, -2, "reparsed");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.Reused));
+    lua_setfield(L, -2, "reused");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.Closures));
+    lua_setfield(L, -2, "closures");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.Evicted));
+    lua_setfield(L, -2, "evicted");
+    return 1;
+}
+
+static int Session_clear(lua_State *L)
+{
+    CheckOpenSession(L).Clear();
+    return 0;
+}
+
+// close, __close. 2回目は何もしない
+static int Session_close(lua_State *L)
+{
+    CheckSession(L).reset();
+    return 0;
+}
+
+static int Session_gc(lua_State *L)
+{
+    using SP = std::shared_ptr<ClangSession>;
+    CheckSession(L).~SP();
+    return 0;
+}
+
+static int Session_tostring(lua_State *L)
+{
+    auto &session = CheckSession(L);
+    if (!session)
+    {
+        lua_pushliteral(L, "session (closed)");
+        return 1;
+    }
+    lua_pushfstring(L, "session (%d tus)", static_cast<int>(session->Stats().Tus));
+    return 1;
+}
+
+static const luaL_Reg SESSION_METHODS[] = {
+    {"parse", Session_parse},
+    {"stats", Session_stats},
+    {"clear", Session_clear},
+    {"close", Session_close},
+    {nullptr, nullptr},
+};
+
+std::shared_ptr<ClangSession> TestSession(lua_State *L, int index)
+{
+    if (lua_isnil(L, index))
+    {
+        return nullptr;
+    }
+    auto p = static_cast<std::shared_ptr<ClangSession> *>(luaL_checkudata(L, index, SESSION_META));
+    if (!*p)
+    {
+        luaL_error(L, "session is closed");
+    }
+    return *p;
+}
+
+int CLALUA_session(lua_State *L)
+{
+    lua_Integer maxTus = 8;
+    if (lua_istable(L, 1))
+    {
+        lua_getfield(L, 1, "max_tus");
+        if (!lua_isnil(L, -1))
+        {
+            maxTus = luaL_checkinteger(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+    if (maxTus <= 0)
+    {
+        return luaL_error(L, "max_tus must be positive");
+    }
+
+    auto p = lua_newuserdata(L, sizeof(std::shared_ptr<ClangSession>));
+    new (p) std::shared_ptr<ClangSession>(std::make_shared<ClangSession>(static_cast<size_t>(maxTus)));
+    if (luaL_newmetatable(L, SESSION_META))
+    {
+        luaL_newlib(L, SESSION_METHODS);
+        lua_setfield(L, -2, "__index");
+
+        lua_pushcfunction(L, Session_gc);
+        lua_setfield(L, -2, "__gc");
+
+        lua_pushcfunction(L, Session_close);
+        lua_setfield(L, -2, "__close");
+
+        lua_pushcfunction(L, Session_tostring);
+        lua_setfield(L, -2, "__tostring");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+} // namespace clalua
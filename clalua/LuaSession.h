@@ -0,0 +1,27 @@
+#pragma once
+#include <memory>
+
+struct lua_State;
+
+// clalua.cpp
+int CLALUA_parse(lua_State *L);
+
+namespace clalua
+{
+
+class ClangSession;
+
+///
+/// clalua.session{max_tus = 8}
+/// => Session(CXIndex と max_tus 個の TU を保持する。ClangSession)
+///    * s:parse(headers, includes, defines, externC, isD [, option]): clalua.parse(..., {session = s})
+///    * s:stats() => {tus, parsed, reparsed, reused, evicted}
+///    * s:clear(): dispose TUs
+///    * s:close(): dispose TUs and the CXIndex. __gc, __close
+///
+int CLALUA_session(lua_State *L);
+
+// clalua.parse の option.session. nil: nullptr, closed: luaL_error
+std::shared_ptr<ClangSession> TestSession(lua_State *L, int index);
+
+} // namespace clalua
@@ -0,0 +1,736 @@
+#include "LuaWriter.h"
+#include "FragmentCache.h"
+#include "OutputDir.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <new>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+static const char *WRITER_META = "clalua.Writer";
+static const char *OUTPUT_DIR_META = "clalua.OutputDir";
+static const char *FRAGMENT_CACHE_META = "clalua.FragmentCache";
+
+bool Writer::Close()
+{
+    if (m_closed)
+    {
+        return true;
+    }
+
+    std::string_view data(m_buffer.data(), m_buffer.size());
+    auto written = m_outdir ? m_outdir->Commit(m_path, data, m_atomic) : WriteFile(m_path, data, m_atomic);
+    if (written)
+    {
+        // 失敗したら buffer を残して、次の Close でもう一度書く
+        m_closed = true;
+        // 書けたら buffer を手放す(gc されるまで writer が残っても memory を持たない)
+        fmt::memory_buffer empty;
+        std::swap(m_buffer, empty);
+    }
+    return written;
+}
+
+// false: fmt::format_error. 例外を lua の C frame に通さない
+template <typename T> static bool FormatArg(fmt::memory_buffer &out, std::string_view spec, const T &value)
+{
+    try
+    {
+        fmt::vformat_to(std::back_inserter(out), spec, fmt::make_format_args(value));
+        return true;
+    }
+    catch (const fmt::format_error &)
+    {
+        return false;
+    }
+}
+
+// fmt に無い書式(整数の precision, %a)は snprintf で
+template <typename T> static bool PrintfArg(fmt::memory_buffer &out, const char *spec, T value)
+{
+    char buffer[1200];
+    auto n = snprintf(buffer, sizeof(buffer), spec, value);
+    if (n < 0 || static_cast<size_t>(n) >= sizeof(buffer))
+    {
+        return false;
+    }
+    out.append(buffer, buffer + n);
+    return true;
+}
+
+///
+/// string.format 互換の %書式を fmt の書式に置き換えて buffer に追記する
+///
+/// %[-+ #0][width][.precision](d|i|u|c|o|x|X|e|E|f|F|g|G|a|A|s|%)
+///
+/// 整数の precision と %a は snprintf で書く。%q は未対応(error)
+///
+/// luaL_error は longjmp するので、ここではデストラクタを持つ値を使わない
+///
+static void WritePrintf(lua_State *L, fmt::memory_buffer &out, int fmtIndex)
+{
+    size_t len;
+    auto p = luaL_checklstring(L, fmtIndex, &len);
+    auto end = p + len;
+    auto arg = fmtIndex;
+    // {:<+#0 + 99 + .999 + type + }
+    char spec[16];
+    size_t specLen = 0;
+    // %-+ #0 + 99 + .999 + ll + type
+    char cspec[16];
+    while (p < end)
+    {
+        auto percent = static_cast<const char *>(memchr(p, '%', end - p));
+        if (!percent)
+        {
+            out.append(p, end);
+            break;
+        }
+        out.append(p, percent);
+        p = percent + 1;
+        if (p < end && *p == '%')
+        {
+            out.push_back('%');
+            ++p;
+            continue;
+        }
+
+        // flags
+        char align = 0;
+        char sign = 0;
+        bool alt = false;
+        bool zero = false;
+        for (; p < end; ++p)
+        {
+            if (*p == '-')
+                align = '<';
+            else if (*p == '+' || *p == ' ')
+                sign = *p;
+            else if (*p == '#')
+                alt = true;
+            else if (*p == '0')
+                zero = true;
+            else
+                break;
+        }
+        auto widthBegin = p;
+        while (p < end && isdigit(static_cast<unsigned char>(*p)))
+        {
+            ++p;
+        }
+        std::string_view width(widthBegin, p - widthBegin);
+        std::string_view precision;
+        if (p < end && *p == '.')
+        {
+            auto precisionBegin = p;
+            ++p;
+            while (p < end && isdigit(static_cast<unsigned char>(*p)))
+            {
+                ++p;
+            }
+            precision = std::string_view(precisionBegin, p - precisionBegin);
+        }
+        if (p >= end || width.size() > 2 || precision.size() > 3)
+        {
+            luaL_error(L, "invalid conversion '%%%.*s' to 'format'", static_cast<int>(p - percent - 1), percent + 1);
+            return;
+        }
+        auto conversion = *p++;
+        if (conversion == 'q')
+        {
+            luaL_error(L, "'%%q' is not supported by writer. use string.format");
+            return;
+        }
+
+        ++arg;
+        if (conversion != 's')
+        {
+            luaL_checkany(L, arg);
+        }
+
+        auto makeSpec = [&](char type, bool numeric) {
+            specLen = 0;
+            auto push = [&](char c) { spec[specLen++] = c; };
+            push('{');
+            push(':');
+            if (align)
+                push(align);
+            else if (!numeric)
+                push('>');
+            if (numeric && sign)
+                push(sign);
+            if (numeric && alt)
+                push('#');
+            if (numeric && zero && !align)
+                push('0');
+            for (auto c : width)
+                push(c);
+            for (auto c : precision)
+                push(c);
+            if (type)
+                push(type);
+            push('}');
+            return std::string_view(spec, specLen);
+        };
+        // printf の書式. length: "ll" or ""
+        auto makeCSpec = [&](const char *length, char type) {
+            size_t n = 0;
+            auto push = [&](char c) { cspec[n++] = c; };
+            push('%');
+            if (align)
+                push('-');
+            if (sign)
+                push(sign);
+            if (alt)
+                push('#');
+            if (zero)
+                push('0');
+            for (auto c : width)
+                push(c);
+            for (auto c : precision)
+                push(c);
+            for (; *length; ++length)
+                push(*length);
+            push(type);
+            cspec[n] = 0;
+            return cspec;
+        };
+
+        auto formatted = true;
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+        {
+            int isnum;
+            auto n = lua_tointegerx(L, arg, &isnum);
+            if (!isnum)
+            {
+                luaL_argerror(L, arg, "number has no integer representation");
+                return;
+            }
+            if (precision.empty())
+            {
+                formatted = FormatArg(out, makeSpec('d', true), n);
+            }
+            else
+            {
+                // fmt は整数の precision を受け付けない
+                formatted = PrintfArg(out, makeCSpec("ll", 'd'), static_cast<long long>(n));
+            }
+            break;
+        }
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        {
+            int isnum;
+            auto n = static_cast<lua_Unsigned>(lua_tointegerx(L, arg, &isnum));
+            if (!isnum)
+            {
+                luaL_argerror(L, arg, "number has no integer representation");
+                return;
+            }
+            if (precision.empty())
+            {
+                formatted = FormatArg(out, makeSpec(conversion == 'u' ? 'd' : conversion, true), n);
+            }
+            else
+            {
+                formatted = PrintfArg(out, makeCSpec("ll", conversion), static_cast<unsigned long long>(n));
+            }
+            break;
+        }
+
+        case 'c':
+        {
+            auto c = static_cast<char>(luaL_checkinteger(L, arg));
+            formatted = FormatArg(out, makeSpec('c', false), c);
+            break;
+        }
+
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        {
+            auto n = luaL_checknumber(L, arg);
+            formatted = FormatArg(out, makeSpec(conversion, true), n);
+            break;
+        }
+
+        case 'a':
+        case 'A':
+        {
+            auto n = luaL_checknumber(L, arg);
+            formatted = PrintfArg(out, makeCSpec("", conversion), static_cast<double>(n));
+            break;
+        }
+
+        case 's':
+        {
+            size_t l;
+            auto s = luaL_tolstring(L, arg, &l);
+            if (width.empty() && precision.empty())
+            {
+                out.append(s, s + l);
+            }
+            else
+            {
+                formatted = FormatArg(out, makeSpec(0, false), std::string_view(s, l));
+            }
+            lua_pop(L, 1);
+            break;
+        }
+
+        default:
+            luaL_error(L, "invalid conversion '%%%c' to 'format'", conversion);
+            return;
+        }
+
+        if (!formatted)
+        {
+            luaL_error(L, "invalid conversion '%%%.*s' to 'format'", static_cast<int>(p - percent - 1), percent + 1);
+            return;
+        }
+    }
+}
+
+static Writer *CheckWriter(lua_State *L)
+{
+    auto writer = static_cast<Writer *>(luaL_checkudata(L, 1, WRITER_META));
+    if (writer->IsClosed())
+    {
+        luaL_error(L, "attempt to use a closed writer: %s", writer->Path().c_str());
+    }
+    return writer;
+}
+
+static void WriteArgs(lua_State *L, Writer *writer, int begin)
+{
+    auto top = lua_gettop(L);
+    for (int i = begin; i <= top; ++i)
+    {
+        size_t len;
+        auto s = luaL_checklstring(L, i, &len);
+        writer->Write(std::string_view(s, len));
+    }
+}
+
+// w:write(...)
+static int Writer_write(lua_State *L)
+{
+    auto writer = CheckWriter(L);
+    WriteArgs(L, writer, 2);
+    lua_settop(L, 1);
+    return 1;
+}
+
+// w:writef(fmt, ...)
+static int Writer_writef(lua_State *L)
+{
+    auto writer = CheckWriter(L);
+    WritePrintf(L, writer->Buffer(), 2);
+    lua_settop(L, 1);
+    return 1;
+}
+
+// w:writefln(fmt, ...)
+static int Writer_writefln(lua_State *L)
+{
+    auto writer = CheckWriter(L);
+    WritePrintf(L, writer->Buffer(), 2);
+    writer->Write("\n");
+    lua_settop(L, 1);
+    return 1;
+}
+
+// w:line(...) indent + ... + \n
+static int Writer_line(lua_State *L)
+{
+    auto writer = CheckWriter(L);
+    if (lua_gettop(L) > 1)
+    {
+        writer->WriteIndent();
+        WriteArgs(L, writer, 2);
+    }
+    writer->Write("\n");
+    lua_settop(L, 1);
+    return 1;
+}
+
+// w:linef(fmt, ...) indent + format + \n
+static int Writer_linef(lua_State *L)
+{
+    auto writer = CheckWriter(L);
+    writer->WriteIndent();
+    WritePrintf(L, writer->Buffer(), 2);
+    writer->Write("\n");
+    lua_settop(L, 1);
+    return 1;
+}
+
+// w:indent([n])
+static int Writer_indent(lua_State *L)
+{
+    auto writer = CheckWriter(L);
+    writer->Indent(static_cast<int>(luaL_optinteger(L, 2, 1)));
+    lua_settop(L, 1);
+    return 1;
+}
+
+// w:dedent([n])
+static int Writer_dedent(lua_State *L)
+{
+    auto writer = CheckWriter(L);
+    writer->Indent(-static_cast<int>(luaL_optinteger(L, 2, 1)));
+    lua_settop(L, 1);
+    return 1;
+}
+
+// w:size()
+static int Writer_size(lua_State *L)
+{
+    auto writer = static_cast<Writer *>(luaL_checkudata(L, 1, WRITER_META));
+    lua_pushinteger(L, writer->Size());
+    return 1;
+}
+
+// w:tail(offset) => string. offset: w:size() の値
+static int Writer_tail(lua_State *L)
+{
+    auto writer = static_cast<Writer *>(luaL_checkudata(L, 1, WRITER_META));
+    auto offset = static_cast<size_t>(luaL_checkinteger(L, 2));
+    auto &buffer = writer->Buffer();
+    luaL_argcheck(L, offset <= buffer.size(), 2, "out of range");
+    lua_pushlstring(L, buffer.data() + offset, buffer.size() - offset);
+    return 1;
+}
+
+// w:close() => true | nil, message
+static int Writer_close(lua_State *L)
+{
+    auto writer = static_cast<Writer *>(luaL_checkudata(L, 1, WRITER_META));
+    if (writer->IsClosed())
+    {
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+    if (!writer->Close())
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: fail to write", writer->Path().c_str());
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int Writer_gc(lua_State *L)
+{
+    auto writer = static_cast<Writer *>(luaL_checkudata(L, 1, WRITER_META));
+    writer->~Writer();
+    return 0;
+}
+
+static int Writer_tostring(lua_State *L)
+{
+    auto writer = static_cast<Writer *>(luaL_checkudata(L, 1, WRITER_META));
+    lua_pushfstring(L, "writer (%s)", writer->Path().c_str());
+    return 1;
+}
+
+static const luaL_Reg WRITER_METHODS[] = {
+    {"write", Writer_write},   {"writef", Writer_writef}, {"writefln", Writer_writefln},
+    {"line", Writer_line},     {"linef", Writer_linef},   {"indent", Writer_indent},
+    {"dedent", Writer_dedent}, {"size", Writer_size},     {"tail", Writer_tail},
+    {"close", Writer_close},   {nullptr, nullptr},
+};
+
+static void PushWriterMeta(lua_State *L)
+{
+    if (luaL_newmetatable(L, WRITER_META))
+    {
+        luaL_newlib(L, WRITER_METHODS);
+        lua_setfield(L, -2, "__index");
+
+        lua_pushcfunction(L, Writer_gc);
+        lua_setfield(L, -2, "__gc");
+
+        lua_pushcfunction(L, Writer_close);
+        lua_setfield(L, -2, "__close");
+
+        lua_pushcfunction(L, Writer_tostring);
+        lua_setfield(L, -2, "__tostring");
+    }
+}
+
+static void PushWriter(lua_State *L, const char *path, bool atomic, const std::shared_ptr<OutputDir> &outdir)
+{
+    auto p = lua_newuserdata(L, sizeof(Writer));
+    new (p) Writer(path, atomic, outdir);
+    PushWriterMeta(L);
+    lua_setmetatable(L, -2);
+}
+
+static bool OptAtomic(lua_State *L, int index)
+{
+    if (!lua_istable(L, index))
+    {
+        return false;
+    }
+    lua_getfield(L, index, "atomic");
+    auto atomic = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return atomic;
+}
+
+int CLALUA_writer(lua_State *L)
+{
+    auto path = luaL_checkstring(L, 1);
+    auto atomic = OptAtomic(L, 2);
+    std::shared_ptr<OutputDir> outdir;
+    if (lua_istable(L, 2))
+    {
+        lua_getfield(L, 2, "outdir");
+        if (!lua_isnil(L, -1))
+        {
+            luaL_checkudata(L, -1, OUTPUT_DIR_META);
+            outdir = TestOutputDir(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+    PushWriter(L, path, atomic, outdir);
+    return 1;
+}
+
+//
+// OutputDir
+//
+// userdata は shared_ptr<OutputDir> を保持する
+//
+static std::shared_ptr<OutputDir> &CheckOutputDir(lua_State *L)
+{
+    return *static_cast<std::shared_ptr<OutputDir> *>(luaL_checkudata(L, 1, OUTPUT_DIR_META));
+}
+
+// o:writer(path, {atomic = bool})
+static int OutputDir_writer(lua_State *L)
+{
+    auto &outdir = CheckOutputDir(L);
+    auto path = luaL_checkstring(L, 2);
+    PushWriter(L, path, OptAtomic(L, 3), outdir);
+    return 1;
+}
+
+// o:finish() => {written = n, unchanged = n, removed = n, bytes = n} | nil, message
+static int OutputDir_finish(lua_State *L)
+{
+    auto &outdir = CheckOutputDir(L);
+    if (!outdir->Finish())
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s/%s: fail to write", outdir->Root().generic_string().c_str(), OutputDir::MANIFEST);
+        return 2;
+    }
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, outdir->Written);
+    lua_setfield(L, -2, "written");
+    lua_pushinteger(L, outdir->Unchanged);
+    lua_setfield(L, -2, "unchanged");
+    lua_pushinteger(L, outdir->Removed);
+    lua_setfield(L, -2, "removed");
+    lua_pushinteger(L, outdir->Bytes);
+    lua_setfield(L, -2, "bytes");
+    return 1;
+}
+
+static int OutputDir_gc(lua_State *L)
+{
+    using SP = std::shared_ptr<OutputDir>;
+    CheckOutputDir(L).~SP();
+    return 0;
+}
+
+static int OutputDir_tostring(lua_State *L)
+{
+    auto &outdir = CheckOutputDir(L);
+    lua_pushfstring(L, "outdir (%s)", outdir->Root().generic_string().c_str());
+    return 1;
+}
+
+static const luaL_Reg OUTPUT_DIR_METHODS[] = {
+    {"writer", OutputDir_writer},
+    {"finish", OutputDir_finish},
+    {nullptr, nullptr},
+};
+
+std::shared_ptr<OutputDir> TestOutputDir(lua_State *L, int index)
+{
+    auto p = static_cast<std::shared_ptr<OutputDir> *>(luaL_testudata(L, index, OUTPUT_DIR_META));
+    return p ? *p : nullptr;
+}
+
+void PushOutputDir(lua_State *L, const std::shared_ptr<OutputDir> &outdir)
+{
+    auto p = lua_newuserdata(L, sizeof(std::shared_ptr<OutputDir>));
+    new (p) std::shared_ptr<OutputDir>(outdir);
+    if (luaL_newmetatable(L, OUTPUT_DIR_META))
+    {
+        luaL_newlib(L, OUTPUT_DIR_METHODS);
+        lua_setfield(L, -2, "__index");
+
+        lua_pushcfunction(L, OutputDir_gc);
+        lua_setfield(L, -2, "__gc");
+
+        lua_pushcfunction(L, OutputDir_tostring);
+        lua_setfield(L, -2, "__tostring");
+    }
+    lua_setmetatable(L, -2);
+}
+
+int CLALUA_outdir(lua_State *L)
+{
+    auto dir = luaL_checkstring(L, 1);
+    PushOutputDir(L, std::make_shared<OutputDir>(dir));
+    return 1;
+}
+
+//
+// FragmentCache
+//
+// userdata は shared_ptr<FragmentCache> を保持する
+//
+static std::shared_ptr<FragmentCache> &CheckFragmentCache(lua_State *L)
+{
+    return *static_cast<std::shared_ptr<FragmentCache> *>(luaL_checkudata(L, 1, FRAGMENT_CACHE_META));
+}
+
+// f:get(key) => text | nil
+static int FragmentCache_get(lua_State *L)
+{
+    auto &fragments = CheckFragmentCache(L);
+    size_t len;
+    auto key = luaL_checklstring(L, 2, &len);
+    std::string text;
+    if (!fragments->Get(std::string(key, len), &text))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushlstring(L, text.data(), text.size());
+    return 1;
+}
+
+// f:put(key, text)
+static int FragmentCache_put(lua_State *L)
+{
+    auto &fragments = CheckFragmentCache(L);
+    size_t keyLen;
+    auto key = luaL_checklstring(L, 2, &keyLen);
+    size_t textLen;
+    auto text = luaL_checklstring(L, 3, &textLen);
+    fragments->Put(std::string(key, keyLen), std::string_view(text, textLen));
+    return 0;
+}
+
+// f:save() => true | nil, message
+static int FragmentCache_save(lua_State *L)
+{
+    auto &fragments = CheckFragmentCache(L);
+    if (!fragments->Save())
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: fail to write", fragments->Path().generic_string().c_str());
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// f:stats() => {loaded = n, hits = n, misses = n, stored = n}
+static int FragmentCache_stats(lua_State *L)
+{
+    auto &fragments = CheckFragmentCache(L);
+    auto stored = fragments->Stored();
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, fragments->Loaded);
+    lua_setfield(L, -2, "loaded");
+    lua_pushinteger(L, fragments->Hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, fragments->Misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, stored);
+    lua_setfield(L, -2, "stored");
+    return 1;
+}
+
+static int FragmentCache_gc(lua_State *L)
+{
+    using SP = std::shared_ptr<FragmentCache>;
+    CheckFragmentCache(L).~SP();
+    return 0;
+}
+
+static int FragmentCache_tostring(lua_State *L)
+{
+    auto &fragments = CheckFragmentCache(L);
+    lua_pushfstring(L, "fragments (%s)", fragments->Path().generic_string().c_str());
+    return 1;
+}
+
+static const luaL_Reg FRAGMENT_CACHE_METHODS[] = {
+    {"get", FragmentCache_get},
+    {"put", FragmentCache_put},
+    {"save", FragmentCache_save},
+    {"stats", FragmentCache_stats},
+    {nullptr, nullptr},
+};
+
+std::shared_ptr<FragmentCache> TestFragmentCache(lua_State *L, int index)
+{
+    auto p = static_cast<std::shared_ptr<FragmentCache> *>(luaL_testudata(L, index, FRAGMENT_CACHE_META));
+    return p ? *p : nullptr;
+}
+
+void PushFragmentCache(lua_State *L, const std::shared_ptr<FragmentCache> &fragments)
+{
+    auto p = lua_newuserdata(L, sizeof(std::shared_ptr<FragmentCache>));
+    new (p) std::shared_ptr<FragmentCache>(fragments);
+    if (luaL_newmetatable(L, FRAGMENT_CACHE_META))
+    {
+        luaL_newlib(L, FRAGMENT_CACHE_METHODS);
+        lua_setfield(L, -2, "__index");
+
+        lua_pushcfunction(L, FragmentCache_gc);
+        lua_setfield(L, -2, "__gc");
+
+        lua_pushcfunction(L, FragmentCache_tostring);
+        lua_setfield(L, -2, "__tostring");
+    }
+    lua_setmetatable(L, -2);
+}
+
+int CLALUA_fragments(lua_State *L)
+{
+    auto path = luaL_checkstring(L, 1);
+    size_t len;
+    auto salt = luaL_optlstring(L, 2, "", &len);
+    PushFragmentCache(L, std::make_shared<FragmentCache>(path, std::string_view(salt, len)));
+    return 1;
+}
+
+} // namespace clalua
@@ -0,0 +1,116 @@
+#pragma once
+#include <fmt/format.h>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct lua_State;
+
+namespace clalua
+{
+
+class OutputDir;
+class FragmentCache;
+
+///
+/// 出力ファイルをメモリ上に組み立てて、Close で一度に書き出す
+///
+/// * atomic: path.tmp に書いてから rename する
+/// * outdir: 内容が変わっていなければ書かない(OutputDir::Commit)
+///
+class Writer
+{
+    std::string m_path;
+    bool m_atomic = false;
+    std::shared_ptr<OutputDir> m_outdir;
+    bool m_closed = false;
+    fmt::memory_buffer m_buffer;
+    int m_indent = 0;
+
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+public:
+    Writer(const std::string &path, bool atomic, const std::shared_ptr<OutputDir> &outdir = nullptr)
+        : m_path(path), m_atomic(atomic), m_outdir(outdir)
+    {
+    }
+    ~Writer()
+    {
+        Close();
+    }
+
+    const std::string &Path() const
+    {
+        return m_path;
+    }
+
+    bool IsClosed() const
+    {
+        return m_closed;
+    }
+
+    size_t Size() const
+    {
+        return m_buffer.size();
+    }
+
+    fmt::memory_buffer &Buffer()
+    {
+        return m_buffer;
+    }
+
+    void Write(std::string_view src)
+    {
+        m_buffer.append(src.data(), src.data() + src.size());
+    }
+
+    void WriteIndent()
+    {
+        for (int i = 0; i < m_indent; ++i)
+        {
+            Write("    ");
+        }
+    }
+
+    void Indent(int delta)
+    {
+        m_indent += delta;
+        if (m_indent < 0)
+        {
+            m_indent = 0;
+        }
+    }
+
+    // write buffer to m_path and free it. return false if failed(the buffer is kept and the next Close retries)
+    bool Close();
+};
+
+// clalua.writer(path, {atomic = bool, outdir = OutputDir})
+int CLALUA_writer(lua_State *L);
+
+///
+/// clalua.outdir(dir)
+/// => OutputDir
+///    * o:writer(path, {atomic = bool})
+///    * o:finish() => {written = n, unchanged = n, removed = n, bytes = n} | nil, message
+///
+int CLALUA_outdir(lua_State *L);
+
+///
+/// clalua.fragments(path, salt)
+/// => FragmentCache
+///    * f:get(key) => text | nil
+///    * f:put(key, text)
+///    * f:save() => true | nil, message
+///    * f:stats() => {loaded = n, hits = n, misses = n, stored = n}
+///
+int CLALUA_fragments(lua_State *L);
+
+// userdata の複写用(clalua.emit の worker に渡す)
+std::shared_ptr<OutputDir> TestOutputDir(lua_State *L, int index);
+void PushOutputDir(lua_State *L, const std::shared_ptr<OutputDir> &outdir);
+std::shared_ptr<FragmentCache> TestFragmentCache(lua_State *L, int index);
+void PushFragmentCache(lua_State *L, const std::shared_ptr<FragmentCache> &fragments);
+
+} // namespace clalua
@@ -0,0 +1,74 @@
+#include "MemoryUsage.h"
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+// after windows.h
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace clalua
+{
+
+#ifdef _WIN32
+
+static bool GetCounters(PROCESS_MEMORY_COUNTERS *counters)
+{
+    return GetProcessMemoryInfo(GetCurrentProcess(), counters, sizeof(*counters));
+}
+
+size_t PeakRssBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetCounters(&counters) ? counters.PeakWorkingSetSize : 0;
+}
+
+size_t CurrentRssBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetCounters(&counters) ? counters.WorkingSetSize : 0;
+}
+
+#else
+
+size_t PeakRssBytes()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    // bytes
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    // kilobytes
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+size_t CurrentRssBytes()
+{
+    auto fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+    {
+        return 0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    auto n = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    if (n != 2)
+    {
+        return 0;
+    }
+    return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+#endif
+
+} // namespace clalua
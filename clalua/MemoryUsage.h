@@ -0,0 +1,12 @@
+#pragma once
+#include <stddef.h>
+
+namespace clalua
+{
+
+// peak resident set size of this process in bytes. 0 if not supported
+size_t PeakRssBytes();
+// current resident set size of this process in bytes. 0 if not supported
+size_t CurrentRssBytes();
+
+} // namespace clalua
@@ -0,0 +1,243 @@
+#include "OutputDir.h"
+#include "Hash.h"
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+namespace clalua
+{
+
+bool WriteFile(const std::filesystem::path &path, std::string_view data, bool atomic)
+{
+    auto dst = path;
+    if (atomic)
+    {
+        dst += ".tmp";
+    }
+
+    std::ofstream ofs(dst, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+    {
+        return false;
+    }
+    ofs.write(data.data(), data.size());
+    ofs.close();
+    if (!ofs)
+    {
+        return false;
+    }
+
+    if (atomic)
+    {
+        std::error_code ec;
+        std::filesystem::rename(dst, path, ec);
+        if (ec)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool HashFile(const std::filesystem::path &path, uint64_t *hash)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+    {
+        return false;
+    }
+    std::vector<char> buffer(64 * 1024);
+    uint64_t h = Fnv1a(nullptr, 0);
+    while (ifs)
+    {
+        ifs.read(buffer.data(), buffer.size());
+        h = Fnv1a(buffer.data(), static_cast<size_t>(ifs.gcount()), h);
+    }
+    *hash = h;
+    return true;
+}
+
+static int64_t MTime(const std::filesystem::path &path)
+{
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    return ec ? 0 : static_cast<int64_t>(mtime.time_since_epoch().count());
+}
+
+static bool IsHex(std::string_view s)
+{
+    for (auto c : s)
+    {
+        if (!isxdigit(static_cast<unsigned char>(c)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// root からの相対 path で、外に出ないもの
+static bool IsInsideKey(const std::filesystem::path &key)
+{
+    if (key.empty() || key.has_root_name() || key.has_root_directory())
+    {
+        return false;
+    }
+    for (auto &part : key)
+    {
+        if (part == "..")
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+OutputDir::OutputDir(const std::filesystem::path &root) : m_root(root)
+{
+    // {hash:016x} {mtime:016x} {relative path}
+    // 古い形式 {hash:016x} {relative path} は mtime 不明として読む
+    std::ifstream ifs(m_root / MANIFEST);
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (line.size() < 18 || line[16] != ' ' || !IsHex(std::string_view(line).substr(0, 16)))
+        {
+            continue;
+        }
+        Stamp stamp;
+        stamp.Hash = std::strtoull(line.substr(0, 16).c_str(), nullptr, 16);
+        auto key = line.substr(17);
+        if (line.size() >= 35 && line[33] == ' ' && IsHex(std::string_view(line).substr(17, 16)))
+        {
+            stamp.MTime = static_cast<int64_t>(std::strtoull(line.substr(17, 16).c_str(), nullptr, 16));
+            key = line.substr(34);
+        }
+        if (!IsInsideKey(key) || std::filesystem::path(key).lexically_normal().generic_string() != key)
+        {
+            // 編集された manifest. root の外は消さない
+            continue;
+        }
+        m_previous.emplace(key, stamp);
+    }
+}
+
+std::string OutputDir::RelativeKey(const std::filesystem::path &path) const
+{
+    auto relative = path.lexically_normal().lexically_relative(m_root.lexically_normal());
+    if (!IsInsideKey(relative))
+    {
+        return {};
+    }
+    return relative.generic_string();
+}
+
+bool OutputDir::Commit(const std::filesystem::path &path, std::string_view data, bool atomic)
+{
+    auto key = RelativeKey(path);
+    auto hash = Fnv1a(data);
+
+    bool unchanged = false;
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        if (!ec && size == data.size())
+        {
+            Stamp previous;
+            bool known = false;
+            if (!key.empty())
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto found = m_previous.find(key);
+                if (found != m_previous.end())
+                {
+                    known = true;
+                    previous = found->second;
+                }
+            }
+            auto mtime = MTime(path);
+            if (known && previous.MTime && previous.MTime == mtime)
+            {
+                // 前回書いたまま
+                unchanged = previous.Hash == hash;
+            }
+            else
+            {
+                // manifest に無いか、書いた後に触られている。実物の hash を取る
+                uint64_t actual;
+                unchanged = HashFile(path, &actual) && actual == hash;
+            }
+        }
+    }
+
+    if (!unchanged)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+        if (!WriteFile(path, data, atomic))
+        {
+            return false;
+        }
+    }
+
+    auto mtime = MTime(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!key.empty())
+    {
+        m_current[key] = {hash, mtime};
+    }
+    Bytes += data.size();
+    if (unchanged)
+    {
+        ++Unchanged;
+    }
+    else
+    {
+        ++Written;
+    }
+    return true;
+}
+
+bool OutputDir::Finish()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_finished)
+    {
+        return true;
+    }
+
+    for (auto &[key, stamp] : m_previous)
+    {
+        if (m_current.find(key) == m_current.end())
+        {
+            std::error_code ec;
+            if (std::filesystem::remove(m_root / key, ec))
+            {
+                ++Removed;
+            }
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_root, ec);
+    std::string manifest;
+    char hex[40];
+    for (auto &[key, stamp] : m_current)
+    {
+        snprintf(hex, sizeof(hex), "%016llx %016llx ", static_cast<unsigned long long>(stamp.Hash),
+                 static_cast<unsigned long long>(stamp.MTime));
+        manifest += hex;
+        manifest += key;
+        manifest += '\n';
+    }
+    if (!WriteFile(m_root / MANIFEST, manifest, true))
+    {
+        // 次の Finish でやり直す
+        return false;
+    }
+    m_finished = true;
+    return true;
+}
+
+} // namespace clalua
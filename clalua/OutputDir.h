@@ -0,0 +1,71 @@
+#pragma once
+#include <filesystem>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace clalua
+{
+
+// write data to path at once. atomic: write path.tmp then rename
+bool WriteFile(const std::filesystem::path &path, std::string_view data, bool atomic);
+
+///
+/// 出力ディレクトリ
+///
+/// 前回の出力(path と内容の hash, mtime)を MANIFEST に記録しておき、
+/// * 内容が変わったファイルだけ書き換える(mtime を保つ)
+/// * 今回出力しなかった前回のファイルを削除する
+///
+/// mtime が記録と違うファイル(手で編集された等)は読んで hash を比べる。
+/// root の外(絶対 path, ..)は MANIFEST に入れないし消さない
+///
+/// clalua.emit の worker からも使うので thread safe
+///
+class OutputDir
+{
+    struct Stamp
+    {
+        uint64_t Hash = 0;
+        // file_time_type::duration. 0: unknown
+        int64_t MTime = 0;
+    };
+
+    std::filesystem::path m_root;
+    std::mutex m_mutex;
+    // relative path => stamp
+    std::unordered_map<std::string, Stamp> m_previous;
+    std::unordered_map<std::string, Stamp> m_current;
+    bool m_finished = false;
+
+public:
+    static constexpr const char *MANIFEST = ".clalua_outputs";
+
+    size_t Written = 0;
+    size_t Unchanged = 0;
+    size_t Removed = 0;
+    // content bytes committed(written + unchanged)
+    size_t Bytes = 0;
+
+    OutputDir(const std::filesystem::path &root);
+
+    const std::filesystem::path &Root() const
+    {
+        return m_root;
+    }
+
+    // write if changed. return false if failed
+    bool Commit(const std::filesystem::path &path, std::string_view data, bool atomic);
+
+    // remove stale files and save manifest. return false if the manifest is not saved
+    bool Finish();
+
+private:
+    // empty if path is outside m_root
+    std::string RelativeKey(const std::filesystem::path &path) const;
+};
+
+} // namespace clalua
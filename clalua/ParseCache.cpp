@@ -0,0 +1,211 @@
+#include "ParseCache.h"
+#include "clalua.h"
+#include "DeclFingerprint.h"
+#include "MemoryUsage.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace clalua
+{
+
+std::string ParseInput::Key() const
+{
+    return TuKey() + ClosureKey();
+}
+
+std::string ParseInput::TuKey() const
+{
+    // '\0' は path や define に現れない
+    std::string key;
+    for (auto list : {&Headers, &Includes, &Defines})
+    {
+        for (auto &value : *list)
+        {
+            key += value;
+            key += '\0';
+        }
+        key += '\n';
+    }
+    return key;
+}
+
+std::string ParseInput::ClosureKey() const
+{
+    std::string key = SortByNamespace ? "namespace" : "";
+    if (Prune.Enabled())
+    {
+        key += "\nprune";
+        key += Prune.DllExportOnly ? ":dllExport" : "";
+        for (auto &name : Prune.Names)
+        {
+            key += '\0';
+            key += name;
+        }
+    }
+    return key;
+}
+
+class RootFilter
+{
+    const PruneOption &m_prune;
+    std::unordered_set<std::string_view> m_names;
+
+public:
+    RootFilter(const PruneOption &prune) : m_prune(prune)
+    {
+        for (auto &name : prune.Names)
+        {
+            m_names.insert(name);
+        }
+    }
+
+    bool IsRoot(const UserDecl &decl) const
+    {
+        if (m_prune.DllExportOnly)
+        {
+            if (auto functionDecl = dynamic_cast<const FunctionDecl *>(&decl))
+            {
+                if (!functionDecl->dllExport)
+                {
+                    return false;
+                }
+            }
+        }
+        if (!m_names.empty())
+        {
+            if (m_names.find(decl.name) == m_names.end() && m_names.find(decl.qualifiedName) == m_names.end())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+void BuildClosure(const std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> &map, const ParseInput &input,
+                  ParsedGraph *graph)
+{
+    graph->Decls = map.size();
+    graph->Graph = CountGraph(map);
+    if (map.empty())
+    {
+        return;
+    }
+
+    auto processor = std::make_shared<ClangDeclProcessor>();
+    auto begin = std::chrono::steady_clock::now();
+    {
+        TraceScope scope("closure");
+        if (input.Progress)
+        {
+            input.Progress->Phase("closure");
+        }
+        processor->Progress = input.Progress;
+        // prune: 落とした root からだけ参照される decl は closure に入らない
+        RootFilter filter(input.Prune);
+        for (auto [id, decl] : map)
+        {
+            auto found = std::find(input.Headers.begin(), input.Headers.end(), decl->path);
+            if (found != input.Headers.end() && filter.IsRoot(*decl))
+            {
+                processor->AddDecl(decl, {});
+            }
+        }
+        processor->CountUses();
+        if (input.SortByNamespace)
+        {
+            processor->SortByNamespace();
+        }
+        // graph は parse の後も残る
+        processor->Progress = nullptr;
+        ComputeFingerprints(*processor);
+    }
+    graph->ClosureMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    graph->ClosurePeakRss = PeakRssBytes();
+    graph->Processor = processor;
+}
+
+ParsedGraphPtr BuildGraph(ParseInput input)
+{
+    auto graph = std::make_shared<ParsedGraph>();
+    auto map = Parse(input.Headers, input.Includes, input.Defines, &graph->Phases, input.Progress);
+    BuildClosure(map, input, graph.get());
+    return graph;
+}
+
+static std::mutex g_cacheMutex;
+static bool g_cacheEnabled = false;
+static std::unordered_map<std::string, std::shared_future<ParsedGraphPtr>> g_cache;
+
+void EnableParseCache(bool enable)
+{
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    g_cacheEnabled = enable;
+    if (!enable)
+    {
+        g_cache.clear();
+    }
+}
+
+ParsedGraphPtr ParseCached(const ParseInput &input, bool *hit)
+{
+    *hit = false;
+    auto key = input.Key();
+    std::promise<ParsedGraphPtr> promise;
+    std::shared_future<ParsedGraphPtr> cached;
+    bool enabled;
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        enabled = g_cacheEnabled;
+        if (enabled)
+        {
+            auto found = g_cache.find(key);
+            if (found != g_cache.end())
+            {
+                cached = found->second;
+            }
+            else
+            {
+                g_cache.emplace(key, promise.get_future().share());
+            }
+        }
+    }
+    if (!enabled)
+    {
+        return BuildGraph(input);
+    }
+    if (cached.valid())
+    {
+        // parse 中なら終わるまで待つ
+        *hit = true;
+        TraceScope scope("parse.wait");
+        return cached.get();
+    }
+
+    try
+    {
+        auto graph = BuildGraph(input);
+        promise.set_value(graph);
+        return graph;
+    }
+    catch (...)
+    {
+        // 待っている thread にも投げる。次の要求は parse しなおす
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        g_cache.erase(key);
+        throw;
+    }
+}
+
+} // namespace clalua
+
+void clalua_parse_cache(int enable)
+{
+    clalua::EnableParseCache(enable != 0);
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "ClangDeclProcessor.h"
+#include "ClangIndex.h"
+#include "GraphStats.h"
+#include "ParseProgress.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clalua
+{
+
+// clalua.parse option.prune. closure の root(Headers の decl)を絞る
+struct PruneOption
+{
+    // functions without __declspec(dllexport) are not roots
+    bool DllExportOnly = false;
+    // empty: any. name or qualifiedName
+    std::vector<std::string> Names;
+
+    bool Enabled() const
+    {
+        return DllExportOnly || !Names.empty();
+    }
+};
+
+// clalua.parse の引数
+struct ParseInput
+{
+    std::vector<std::string> Headers;
+    std::vector<std::string> Includes;
+    std::vector<std::string> Defines;
+    bool SortByNamespace = false;
+    PruneOption Prune;
+    // nullptr: no progress. Key に含めない
+    ParseProgress *Progress = nullptr;
+
+    // TuKey + ClosureKey
+    std::string Key() const;
+    // Headers, Includes, Defines. the TU and the traversal
+    std::string TuKey() const;
+    // SortByNamespace, Prune. the closure built from the traversal
+    std::string ClosureKey() const;
+};
+
+///
+/// parse, traverse, closure の結果
+///
+/// 作った後は read only。複数の lua_State(clalua_driver --batch の job)から同時に push する
+///
+struct ParsedGraph
+{
+    // nullptr: no decls
+    std::shared_ptr<ClangDeclProcessor> Processor;
+    ParsePhases Phases;
+    GraphStats Graph;
+    size_t Decls = 0;
+    double ClosureMs = 0;
+    size_t ClosurePeakRss = 0;
+};
+using ParsedGraphPtr = std::shared_ptr<const ParsedGraph>;
+
+// decls of input.Headers and what they reference
+void BuildClosure(const std::unordered_map<uint32_t, std::shared_ptr<UserDecl>> &map, const ParseInput &input,
+                  ParsedGraph *graph);
+
+// Parse and BuildClosure
+ParsedGraphPtr BuildGraph(ParseInput input);
+
+///
+/// clalua_parse_cache(1) の間、同じ ParseInput の BuildGraph を process で1回にする
+///
+/// 同じ input を同時に要求した thread は最初の thread の parse を待つ。
+/// 無効なら毎回 BuildGraph する。hit: cache から返した
+///
+ParsedGraphPtr ParseCached(const ParseInput &input, bool *hit);
+
+// disable: cache した graph も捨てる
+void EnableParseCache(bool enable);
+
+} // namespace clalua
@@ -0,0 +1,74 @@
+#include "ParseProgress.h"
+#include <string_view>
+
+namespace clalua
+{
+
+ParseProgress::ParseProgress(std::function<void(const ProgressSnapshot &)> callback, double intervalMs)
+    : m_callback(std::move(callback)), m_owner(std::this_thread::get_id()),
+      m_interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(intervalMs))),
+      m_begin(Clock::now()), m_phaseBegin(m_begin), m_last(m_begin)
+{
+}
+
+ProgressSnapshot ParseProgress::Snapshot(Clock::time_point now) const
+{
+    ProgressSnapshot snapshot;
+    snapshot.Phase = m_phase;
+    snapshot.Files = m_files.load(std::memory_order_relaxed);
+    snapshot.Cursors = m_cursors.load(std::memory_order_relaxed);
+    snapshot.Decls = m_decls.load(std::memory_order_relaxed);
+    snapshot.ClosureDecls = m_closureDecls.load(std::memory_order_relaxed);
+    snapshot.ElapsedMs = std::chrono::duration<double, std::milli>(now - m_begin).count();
+
+    auto phaseSeconds = std::chrono::duration<double>(now - m_phaseBegin).count();
+    if (phaseSeconds > 0)
+    {
+        std::string_view phase(m_phase);
+        if (phase == "traverse")
+        {
+            snapshot.PerSecond = snapshot.Cursors / phaseSeconds;
+        }
+        else if (phase == "closure")
+        {
+            snapshot.PerSecond = snapshot.ClosureDecls / phaseSeconds;
+        }
+    }
+    return snapshot;
+}
+
+void ParseProgress::Report(Clock::time_point now)
+{
+    m_last = now;
+    if (m_callback)
+    {
+        m_callback(Snapshot(now));
+    }
+}
+
+void ParseProgress::Phase(const char *phase)
+{
+    if (std::this_thread::get_id() != m_owner)
+    {
+        return;
+    }
+    auto now = Clock::now();
+    m_phase = phase;
+    m_phaseBegin = now;
+    Report(now);
+}
+
+void ParseProgress::Poll()
+{
+    if (std::this_thread::get_id() != m_owner)
+    {
+        return;
+    }
+    auto now = Clock::now();
+    if (now - m_last >= m_interval)
+    {
+        Report(now);
+    }
+}
+
+} // namespace clalua
@@ -0,0 +1,114 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+
+namespace clalua
+{
+
+struct ProgressSnapshot
+{
+    // "parse", "traverse", "closure", "push", "done"
+    const char *Phase = "";
+    // included files of the TU(after parse)
+    size_t Files = 0;
+    // TraverserImpl::traverse
+    size_t Cursors = 0;
+    // created in traverse
+    size_t Decls = 0;
+    // ClangDeclProcessor::AddDecl
+    size_t ClosureDecls = 0;
+    double ElapsedMs = 0;
+    // cursors/s in traverse, closure decls/s in closure
+    double PerSecond = 0;
+};
+
+///
+/// clalua.parse{progress = function} の進捗
+///
+/// 件数は relaxed atomic で数える。callback は作った thread でだけ、
+/// phase が変わったときと interval 毎に呼ぶ。時刻は Tick の 256 回に 1 回だけ見る
+///
+/// callback は ClangSession の lock の中で呼ばれるので clalua.parse を呼んではいけない(clalua.cpp で error にする)
+///
+class ParseProgress
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::function<void(const ProgressSnapshot &)> m_callback;
+    std::thread::id m_owner;
+    Clock::duration m_interval;
+    Clock::time_point m_begin;
+    Clock::time_point m_phaseBegin;
+    Clock::time_point m_last;
+
+    const char *m_phase = "";
+    std::atomic<size_t> m_files = 0;
+    std::atomic<size_t> m_cursors = 0;
+    std::atomic<size_t> m_decls = 0;
+    std::atomic<size_t> m_closureDecls = 0;
+    std::atomic<uint32_t> m_ticks = 0;
+
+    void Tick()
+    {
+        if ((m_ticks.fetch_add(1, std::memory_order_relaxed) & 255) == 255)
+        {
+            Poll();
+        }
+    }
+
+    void Report(Clock::time_point now);
+
+public:
+    ParseProgress(std::function<void(const ProgressSnapshot &)> callback, double intervalMs);
+
+    // always reports
+    void Phase(const char *phase);
+    // reports if the interval passed
+    void Poll();
+
+    void SetFiles(size_t files)
+    {
+        m_files.store(files, std::memory_order_relaxed);
+    }
+    void Cursor()
+    {
+        m_cursors.fetch_add(1, std::memory_order_relaxed);
+        Tick();
+    }
+    void Decl()
+    {
+        m_decls.fetch_add(1, std::memory_order_relaxed);
+    }
+    void ClosureDecl()
+    {
+        m_closureDecls.fetch_add(1, std::memory_order_relaxed);
+        Tick();
+    }
+
+    ProgressSnapshot Snapshot(Clock::time_point now) const;
+
+    // work を別 thread で走らせ、終わるまで interval 毎に Poll する(clang の parse 中の heartbeat)。
+    // libclang は parse を自前の 8MB stack の thread で走らせるので、ここの thread の stack は使わない
+    template <typename F> auto Run(F &&work) -> decltype(work())
+    {
+        if (!m_callback || std::this_thread::get_id() != m_owner)
+        {
+            return work();
+        }
+        auto wait = std::max(m_interval, Clock::duration(std::chrono::milliseconds(10)));
+        auto future = std::async(std::launch::async, std::forward<F>(work));
+        while (future.wait_for(wait) != std::future_status::ready)
+        {
+            Poll();
+        }
+        return future.get();
+    }
+};
+
+} // namespace clalua
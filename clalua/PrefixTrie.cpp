@@ -0,0 +1,207 @@
+#include "PrefixTrie.h"
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+void PrefixTrie::Add(std::string_view prefix, uint32_t id)
+{
+    uint32_t current = 0;
+    for (auto c : prefix)
+    {
+        auto key = static_cast<uint8_t>(c);
+        uint32_t next = 0;
+        for (auto &[k, child] : m_nodes[current].Children)
+        {
+            if (k == key)
+            {
+                next = child;
+                break;
+            }
+        }
+        if (!next)
+        {
+            next = static_cast<uint32_t>(m_nodes.size());
+            m_nodes[current].Children.emplace_back(key, next);
+            m_nodes.emplace_back();
+        }
+        current = next;
+    }
+    if (!m_nodes[current].Terminal)
+    {
+        m_nodes[current].Terminal = id + 1;
+    }
+}
+
+uint32_t PrefixTrie::LongestMatch(std::string_view src) const
+{
+    uint32_t found = m_nodes[0].Terminal;
+    uint32_t current = 0;
+    for (auto c : src)
+    {
+        auto key = static_cast<uint8_t>(c);
+        uint32_t next = 0;
+        for (auto &[k, child] : m_nodes[current].Children)
+        {
+            if (k == key)
+            {
+                next = child;
+                break;
+            }
+        }
+        if (!next)
+        {
+            break;
+        }
+        current = next;
+        if (m_nodes[current].Terminal)
+        {
+            found = m_nodes[current].Terminal;
+        }
+    }
+    return found ? found - 1 : NOT_FOUND;
+}
+
+void PrefixTrie::AllMatches(std::string_view src, std::vector<uint32_t> *ids) const
+{
+    ids->clear();
+    uint32_t current = 0;
+    if (m_nodes[0].Terminal)
+    {
+        ids->push_back(m_nodes[0].Terminal - 1);
+    }
+    for (auto c : src)
+    {
+        auto key = static_cast<uint8_t>(c);
+        uint32_t next = 0;
+        for (auto &[k, child] : m_nodes[current].Children)
+        {
+            if (k == key)
+            {
+                next = child;
+                break;
+            }
+        }
+        if (!next)
+        {
+            break;
+        }
+        current = next;
+        if (m_nodes[current].Terminal)
+        {
+            ids->push_back(m_nodes[current].Terminal - 1);
+        }
+    }
+}
+
+int CLALUA_group_prefix(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    auto key = luaL_optstring(L, 3, "name");
+    auto all = lua_toboolean(L, 4);
+    auto prefixCount = static_cast<lua_Integer>(lua_rawlen(L, 2));
+    // luaL_error の前に C++ の local を作らない
+    for (lua_Integer i = 1; i <= prefixCount; ++i)
+    {
+        if (lua_rawgeti(L, 2, i) != LUA_TSTRING)
+        {
+            return luaL_error(L, "prefixes[%d] is not a string", static_cast<int>(i));
+        }
+        lua_pop(L, 1);
+    }
+
+    // groups[prefix] = {}
+    PrefixTrie trie;
+    lua_createtable(L, 0, static_cast<int>(prefixCount));
+    auto groups = lua_gettop(L);
+    // id => group table
+    lua_createtable(L, static_cast<int>(prefixCount), 0);
+    auto groupById = lua_gettop(L);
+    for (lua_Integer i = 1; i <= prefixCount; ++i)
+    {
+        lua_rawgeti(L, 2, i);
+        size_t size;
+        auto prefix = lua_tolstring(L, -1, &size);
+        if (lua_getfield(L, groups, prefix) != LUA_TTABLE)
+        {
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_setfield(L, groups, prefix);
+        }
+        lua_rawseti(L, groupById, i);
+        trie.Add(std::string_view(prefix, size), static_cast<uint32_t>(i));
+        lua_pop(L, 1);
+    }
+
+    lua_newtable(L);
+    auto rest = lua_gettop(L);
+    lua_Integer restCount = 0;
+    std::vector<lua_Integer> counts(static_cast<size_t>(prefixCount) + 1);
+    std::vector<uint32_t> ids;
+    auto match = [&](std::string_view name) {
+        if (all)
+        {
+            trie.AllMatches(name, &ids);
+        }
+        else
+        {
+            ids.clear();
+            auto id = trie.LongestMatch(name);
+            if (id != PrefixTrie::NOT_FOUND)
+            {
+                ids.push_back(id);
+            }
+        }
+    };
+    auto itemCount = static_cast<lua_Integer>(lua_rawlen(L, 1));
+    for (lua_Integer i = 1; i <= itemCount; ++i)
+    {
+        lua_rawgeti(L, 1, i);
+        ids.clear();
+        if (lua_type(L, -1) == LUA_TSTRING)
+        {
+            size_t size;
+            auto name = lua_tolstring(L, -1, &size);
+            match(std::string_view(name, size));
+        }
+        else if (lua_istable(L, -1))
+        {
+            if (lua_getfield(L, -1, key) == LUA_TSTRING)
+            {
+                size_t size;
+                auto name = lua_tolstring(L, -1, &size);
+                match(std::string_view(name, size));
+            }
+            lua_pop(L, 1);
+        }
+
+        if (ids.empty())
+        {
+            lua_rawseti(L, rest, ++restCount);
+            continue;
+        }
+        for (auto id : ids)
+        {
+            lua_rawgeti(L, groupById, id);
+            lua_pushvalue(L, -2);
+            lua_rawseti(L, -2, ++counts[id]);
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pushvalue(L, groups);
+    lua_pushvalue(L, rest);
+    return 2;
+}
+
+} // namespace clalua
@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct lua_State;
+
+namespace clalua
+{
+
+///
+/// 最長一致(または一致する全部)の prefix 検索
+///
+/// 接頭辞の数(数十)に対して検索対象(数万の macro)が多い用途。
+/// 子は node 毎の小さい配列を線形探索する
+///
+class PrefixTrie
+{
+    struct Node
+    {
+        // prefix id + 1. 0: not terminal
+        uint32_t Terminal = 0;
+        std::vector<std::pair<uint8_t, uint32_t>> Children;
+    };
+    std::vector<Node> m_nodes{1};
+
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    // 同じ prefix は最初の id のまま
+    void Add(std::string_view prefix, uint32_t id);
+
+    // id of the longest prefix of src. NOT_FOUND if none
+    uint32_t LongestMatch(std::string_view src) const;
+
+    // ids of all prefixes of src, shortest first
+    void AllMatches(std::string_view src, std::vector<uint32_t> *ids) const;
+};
+
+///
+/// clalua.group_prefix(items, prefixes [, key [, all]])
+/// => {[prefix] = {item...}}, {unmatched item...}
+///
+/// item: string か item[key](default: "name")が string の table。
+/// 各 item は最長一致の prefix の group にだけ入る。all なら一致する全部の group に入る。
+/// 順序は items の順
+///
+int CLALUA_group_prefix(lua_State *L);
+
+} // namespace clalua
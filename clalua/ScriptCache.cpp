@@ -0,0 +1,254 @@
+#include "ScriptCache.h"
+#include "Hash.h"
+#include "OutputDir.h"
+#include "clalua.h"
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <string_view>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+static const char *SCRIPT_CACHE_KEY = "clalua.ScriptCache";
+// {MAGIC}{source hash:016x}\n{bytecode}
+static const std::string_view MAGIC = "CLALUAC ";
+static const size_t HEADER_SIZE = 8 + 16 + 1;
+
+static int ScriptCache_gc(lua_State *L)
+{
+    auto cache = static_cast<ScriptCache *>(lua_touserdata(L, 1));
+    cache->~ScriptCache();
+    return 0;
+}
+
+ScriptCache *GetScriptCache(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, SCRIPT_CACHE_KEY);
+    auto cache = static_cast<ScriptCache *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return cache;
+}
+
+static bool ReadAll(const std::filesystem::path &path, std::string *dst)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+    {
+        return false;
+    }
+    std::ostringstream ss;
+    ss << ifs.rdbuf();
+    *dst = std::move(ss).str();
+    return true;
+}
+
+static int DumpWriter(lua_State *, const void *p, size_t size, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), size);
+    return 0;
+}
+
+static std::filesystem::path CachePath(const ScriptCache &cache, std::string_view name, std::string_view path)
+{
+    // 別の directory の同名 module を区別する
+    return std::filesystem::path(cache.CacheDir) /
+           fmt::format("{}.{:08x}.luac", name, static_cast<uint32_t>(Fnv1a(path)));
+}
+
+// push the chunk or an error message. does not raise
+static int LoadCached(lua_State *L, ScriptCache *cache, const char *name, const char *path)
+{
+    std::string source;
+    if (!ReadAll(path, &source))
+    {
+        lua_pushfstring(L, "cannot open %s", path);
+        return LUA_ERRFILE;
+    }
+    auto chunkname = std::string("@") + path;
+
+    // luaL_loadfile と同じく BOM と先頭の # 行を飛ばす(行番号のため改行は残す)
+    std::string_view text = source;
+    if (text.substr(0, 3) == "\xEF\xBB\xBF")
+    {
+        text.remove_prefix(3);
+    }
+    if (!text.empty() && text[0] == '#')
+    {
+        auto pos = text.find('\n');
+        text.remove_prefix(pos == std::string_view::npos ? text.size() : pos);
+    }
+    if (!text.empty() && text[0] == LUA_SIGNATURE[0])
+    {
+        // precompiled
+        return luaL_loadbufferx(L, text.data(), text.size(), chunkname.c_str(), "b");
+    }
+
+    if (cache->CacheDir.empty())
+    {
+        ++cache->Stats.Misses;
+        return luaL_loadbufferx(L, text.data(), text.size(), chunkname.c_str(), "t");
+    }
+
+    auto hash = fmt::format("{}{:016x}\n", MAGIC, Fnv1a(source));
+    auto cachePath = CachePath(*cache, name, path);
+    std::string bytecode;
+    if (ReadAll(cachePath, &bytecode) && bytecode.size() > HEADER_SIZE && bytecode.compare(0, HEADER_SIZE, hash) == 0)
+    {
+        if (luaL_loadbufferx(L, bytecode.data() + HEADER_SIZE, bytecode.size() - HEADER_SIZE, chunkname.c_str(),
+                             "b") == LUA_OK)
+        {
+            ++cache->Stats.Hits;
+            return LUA_OK;
+        }
+        // lua の version 違いなど。compile しなおす
+        lua_pop(L, 1);
+    }
+
+    ++cache->Stats.Misses;
+    auto status = luaL_loadbufferx(L, text.data(), text.size(), chunkname.c_str(), "t");
+    if (status != LUA_OK)
+    {
+        return status;
+    }
+    bytecode = hash;
+    lua_dump(L, &DumpWriter, &bytecode, 0);
+    // worker が同時に書いても壊れないように atomic
+    WriteFile(cachePath, bytecode, true);
+    return LUA_OK;
+}
+
+static const clalua_embedded_script *FindEmbedded(const ScriptCache *cache, const char *name)
+{
+    if (!cache->Embedded)
+    {
+        return nullptr;
+    }
+    for (auto e = cache->Embedded; e->name; ++e)
+    {
+        if (std::string_view(e->name) == name)
+        {
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+// package.searchers
+static int Searcher(lua_State *L)
+{
+    auto name = luaL_checkstring(L, 1);
+    auto cache = GetScriptCache(L);
+    if (!cache)
+    {
+        return 0;
+    }
+
+    if (auto embedded = FindEmbedded(cache, name))
+    {
+        if (luaL_loadbufferx(L, reinterpret_cast<const char *>(embedded->data), embedded->size, name, "b") != LUA_OK)
+        {
+            return luaL_error(L, "error loading embedded module '%s':\n\t%s", name, lua_tostring(L, -1));
+        }
+        ++cache->Stats.Embedded;
+        lua_pushfstring(L, ":embedded:%s", name);
+        return 2;
+    }
+
+    // package.searchpath(name, package.path)
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "searchpath");
+    lua_pushvalue(L, 1);
+    lua_getfield(L, -3, "path");
+    lua_call(L, 2, 2);
+    if (lua_isnil(L, -2))
+    {
+        // Lua の searcher が message を出す
+        return 0;
+    }
+    lua_pop(L, 1);
+    auto path = lua_tostring(L, -1);
+
+    if (LoadCached(L, cache, name, path) != LUA_OK)
+    {
+        return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, path, lua_tostring(L, -1));
+    }
+    lua_pushstring(L, path);
+    return 2;
+}
+
+ScriptCache *InstallScriptCache(lua_State *L, const std::string &cacheDir, const clalua_embedded_script *embedded)
+{
+    auto cache = GetScriptCache(L);
+    if (!cache)
+    {
+        cache = new (lua_newuserdata(L, sizeof(ScriptCache))) ScriptCache;
+        lua_createtable(L, 0, 1);
+        lua_pushcfunction(L, ScriptCache_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, SCRIPT_CACHE_KEY);
+
+        // table.insert(package.searchers, 2, Searcher)
+        lua_getglobal(L, "package");
+        lua_getfield(L, -1, "searchers");
+        auto n = static_cast<int>(lua_rawlen(L, -1));
+        for (int i = n; i >= 2; --i)
+        {
+            lua_rawgeti(L, -1, i);
+            lua_rawseti(L, -2, i + 1);
+        }
+        lua_pushcfunction(L, Searcher);
+        lua_rawseti(L, -2, 2);
+        lua_pop(L, 2);
+    }
+
+    cache->CacheDir = cacheDir;
+    cache->Embedded = embedded;
+    if (!cacheDir.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir, ec);
+    }
+    return cache;
+}
+
+void CopyScriptCache(lua_State *L, lua_State *W)
+{
+    if (auto cache = GetScriptCache(L))
+    {
+        InstallScriptCache(W, cache->CacheDir, cache->Embedded);
+    }
+}
+
+int LoadScript(lua_State *L, const char *name, const char *path)
+{
+    auto cache = GetScriptCache(L);
+    if (!cache)
+    {
+        return luaL_loadfile(L, path);
+    }
+    return LoadCached(L, cache, name, path);
+}
+
+} // namespace clalua
+
+void clalua_script_cache(lua_State *L, const char *cache_dir, const clalua_embedded_script *embedded)
+{
+    clalua::InstallScriptCache(L, cache_dir ? cache_dir : "", embedded);
+}
+
+int clalua_loadfile(lua_State *L, const char *path)
+{
+    auto name = std::filesystem::path(path).stem().string();
+    return clalua::LoadScript(L, name.c_str(), path);
+}
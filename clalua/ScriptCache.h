@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+struct lua_State;
+struct clalua_embedded_script;
+
+namespace clalua
+{
+
+struct ScriptCacheStats
+{
+    // loaded from clalua_embedded_script
+    size_t Embedded = 0;
+    // bytecode in CacheDir was fresh
+    size_t Hits = 0;
+    // compiled from source (and written to CacheDir)
+    size_t Misses = 0;
+};
+
+///
+/// require / clalua_loadfile の bytecode cache
+///
+/// package.searchers[2](preload の次)に入る searcher
+/// 1. Embedded(clalua_embed で埋め込んだ bytecode)
+/// 2. package.path で見つけた script の bytecode を {CacheDir}/{name}.{path hash}.luac から読む。
+///    header の source hash が一致しなければ compile して書き直す
+///
+/// lua_State の registry に置く。clalua.emit の worker は親の設定を引き継ぐ
+///
+struct ScriptCache
+{
+    // empty: bytecode を書かない
+    std::string CacheDir;
+    // {nullptr, nullptr, 0} terminated
+    const clalua_embedded_script *Embedded = nullptr;
+    ScriptCacheStats Stats;
+};
+
+// nullptr if not installed
+ScriptCache *GetScriptCache(lua_State *L);
+
+// install the searcher
+ScriptCache *InstallScriptCache(lua_State *L, const std::string &cacheDir, const clalua_embedded_script *embedded);
+
+// copy the settings of L to W (clalua.emit worker)
+void CopyScriptCache(lua_State *L, lua_State *W);
+
+// luaL_loadfile through the cache. name: cache key (module name)
+int LoadScript(lua_State *L, const char *name, const char *path);
+
+} // namespace clalua
@@ -0,0 +1,208 @@
+#include "Trace.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <new>
+#include <vector>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+namespace clalua
+{
+
+std::atomic<bool> g_traceEnabled = false;
+
+struct TraceEvent
+{
+    std::string Name;
+    std::string Detail;
+    int64_t Begin;
+    int64_t End;
+    uint32_t Thread;
+};
+
+static std::mutex g_traceMutex;
+static std::string g_tracePath;
+static std::vector<TraceEvent> g_traceEvents;
+
+static uint32_t ThreadIndex()
+{
+    static std::atomic<uint32_t> s_next = 1;
+    thread_local uint32_t t_index = s_next++;
+    return t_index;
+}
+
+int64_t TraceNow()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void TraceRecord(const char *name, const char *detail, int64_t begin, int64_t end)
+{
+    auto thread = ThreadIndex();
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    if (!TraceEnabled())
+    {
+        return;
+    }
+    g_traceEvents.push_back({name, detail ? detail : "", begin, end, thread});
+}
+
+bool TraceBegin(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    g_tracePath = path;
+    g_traceEvents.clear();
+    g_traceEnabled = true;
+    return true;
+}
+
+static void WriteJsonString(FILE *fp, const std::string &src)
+{
+    fputc('"', fp);
+    for (auto c : src)
+    {
+        switch (c)
+        {
+        case '"':
+            fputs("\\\"", fp);
+            break;
+        case '\\':
+            fputs("\\\\", fp);
+            break;
+        case '\n':
+            fputs("\\n", fp);
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                fprintf(fp, "\\u%04x", c);
+            }
+            else
+            {
+                fputc(c, fp);
+            }
+            break;
+        }
+    }
+    fputc('"', fp);
+}
+
+bool TraceEnd()
+{
+    std::vector<TraceEvent> events;
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(g_traceMutex);
+        if (!TraceEnabled())
+        {
+            return true;
+        }
+        g_traceEnabled = false;
+        events.swap(g_traceEvents);
+        path.swap(g_tracePath);
+    }
+
+    auto fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        return false;
+    }
+    int64_t origin = events.empty() ? 0 : events.front().Begin;
+    for (auto &e : events)
+    {
+        if (e.Begin < origin)
+        {
+            origin = e.Begin;
+        }
+    }
+
+    fputs("{\"traceEvents\":[\n", fp);
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        auto &e = events[i];
+        fputs("{\"name\":", fp);
+        WriteJsonString(fp, e.Name);
+        fprintf(fp, ",\"cat\":\"clalua\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld", e.Thread,
+                static_cast<long long>(e.Begin - origin), static_cast<long long>(e.End - e.Begin));
+        if (!e.Detail.empty())
+        {
+            fputs(",\"args\":{\"detail\":", fp);
+            WriteJsonString(fp, e.Detail);
+            fputs("}", fp);
+        }
+        fputs(i + 1 < events.size() ? "},\n" : "}\n", fp);
+    }
+    fputs("]}\n", fp);
+    return fclose(fp) == 0;
+}
+
+//
+// lua
+//
+static const char *TRACE_SCOPE_META = "clalua.TraceScope";
+
+int CLALUA_trace_begin(lua_State *L)
+{
+    auto path = luaL_checkstring(L, 1);
+    TraceBegin(path);
+    return 0;
+}
+
+int CLALUA_trace_end(lua_State *L)
+{
+    if (!TraceEnd())
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, "clalua.trace_end: fail to write");
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int TraceScope_close(lua_State *L)
+{
+    auto scope = static_cast<TraceScope *>(luaL_checkudata(L, 1, TRACE_SCOPE_META));
+    if (lua_getiuservalue(L, 1, 1) != LUA_TNIL)
+    {
+        // first close
+        scope->~TraceScope();
+        lua_pushnil(L);
+        lua_setiuservalue(L, 1, 1);
+    }
+    return 0;
+}
+
+int CLALUA_trace_scope(lua_State *L)
+{
+    auto name = luaL_checkstring(L, 1);
+    auto detail = luaL_optstring(L, 2, "");
+    if (!TraceEnabled())
+    {
+        return 0;
+    }
+
+    // user value 1: name. keeps the name alive and marks the scope open
+    auto p = lua_newuserdatauv(L, sizeof(TraceScope), 1);
+    lua_pushvalue(L, 1);
+    lua_setiuservalue(L, -2, 1);
+    new (p) TraceScope(name, detail);
+    if (luaL_newmetatable(L, TRACE_SCOPE_META))
+    {
+        lua_pushcfunction(L, TraceScope_close);
+        lua_setfield(L, -2, "__close");
+        lua_pushcfunction(L, TraceScope_close);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+} // namespace clalua
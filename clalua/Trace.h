@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+struct lua_State;
+
+namespace clalua
+{
+
+///
+/// Chrome trace(chrome://tracing, ui.perfetto.dev) 形式の区間計測
+///
+/// TraceBegin から TraceEnd までの TraceScope を記録して json に書き出す。
+/// 無効な間は TraceScope は atomic<bool> を 1 回読むだけ
+///
+extern std::atomic<bool> g_traceEnabled;
+
+inline bool TraceEnabled()
+{
+    return g_traceEnabled.load(std::memory_order_relaxed);
+}
+
+// start recording. path: output json
+bool TraceBegin(const std::string &path);
+// write json and stop recording. return false if failed to write
+bool TraceEnd();
+
+int64_t TraceNow();
+void TraceRecord(const char *name, const char *detail, int64_t begin, int64_t end);
+
+class TraceScope
+{
+    const char *m_name;
+    std::string m_detail;
+    int64_t m_begin = -1;
+
+public:
+    TraceScope(const char *name) : m_name(name)
+    {
+        if (TraceEnabled())
+        {
+            m_begin = TraceNow();
+        }
+    }
+    TraceScope(const char *name, const std::string &detail) : m_name(name)
+    {
+        if (TraceEnabled())
+        {
+            m_detail = detail;
+            m_begin = TraceNow();
+        }
+    }
+    ~TraceScope()
+    {
+        if (m_begin >= 0)
+        {
+            TraceRecord(m_name, m_detail.empty() ? nullptr : m_detail.c_str(), m_begin, TraceNow());
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+// clalua.trace_begin(path)
+int CLALUA_trace_begin(lua_State *L);
+// clalua.trace_end() => true | nil, message
+int CLALUA_trace_end(lua_State *L);
+///
+/// local scope <close> = clalua.trace_scope(name [, detail])
+///
+/// nil while tracing is disabled
+///
+int CLALUA_trace_scope(lua_State *L);
+
+} // namespace clalua
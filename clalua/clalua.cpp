@@ -2,9 +2,30 @@
 #include "ClangIndex.h"
 #include "ClangCursorTraverser.h"
 #include "ClangDeclProcessor.h"
+#include "ClangSession.h"
+#include "DeclFingerprint.h"
+#include "DeclIndex.h"
+#include "GraphStats.h"
+#include "LuaEmitter.h"
+#include "LuaMemory.h"
+#include "LuaProfiler.h"
+#include "LuaPush.h"
+#include "LuaSession.h"
+#include "LuaWriter.h"
+#include "MemoryUsage.h"
+#include "ParseCache.h"
+#include "ParseProgress.h"
+#include "PrefixTrie.h"
+#include "ScriptCache.h"
+#include "Trace.h"
 #include <plog/Appenders/ConsoleAppender.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <new>
 #include <plog/Log.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <perilune/perilune.h>
 
@@ -35,74 +56,6 @@ public:
 };
 } // namespace plog
 
-struct Lua
-{
-    lua_State *L;
-
-    Lua() : L(luaL_newstate())
-    {
-        luaL_requiref(L, "_G", luaopen_base, 1);
-        lua_pop(L, 1);
-    }
-
-    ~Lua()
-    {
-        lua_close(L);
-    }
-
-    void printLuaError()
-    {
-        std::cerr << lua_tostring(L, -1) << std::endl;
-    }
-
-    bool doFile(const char *file)
-    {
-        if (luaL_dofile(L, file))
-        {
-            printLuaError();
-            return false;
-        }
-        return true;
-    }
-
-    void cmdline(int argc, char **argv)
-    {
-        if (argc < 2)
-        {
-            // error
-            LOGE << "usage: clalua.exe {script.lua} [args...]";
-            return;
-        }
-
-        auto file = argv[1];
-        argv += 2;
-        argc -= 2;
-
-        // parse script
-        auto chunk = luaL_loadfile(L, file);
-        if (chunk)
-        {
-            // error
-            LOGE << lua_tostring(L, -1);
-            return;
-        }
-
-        // push arguments
-        for (int i = 0; i < argc; ++i)
-        {
-            lua_pushstring(L, argv[i]);
-        }
-
-        // execute chunk
-        auto result = lua_pcall(L, argc, LUA_MULTRET, 0);
-        if (result)
-        {
-            LOGE << lua_tostring(L, -1);
-            return;
-        }
-    }
-};
-
 static void BackslashToSlash(std::string &src)
 {
     for (auto &c : src)
@@ -122,292 +75,413 @@ static void BackslashStoSlash(std::vector<std::string> &srcs)
     }
 }
 
-static void PushDecl(lua_State *L, const std::shared_ptr<clalua::Decl> &decl);
-
-static void PushRef(lua_State *L, const clalua::TypeReference &ref)
+// 直前の clalua.parse の phase 毎の時間(ms)、件数、メモリ
+struct ParseStats
 {
-    lua_newtable(L);
+    double ParseMs = 0;
+    double TraverseMs = 0;
+    double ClosureMs = 0;
+    double PushMs = 0;
+    size_t Decls = 0;
+    size_t Sources = 0;
+    size_t SourceDecls = 0;
+    // clalua_parse_cache. Parse/Traverse/Closure were done by another clalua.parse
+    bool Cached = false;
+    // clalua_parse_session. parsed, reparsed or reused
+    const char *Session = nullptr;
+    // the error of option.progress. the callback is not called after that
+    std::string ProgressError;
+
+    clalua::ParsePhases Phases;
+    clalua::GraphStats Graph;
+    size_t ClosurePeakRss = 0;
+    size_t PushPeakRss = 0;
+    // after marshaling
+    size_t LuaHeapBytes = 0;
+};
 
-    lua_pushstring(L, "type");
-    PushDecl(L, ref.decl);
-    lua_settable(L, -3);
-}
+static const char *PARSE_STATS_KEY = "clalua.ParseStats";
 
-static void PushTypedefDecl(lua_State *L, const std::shared_ptr<clalua::Typedef> &decl)
+static int ParseStats_gc(lua_State *L)
 {
-    lua_pushstring(L, "class");
-    lua_pushstring(L, "TypeDef");
-    lua_settable(L, -3);
-
-    lua_pushstring(L, "ref");
-    PushRef(L, decl->ref);
-    lua_settable(L, -3);
+    static_cast<ParseStats *>(lua_touserdata(L, 1))->~ParseStats();
+    return 0;
 }
 
-static void PushEnumDecl(lua_State *L, const std::shared_ptr<clalua::EnumDecl> &decl)
+static ParseStats *GetParseStats(lua_State *L)
 {
-    lua_pushstring(L, "class");
-    lua_pushstring(L, "Enum");
-    lua_settable(L, -3);
-
-    lua_pushstring(L, "values");
-    lua_newtable(L);
-    // TODO:
-    lua_settable(L, -3);
+    lua_getfield(L, LUA_REGISTRYINDEX, PARSE_STATS_KEY);
+    auto stats = static_cast<ParseStats *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    if (!stats)
+    {
+        stats = new (lua_newuserdata(L, sizeof(ParseStats))) ParseStats;
+        if (luaL_newmetatable(L, PARSE_STATS_KEY))
+        {
+            lua_pushcfunction(L, ParseStats_gc);
+            lua_setfield(L, -2, "__gc");
+        }
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, PARSE_STATS_KEY);
+    }
+    return stats;
 }
 
-static void PushField(lua_State *L, const clalua::StructField &field)
+static double ElapsedMs(std::chrono::steady_clock::time_point begin)
 {
-    lua_newtable(L);
-
-    // name
-    lua_pushstring(L, "name");
-    lua_pushstring(L, field.name.c_str());
-    lua_settable(L, -3);
-
-    // offset
-    lua_pushstring(L, "offset");
-    lua_pushinteger(L, field.offset);
-    lua_settable(L, -3);
-
-    // ref
-    lua_pushstring(L, "ref");
-    PushRef(L, field.ref);
-    lua_settable(L, -3);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
 }
 
-static void PushStructDecl(lua_State *L, const std::shared_ptr<clalua::StructDecl> &decl)
-{
-    lua_pushstring(L, "class");
-    lua_pushstring(L, "Struct");
-    lua_settable(L, -3);
+// option.progress の stack index
+static const int PROGRESS_INDEX = 7;
 
-    lua_pushstring(L, "namespace");
-    lua_newtable(L);
-    // TODO:
-    lua_settable(L, -3);
+// progress callback の中. ClangSession の lock を持っているので clalua.parse は error にする
+static thread_local bool t_inProgress = false;
 
-    lua_pushstring(L, "fields");
-    lua_newtable(L);
-    // int i = 1;
-    // for (auto &field : decl->fields)
-    // {
-    //     PushField(L, field);
-    //     lua_rawseti(L, -2, i++);
-    // }
-    lua_settable(L, -3);
+// progress({phase, files, cursors, decls, closure_decls, elapsed_ms, per_s})
+static void CallProgress(lua_State *L, ParseStats *stats, const clalua::ProgressSnapshot &snapshot)
+{
+    if (!stats->ProgressError.empty())
+    {
+        return;
+    }
+    lua_pushvalue(L, PROGRESS_INDEX);
+    lua_createtable(L, 0, 7);
+    lua_pushstring(L, snapshot.Phase);
+    lua_setfield(L, -2, "phase");
+    lua_pushinteger(L, static_cast<lua_Integer>(snapshot.Files));
+    lua_setfield(L, -2, "files");
+    lua_pushinteger(L, static_cast<lua_Integer>(snapshot.Cursors));
+    lua_setfield(L, -2, "cursors");
+    lua_pushinteger(L, static_cast<lua_Integer>(snapshot.Decls));
+    lua_setfield(L, -2, "decls");
+    lua_pushinteger(L, static_cast<lua_Integer>(snapshot.ClosureDecls));
+    lua_setfield(L, -2, "closure_decls");
+    lua_pushnumber(L, snapshot.ElapsedMs);
+    lua_setfield(L, -2, "elapsed_ms");
+    lua_pushnumber(L, snapshot.PerSecond);
+    lua_setfield(L, -2, "per_s");
+    // libclang の callback の中なので longjmp しない
+    t_inProgress = true;
+    auto status = lua_pcall(L, 1, 0, 0);
+    t_inProgress = false;
+    if (status != LUA_OK)
+    {
+        auto message = lua_tostring(L, -1);
+        stats->ProgressError = message ? message : "error";
+        lua_pop(L, 1);
+    }
 }
 
-static void PushFunctionDecl(lua_State *L, const std::shared_ptr<clalua::FunctionDecl> &decl)
+// lua_pcall から. 1: lightuserdata(const std::shared_ptr<ClangDeclProcessor> *)
+static int ProtectedPushSourceMap(lua_State *L)
 {
-    lua_pushstring(L, "class");
-    lua_pushstring(L, "Function");
-    lua_settable(L, -3);
+    auto processor = static_cast<const std::shared_ptr<clalua::ClangDeclProcessor> *>(lua_touserdata(L, 1));
+    lua_settop(L, 0);
+    PushSourceMap(L, *processor);
+    return 1;
 }
 
-static void PushUserDecl(lua_State *L, const std::shared_ptr<clalua::UserDecl> &decl)
+// -1: error. the error object is on the top
+static int ParseAndPush(lua_State *L)
 {
-    lua_newtable(L);
-
-    lua_pushstring(L, "name");
-    lua_pushstring(L, decl->name.c_str());
-    lua_settable(L, -3);
-
-    lua_pushstring(L, "hash");
-    lua_pushinteger(L, decl->hash);
-    lua_settable(L, -3);
-
-    lua_pushstring(L, "useCount");
-    // TODO:
-    lua_pushinteger(L, 0);
-    lua_settable(L, -3);
-
-    if (auto typedefDecl = std::dynamic_pointer_cast<clalua::Typedef>(decl))
+    if (t_inProgress)
     {
-        PushTypedefDecl(L, typedefDecl);
+        return luaL_error(L, "clalua.parse: called from option.progress");
     }
-    else if (auto enumDecl = std::dynamic_pointer_cast<clalua::EnumDecl>(decl))
+    auto stats = GetParseStats(L);
+    *stats = {};
+
+    // 6: {progress = function(p), progress_ms = 500}
+    lua_settop(L, 6);
+    double progressMs = 500;
+    if (lua_istable(L, 6))
     {
-        PushEnumDecl(L, enumDecl);
+        lua_getfield(L, 6, "progress_ms");
+        if (lua_isnumber(L, -1))
+        {
+            progressMs = lua_tonumber(L, -1);
+        }
+        lua_pop(L, 1);
+        lua_getfield(L, 6, "progress");
+        if (!lua_isnil(L, -1))
+        {
+            luaL_checktype(L, -1, LUA_TFUNCTION);
+        }
     }
-    else if (auto structDecl = std::dynamic_pointer_cast<clalua::StructDecl>(decl))
+    else
     {
-        PushStructDecl(L, structDecl);
+        lua_pushnil(L);
     }
-    else if (auto functionDecl = std::dynamic_pointer_cast<clalua::FunctionDecl>(decl))
+
+    // 6: {session = clalua.session}. luaL_error の前に C++ の local を作らない
+    std::shared_ptr<clalua::ClangSession> session;
+    if (lua_istable(L, 6))
     {
-        // PushFunctionDecl(L, functionDecl);
+        lua_getfield(L, 6, "session");
+        session = clalua::TestSession(L, -1);
+        lua_pop(L, 1);
     }
-    else
+    if (!session)
     {
-        std::cout << "unknown UserDecl: " << decl->name << std::endl;
+        session = clalua::GetDefaultSession();
     }
-}
 
-template <typename T>
-bool PushPrim(lua_State *L, const std::shared_ptr<clalua::Primitive> &decl)
-{
-    auto t = std::dynamic_pointer_cast<T>(decl);
-    if (!t)
+    // 型情報を集める
+    clalua::ParseInput input;
+    input.Headers = perilune::LuaGetVector<std::string>(L, 1);
+    input.Includes = perilune::LuaGetVector<std::string>(L, 2);
+    input.Defines = perilune::LuaGetVector<std::string>(L, 3);
+    auto externC = perilune::LuaGet<bool>::Get(L, 4);
+    // 6: {sort = "namespace", prune = {dllExport = true, names = {...}}}
+    if (lua_istable(L, 6))
     {
-        return false;
-    }
-
-    lua_newtable(L);
-
-    lua_pushstring(L, "name");
-    lua_pushstring(L, typeid(T).name());
-    lua_settable(L, -3);
+        if (lua_getfield(L, 6, "prune") == LUA_TTABLE)
+        {
+            auto prune = lua_gettop(L);
+            lua_getfield(L, prune, "dllExport");
+            input.Prune.DllExportOnly = lua_toboolean(L, -1);
+            lua_pop(L, 1);
+            if (lua_getfield(L, prune, "names") == LUA_TTABLE)
+            {
+                input.Prune.Names = perilune::LuaGetVector<std::string>(L, lua_gettop(L));
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
 
-    return true;
-}
+        lua_getfield(L, 6, "sort");
+        input.SortByNamespace = lua_isstring(L, -1) && std::string_view(lua_tostring(L, -1)) == "namespace";
+        lua_pop(L, 1);
+    }
+    std::unique_ptr<clalua::ParseProgress> progress;
+    if (lua_isfunction(L, PROGRESS_INDEX))
+    {
+        progress = std::make_unique<clalua::ParseProgress>(
+            [L, stats](const clalua::ProgressSnapshot &snapshot) { CallProgress(L, stats, snapshot); }, progressMs);
+        input.Progress = progress.get();
+    }
 
-static void PushDecl(lua_State *L, const std::shared_ptr<clalua::Decl> &decl)
-{
-    if (auto userDecl = std::dynamic_pointer_cast<clalua::UserDecl>(decl))
+    bool cached = false;
+    clalua::ParsedGraphPtr graph;
+    if (session)
+    {
+        // clalua.session か clalua_parse_session(clalua_driver --daemon)なら TU を保持して、変わっていなければ再利用する
+        clalua::SessionParse status;
+        graph = session->Parse(input, &status);
+        stats->Session = clalua::SessionParseName(status);
+        cached = status == clalua::SessionParse::Reused;
+    }
+    else
     {
-        PushUserDecl(L, userDecl);
+        // clalua_parse_cache(1)(clalua_driver --batch)なら同じ引数の parse は process で1回
+        graph = clalua::ParseCached(input, &cached);
     }
-    else if (auto primitive = std::dynamic_pointer_cast<clalua::Primitive>(decl))
+    stats->Cached = cached;
+    stats->Phases = graph->Phases;
+    stats->Decls = graph->Decls;
+    stats->Graph = graph->Graph;
+    if (!cached)
     {
-        if (PushPrim<clalua::Void>(L, primitive))
-            return;
-        else if (PushPrim<clalua::Bool>(L, primitive))
-            return;
-        else if (PushPrim<clalua::Int8>(L, primitive))
-            return;
-        else if (PushPrim<clalua::Int16>(L, primitive))
-            return;
-        else if (PushPrim<clalua::Int32>(L, primitive))
-            return;
-        else if (PushPrim<clalua::Int64>(L, primitive))
-            return;
-        else if (PushPrim<clalua::UInt8>(L, primitive))
-            return;
-        else if (PushPrim<clalua::UInt16>(L, primitive))
-            return;
-        else if (PushPrim<clalua::UInt32>(L, primitive))
-            return;
-        else if (PushPrim<clalua::UInt64>(L, primitive))
-            return;
-        else if (PushPrim<clalua::Float>(L, primitive))
-            return;
-        else if (PushPrim<clalua::Double>(L, primitive))
-            return;
-        else
+        stats->ParseMs = graph->Phases.ParseMs;
+        stats->TraverseMs = graph->Phases.TraverseMs;
+        stats->ClosureMs = graph->ClosureMs;
+    }
+    stats->ClosurePeakRss = graph->ClosurePeakRss;
+    auto &processor = graph->Processor;
+    if (!processor)
+    {
+        if (progress)
         {
-            throw "unknown primitive";
+            progress->Phase("done");
         }
+        return 0;
+    }
+    stats->Sources = processor->SourceMap.size();
+    for (auto &[path, source] : processor->SourceMap)
+    {
+        stats->SourceDecls += source->Decls.size();
     }
-    else if (auto pointer = std::dynamic_pointer_cast<clalua::Pointer>(decl))
+
+    //
+    // return map<path, source>
+    //
+    if (progress)
     {
-        lua_newtable(L);
-        lua_pushstring(L, "class");
-        lua_pushstring(L, "Pointer");
-        lua_settable(L, -3);
-
-        lua_pushstring(L, "ref");
-        PushRef(L, pointer->pointee);
-        lua_settable(L, -3);
+        progress->Phase("push");
     }
-    else if (auto reference = std::dynamic_pointer_cast<clalua::Reference>(decl))
+    auto begin = std::chrono::steady_clock::now();
+    int status;
     {
-        lua_newtable(L);
-        lua_pushstring(L, "class");
-        lua_pushstring(L, "Reference");
-        lua_settable(L, -3);
+        clalua::TraceScope scope("marshal");
+        // error(out of memory など)でも GC mode を戻すので longjmp を跨がない
+        clalua::ScopedPushPhase phase(L);
+        lua_pushcfunction(L, &ProtectedPushSourceMap);
+        lua_pushlightuserdata(L, const_cast<std::shared_ptr<clalua::ClangDeclProcessor> *>(&processor));
+        status = lua_pcall(L, 1, 1, 0);
     }
-    else if (auto array = std::dynamic_pointer_cast<clalua::Array>(decl))
+    if (status != LUA_OK)
     {
-        lua_newtable(L);
-        lua_pushstring(L, "class");
-        lua_pushstring(L, "Array");
-        lua_settable(L, -3);
+        return -1;
     }
-    else
+    if (progress)
     {
-        // lua_pushstring(L, "__unknown__");
-        std::cout << "unknown: " << typeid(decl).name() << std::endl;
+        progress->Phase("done");
     }
+    stats->PushMs = ElapsedMs(begin);
+    stats->PushPeakRss = clalua::PeakRssBytes();
+    stats->LuaHeapBytes = static_cast<size_t>(lua_gc(L, LUA_GCCOUNT)) * 1024 + lua_gc(L, LUA_GCCOUNTB);
+    return 1;
 }
 
-// return {decls, macros}
-static int PushSource(lua_State *L, const clalua::SourcePtr &source)
+int CLALUA_parse(lua_State *L)
 {
-    auto top = lua_gettop(L);
-    lua_newtable(L);
-
+    // ParseAndPush の C++ の local を解放してから raise する
+    auto n = ParseAndPush(L);
+    if (n < 0)
     {
-        lua_pushstring(L, "name");
-        lua_pushstring(L, source->Name().c_str());
-        lua_settable(L, -3);
+        return lua_error(L);
     }
+    return n;
+}
 
-    // decls
+///
+/// clalua.phases()
+/// => {parse_ms, traverse_ms, closure_ms, push_ms, decls, sources, source_decls, cached, session} of the last clalua.parse
+///
+/// cached: the graph was shared from a previous clalua.parse with the same arguments (clalua_parse_cache,
+///         or an unchanged TU of clalua_parse_session). parse_ms, traverse_ms and closure_ms are 0
+/// session: "parsed", "reparsed" or "reused" with clalua.session or clalua_parse_session
+/// progress_error: the error of option.progress(the callback was not called after that)
+///
+int CLALUA_phases(lua_State *L)
+{
+    auto stats = GetParseStats(L);
+    lua_createtable(L, 0, 9);
+    lua_pushnumber(L, stats->ParseMs);
+    lua_setfield(L, -2, "parse_ms");
+    lua_pushnumber(L, stats->TraverseMs);
+    lua_setfield(L, -2, "traverse_ms");
+    lua_pushnumber(L, stats->ClosureMs);
+    lua_setfield(L, -2, "closure_ms");
+    lua_pushnumber(L, stats->PushMs);
+    lua_setfield(L, -2, "push_ms");
+    lua_pushinteger(L, stats->Decls);
+    lua_setfield(L, -2, "decls");
+    lua_pushinteger(L, stats->Sources);
+    lua_setfield(L, -2, "sources");
+    lua_pushinteger(L, stats->SourceDecls);
+    lua_setfield(L, -2, "source_decls");
+    lua_pushboolean(L, stats->Cached);
+    lua_setfield(L, -2, "cached");
+    if (stats->Session)
     {
-        lua_pushstring(L, "types");
-        lua_newtable(L);
-        {
-            int i = 1;
-            for (auto decl : source->Decls)
-            {
-                PushDecl(L, decl);
-                lua_rawseti(L, -2, i++);
-            }
-        }
-        lua_settable(L, -3);
+        lua_pushstring(L, stats->Session);
+        lua_setfield(L, -2, "session");
     }
-
-    // macros
+    if (!stats->ProgressError.empty())
     {
-        lua_pushstring(L, "macros");
-        lua_newtable(L);
-        lua_settable(L, -3);
+        lua_pushstring(L, stats->ProgressError.c_str());
+        lua_setfield(L, -2, "progress_error");
     }
-
-    // std::cerr << "top: " << (lua_gettop(L) - top) << std::endl;
-    assert(lua_gettop(L) - top == 1);
     return 1;
 }
 
-int CLALUA_parse(lua_State *L)
+static void SetIntegerField(lua_State *L, const char *key, size_t value)
 {
-    // 型情報を集める
-    auto headers = perilune::LuaGetVector<std::string>(L, 1);
-    auto includes = perilune::LuaGetVector<std::string>(L, 2);
-    auto defines = perilune::LuaGetVector<std::string>(L, 3);
-    auto externC = perilune::LuaGet<bool>::Get(L, 4);
+    lua_pushinteger(L, static_cast<lua_Integer>(value));
+    lua_setfield(L, -2, key);
+}
 
-    std::unordered_map<uint32_t, std::shared_ptr<clalua::UserDecl>> map = clalua::Parse(headers, includes, defines);
-    if (map.empty())
+///
+/// clalua.stats()
+/// => {
+///     decls = {total, struct, typedef, enum, function, other, pointer, reference, array, primitive},
+///     strings, string_bytes, graph_bytes,
+///     tu_bytes, tu = {[resource usage name] = bytes},
+///     lua_heap_bytes,   -- right after marshaling
+///     peak_rss = {parse, traverse, closure, push}, rss, current_peak_rss,
+/// }
+///
+int CLALUA_stats(lua_State *L)
+{
+    auto stats = GetParseStats(L);
+    auto &graph = stats->Graph;
+    lua_createtable(L, 0, 10);
+
+    lua_createtable(L, 0, 10);
+    SetIntegerField(L, "total", stats->Decls);
+    SetIntegerField(L, "struct", graph.Structs);
+    SetIntegerField(L, "typedef", graph.Typedefs);
+    SetIntegerField(L, "enum", graph.Enums);
+    SetIntegerField(L, "function", graph.Functions);
+    SetIntegerField(L, "other", graph.OtherUserDecls);
+    SetIntegerField(L, "pointer", graph.Pointers);
+    SetIntegerField(L, "reference", graph.References);
+    SetIntegerField(L, "array", graph.Arrays);
+    SetIntegerField(L, "primitive", graph.Primitives);
+    lua_setfield(L, -2, "decls");
+
+    SetIntegerField(L, "strings", graph.Strings);
+    SetIntegerField(L, "string_bytes", graph.StringBytes);
+    SetIntegerField(L, "graph_bytes", graph.NativeBytes);
+
+    SetIntegerField(L, "tu_bytes", stats->Phases.TuMemoryBytes);
+    lua_createtable(L, 0, static_cast<int>(stats->Phases.TuMemory.size()));
+    for (auto &[name, bytes] : stats->Phases.TuMemory)
     {
-        return 0;
+        SetIntegerField(L, name.c_str(), bytes);
     }
+    lua_setfield(L, -2, "tu");
+
+    SetIntegerField(L, "lua_heap_bytes", stats->LuaHeapBytes);
+
+    lua_createtable(L, 0, 4);
+    SetIntegerField(L, "parse", stats->Phases.ParsePeakRss);
+    SetIntegerField(L, "traverse", stats->Phases.TraversePeakRss);
+    SetIntegerField(L, "closure", stats->ClosurePeakRss);
+    SetIntegerField(L, "push", stats->PushPeakRss);
+    lua_setfield(L, -2, "peak_rss");
 
-    clalua::ClangDeclProcessor processor;
-    for (auto [id, decl] : map)
+    SetIntegerField(L, "rss", clalua::CurrentRssBytes());
+    SetIntegerField(L, "current_peak_rss", clalua::PeakRssBytes());
+
+    if (auto cache = clalua::GetScriptCache(L))
     {
-        auto found = std::find(headers.begin(), headers.end(), decl->path);
-        if (found != headers.end())
-        {
-            processor.AddDecl(decl, {});
-        }
+        lua_createtable(L, 0, 3);
+        SetIntegerField(L, "embedded", cache->Stats.Embedded);
+        SetIntegerField(L, "hits", cache->Stats.Hits);
+        SetIntegerField(L, "misses", cache->Stats.Misses);
+        lua_setfield(L, -2, "scripts");
     }
+    return 1;
+}
 
-    //
-    // return map<path, source>
-    //
-    lua_newtable(L);
+// clalua.now() => monotonic seconds
+int CLALUA_now(lua_State *L)
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    lua_pushnumber(L, std::chrono::duration<double>(now).count());
+    return 1;
+}
 
-    for (auto [key, value] : processor.SourceMap)
+lua_State *clalua_newstate(int pooled)
+{
+    auto allocator = new clalua::LuaAllocator(pooled ? clalua::LuaAllocator::Mode::Pool
+                                                     : clalua::LuaAllocator::Mode::System);
+    auto L = allocator->NewState();
+    if (!L)
     {
-        // std::cout << key << ": " << value->Decls.size() << ::std::endl;
-        lua_pushstring(L, key.c_str());
-        PushSource(L, value);
-        lua_settable(L, -3);
+        delete allocator;
     }
+    return L;
+}
 
-    return 1;
+void clalua_close(lua_State *L)
+{
+    auto allocator = clalua::LuaAllocator::Get(L);
+    lua_close(L);
+    delete allocator;
 }
 
 int luaopen_clalua(lua_State *L)
@@ -417,6 +491,60 @@ int luaopen_clalua(lua_State *L)
     lua_pushcfunction(L, CLALUA_parse);
     lua_setfield(L, -2, "parse");
 
+    lua_pushcfunction(L, CLALUA_phases);
+    lua_setfield(L, -2, "phases");
+
+    lua_pushcfunction(L, CLALUA_stats);
+    lua_setfield(L, -2, "stats");
+
+    lua_pushcfunction(L, CLALUA_now);
+    lua_setfield(L, -2, "now");
+
+    lua_pushcfunction(L, clalua::CLALUA_session);
+    lua_setfield(L, -2, "session");
+
+    lua_pushcfunction(L, clalua::CLALUA_query);
+    lua_setfield(L, -2, "query");
+
+    lua_pushcfunction(L, clalua::CLALUA_diff);
+    lua_setfield(L, -2, "diff");
+
+    lua_pushcfunction(L, clalua::CLALUA_group_prefix);
+    lua_setfield(L, -2, "group_prefix");
+
+    lua_pushcfunction(L, clalua::CLALUA_writer);
+    lua_setfield(L, -2, "writer");
+
+    lua_pushcfunction(L, clalua::CLALUA_outdir);
+    lua_setfield(L, -2, "outdir");
+
+    lua_pushcfunction(L, clalua::CLALUA_fragments);
+    lua_setfield(L, -2, "fragments");
+
+    lua_pushcfunction(L, clalua::CLALUA_emit);
+    lua_setfield(L, -2, "emit");
+
+    lua_pushcfunction(L, clalua::CLALUA_gc);
+    lua_setfield(L, -2, "gc");
+
+    lua_pushcfunction(L, clalua::CLALUA_alloc_stats);
+    lua_setfield(L, -2, "alloc_stats");
+
+    lua_pushcfunction(L, clalua::CLALUA_trace_begin);
+    lua_setfield(L, -2, "trace_begin");
+
+    lua_pushcfunction(L, clalua::CLALUA_trace_end);
+    lua_setfield(L, -2, "trace_end");
+
+    lua_pushcfunction(L, clalua::CLALUA_trace_scope);
+    lua_setfield(L, -2, "trace_scope");
+
+    lua_pushcfunction(L, clalua::CLALUA_profile_begin);
+    lua_setfield(L, -2, "profile_begin");
+
+    lua_pushcfunction(L, clalua::CLALUA_profile_end);
+    lua_setfield(L, -2, "profile_end");
+
     // type
 
     return 1;
@@ -1,6 +1,11 @@
 #pragma once
 
-#ifdef CLALUA_BUILD
+#if defined(CLALUA_STATIC)
+// linked into clalua_static
+#define CLALUA_EXPORT
+#elif !defined(_WIN32)
+#define CLALUA_EXPORT __attribute__((visibility("default")))
+#elif defined(CLALUA_BUILD)
 #define CLALUA_EXPORT __declspec(dllexport)
 #else
 #define CLALUA_EXPORT __declspec(dllimport)
@@ -10,5 +15,33 @@ extern "C"
 {
 #include <lua.h>
 
+    // precompiled module (clalua_embed)
+    struct clalua_embedded_script
+    {
+        const char *name;
+        const unsigned char *data;
+        size_t size;
+    };
+
     CLALUA_EXPORT int luaopen_clalua(lua_State *L);
+
+    // lua_State with clalua::LuaAllocator. pooled: size class pool for small blocks
+    CLALUA_EXPORT lua_State *clalua_newstate(int pooled);
+    // close a state created by clalua_newstate
+    CLALUA_EXPORT void clalua_close(lua_State *L);
+
+    // package searcher with a bytecode cache in cache_dir (nullptr: no cache)
+    // and embedded modules ({nullptr, nullptr, 0} terminated, nullptr: none)
+    CLALUA_EXPORT void clalua_script_cache(lua_State *L, const char *cache_dir,
+                                           const struct clalua_embedded_script *embedded);
+    // luaL_loadfile through the script cache
+    CLALUA_EXPORT int clalua_loadfile(lua_State *L, const char *path);
+
+    // share the graph of clalua.parse between calls (and lua_States) with the same arguments.
+    // 0: disable and release the cached graphs
+    CLALUA_EXPORT void clalua_parse_cache(int enable);
+
+    // keep the CXIndex, up to max_tus TUs and their graphs for clalua.parse.
+    // an unchanged parse returns the last graph, a changed include is reparsed. 0: dispose
+    CLALUA_EXPORT void clalua_parse_session(int max_tus);
 }
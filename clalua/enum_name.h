@@ -8,6 +8,14 @@
 ///
 
 template <typename E, E V> std::string_view enum_name_impl() {
+#ifndef _MSC_VER
+  // clang: "... [E = CXCursorKind, V = CXCursor_UnexposedDecl]"
+  // gcc:   "... [with E = CXCursorKind; E V = CXCursor_UnexposedDecl; ...]"
+  std::string_view sig = __PRETTY_FUNCTION__;
+  auto begin = sig.find("V = ") + 4;
+  auto end = sig.find_first_of(";]", begin);
+  return sig.substr(begin, end - begin);
+#else
   //   constexpr auto str = __FUNCSIG__;
   constexpr auto prefix_len =
       sizeof("std::string_view __cdecl enum_name_impl(void) [E = CXCursorKind, "
@@ -18,6 +26,7 @@ template <typename E, E V> std::string_view enum_name_impl() {
   auto sig = __FUNCSIG__;
   auto begin = sig + prefix_len;
   return std::string_view(begin, size - prefix_len - 1);
+#endif
 }
 
 template <int N, typename E> struct enum_name_n {
@@ -0,0 +1,84 @@
+//
+// clalua_embed {out.cpp} {name}={path.lua}...
+//
+// script を compile して bytecode を clalua_embedded_scripts[] として書き出す
+// (CLALUA_EMBED_SCRIPTS)
+//
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+}
+
+static int Writer(lua_State *, const void *p, size_t size, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), size);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::fputs("usage: clalua_embed {out.cpp} {name}={path.lua}...\n", stderr);
+        return 1;
+    }
+
+    std::string out = "// generated by clalua_embed. do not edit\n#include \"clalua.h\"\n\n";
+    std::vector<std::string> names;
+    auto L = luaL_newstate();
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto pos = arg.find('=');
+        if (pos == std::string::npos)
+        {
+            std::fprintf(stderr, "invalid argument: %s\n", argv[i]);
+            lua_close(L);
+            return 1;
+        }
+        auto name = arg.substr(0, pos);
+        auto path = arg.substr(pos + 1);
+        if (luaL_loadfile(L, path.c_str()) != LUA_OK)
+        {
+            std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+            lua_close(L);
+            return 1;
+        }
+        std::string bytecode;
+        lua_dump(L, &Writer, &bytecode, 0);
+        lua_pop(L, 1);
+
+        char buf[16];
+        out += "static const unsigned char s_" + std::to_string(names.size()) + "[] = {";
+        for (size_t j = 0; j < bytecode.size(); ++j)
+        {
+            std::snprintf(buf, sizeof(buf), "%s%u,", j % 16 ? "" : "\n    ", static_cast<unsigned char>(bytecode[j]));
+            out += buf;
+        }
+        out += "\n};\n";
+        names.push_back(name);
+    }
+    lua_close(L);
+
+    out += "\nextern \"C\" const clalua_embedded_script clalua_embedded_scripts[] = {\n";
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        out += "    {\"" + names[i] + "\", s_" + std::to_string(i) + ", sizeof(s_" + std::to_string(i) + ")},\n";
+    }
+    out += "    {nullptr, nullptr, 0},\n};\n";
+
+    auto fp = std::fopen(argv[1], "wb");
+    if (!fp)
+    {
+        std::fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    std::fwrite(out.data(), 1, out.size(), fp);
+    std::fclose(fp);
+    return 0;
+}
@@ -0,0 +1,1044 @@
+//
+// clalua_driver [options] {script.lua} [args...]
+// clalua_driver [options] --batch manifest.lua
+// clalua_driver [options] --daemon SOCKET
+// clalua_driver --connect SOCKET {run|parse|query|stats|shutdown} [args...]
+//
+// lua.exe の代わりに script を実行する。clalua は require 済みになる
+// --batch は manifest の job を thread 毎の lua_State で実行する。同じ引数の clalua.parse は1回だけ parse する
+// --daemon は CXIndex, TU, graph を保持したまま socket の request を処理する
+// clalua_static は lua, lfs, lrdb_server も link 済みで package.preload から読む
+//
+#include "clalua.h"
+#include "socket.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if !defined(_WIN32)
+#include <csignal>
+#endif
+
+extern "C"
+{
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+#if defined(CLALUA_STATIC)
+extern "C"
+{
+    int luaopen_lfs(lua_State *L);
+    int luaopen_lrdb_server(lua_State *L);
+}
+#endif
+
+#if defined(CLALUA_EMBED_SCRIPTS)
+// EmbeddedScripts.cpp (clalua_embed)
+extern "C" const clalua_embedded_script clalua_embedded_scripts[];
+#endif
+
+static const char *USAGE = R"(usage: clalua_driver [options] {script.lua} [args...]
+       clalua_driver [options] --batch manifest.lua
+       clalua_driver [options] --daemon SOCKET
+       clalua_driver --connect SOCKET {run|parse|query|stats|shutdown} [args...]
+options:
+    --alloc pool|system     lua_Alloc (default: pool)
+    --gc-push MODE          GC mode while pushing the parsed graph (default: stop)
+    --gc-emit MODE          GC mode while the script emits (default: incremental)
+                            MODE: incremental | generational | stop
+    --alloc-stats           print allocator and GC statistics at exit
+    --stats                 print decl counts and memory of the last clalua.parse at exit
+    --trace out.json        write a Chrome trace (chrome://tracing, ui.perfetto.dev)
+    --lua-profile out.folded
+                            sample Lua call stacks. write collapsed stacks (flamegraph)
+                            and print the top functions at exit
+    --lua-profile-period N  instructions per sample (default: 1000)
+    --debugger PORT         start lrdb_server on PORT (predefine.lua, or env CLALUA_DEBUGGER)
+    --bytecode-cache DIR    load require'd scripts and the script from bytecode cached in DIR
+                            (or env CLALUA_BYTECODE_CACHE)
+    --no-embedded           ignore the embedded scripts/ modules and require from package.path
+    --batch manifest.lua    run the jobs returned by manifest.lua on parallel lua_States
+                            { {script = "cs_windowskits.lua", args = {...}}, ... }
+                            jobs calling clalua.parse with the same arguments share one parse.
+                            --lua-profile and --debugger are not available
+    --jobs N                threads for --batch (default: hardware threads)
+    --daemon SOCKET         serve requests on a unix domain socket. keeps the CXIndex, TUs and
+                            graphs; a clalua.parse whose included files are unchanged (mtime, hash)
+                            returns the last graph, otherwise the TU is reparsed.
+                            a SOCKET without '/' is in $XDG_RUNTIME_DIR or /tmp/clalua-{uid} (0700).
+                            the socket is 0600: run executes any script as the daemon's user.
+                            relative paths in requests are resolved against the client's directory
+    --max-tus N             TUs kept by --daemon (default: 8)
+    --connect SOCKET        send a request to the daemon and print the reply
+                            run script.lua [args...]
+                            parse [-I DIR] [-D DEF] [--sort namespace] header...
+                            query [-I DIR] [-D DEF] [--name N] [--prefix P] [--kind K] [--file F] header...
+                            stats
+                            shutdown
+)";
+
+struct Options
+{
+    bool Pooled = true;
+    const char *GcPush = nullptr;
+    const char *GcEmit = nullptr;
+    bool AllocStats = false;
+    bool Stats = false;
+    const char *Trace = nullptr;
+    const char *LuaProfile = nullptr;
+    const char *LuaProfilePeriod = nullptr;
+    const char *Debugger = nullptr;
+    const char *BytecodeCache = nullptr;
+    bool NoEmbedded = false;
+    const char *Batch = nullptr;
+    const char *Jobs = nullptr;
+    const char *Daemon = nullptr;
+    const char *MaxTus = nullptr;
+    const char *Connect = nullptr;
+    const char *Script = nullptr;
+    int ScriptArg = 0;
+};
+
+static bool ParseOptions(int argc, char **argv, Options *options)
+{
+    int i = 1;
+    for (; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.size() < 2 || arg[0] != '-' || arg[1] != '-')
+        {
+            break;
+        }
+
+        if (arg == "--alloc-stats")
+        {
+            options->AllocStats = true;
+            continue;
+        }
+        if (arg == "--stats")
+        {
+            options->Stats = true;
+            continue;
+        }
+        if (arg == "--no-embedded")
+        {
+            options->NoEmbedded = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        auto value = argv[++i];
+        if (arg == "--alloc")
+        {
+            if (strcmp(value, "pool") == 0)
+            {
+                options->Pooled = true;
+            }
+            else if (strcmp(value, "system") == 0)
+            {
+                options->Pooled = false;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (arg == "--gc-push")
+        {
+            options->GcPush = value;
+        }
+        else if (arg == "--gc-emit")
+        {
+            options->GcEmit = value;
+        }
+        else if (arg == "--trace")
+        {
+            options->Trace = value;
+        }
+        else if (arg == "--lua-profile")
+        {
+            options->LuaProfile = value;
+        }
+        else if (arg == "--lua-profile-period")
+        {
+            options->LuaProfilePeriod = value;
+        }
+        else if (arg == "--debugger")
+        {
+            options->Debugger = value;
+        }
+        else if (arg == "--bytecode-cache")
+        {
+            options->BytecodeCache = value;
+        }
+        else if (arg == "--batch")
+        {
+            options->Batch = value;
+        }
+        else if (arg == "--jobs")
+        {
+            options->Jobs = value;
+        }
+        else if (arg == "--daemon")
+        {
+            options->Daemon = value;
+        }
+        else if (arg == "--max-tus")
+        {
+            options->MaxTus = value;
+        }
+        else if (arg == "--connect")
+        {
+            options->Connect = value;
+            // request words
+            ++i;
+            break;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (options->Connect)
+    {
+        options->ScriptArg = i;
+        return i < argc;
+    }
+    if (options->Daemon)
+    {
+        return i == argc && !options->Batch && !options->LuaProfile && !options->Debugger;
+    }
+    if (options->Batch)
+    {
+        // profiler の出力と debugger の port は process に1つ
+        return i == argc && !options->LuaProfile && !options->Debugger;
+    }
+    if (i >= argc)
+    {
+        return false;
+    }
+    options->Script = argv[i];
+    options->ScriptArg = i;
+    return true;
+}
+
+static int Traceback(lua_State *L)
+{
+    auto message = lua_tostring(L, 1);
+    luaL_traceback(L, L, message ? message : "(error object is not a string)", 1);
+    return 1;
+}
+
+// call clalua[name](...) with a table argument on the top
+static bool CallClalua(lua_State *L, const char *name, int nargs, int nresults)
+{
+    lua_getglobal(L, "clalua");
+    lua_getfield(L, -1, name);
+    lua_remove(L, -2);
+    lua_insert(L, -(nargs + 1));
+    if (lua_pcall(L, nargs, nresults, 0) != LUA_OK)
+    {
+        std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+// print the table on the top. nested tables as [title.key]
+static void PrintStatsTable(lua_State *L, const std::string &title)
+{
+    if (!lua_istable(L, -1))
+    {
+        return;
+    }
+    std::fprintf(stderr, "[%s]\n", title.c_str());
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+        if (!lua_istable(L, -1))
+        {
+            auto value = luaL_tolstring(L, -1, nullptr);
+            std::fprintf(stderr, "    %s = %s\n", luaL_tolstring(L, -3, nullptr), value);
+            lua_pop(L, 2);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+        if (lua_istable(L, -1))
+        {
+            auto key = title + "." + luaL_tolstring(L, -2, nullptr);
+            lua_pop(L, 1);
+            PrintStatsTable(L, key);
+        }
+        lua_pop(L, 1);
+    }
+}
+
+static void PrintStats(lua_State *L)
+{
+    if (CallClalua(L, "alloc_stats", 0, 1))
+    {
+        PrintStatsTable(L, "alloc");
+        lua_pop(L, 1);
+    }
+    if (CallClalua(L, "gc", 0, 1))
+    {
+        PrintStatsTable(L, "gc");
+        lua_pop(L, 1);
+    }
+}
+
+static void PrintPipelineStats(lua_State *L)
+{
+    if (CallClalua(L, "stats", 0, 1))
+    {
+        PrintStatsTable(L, "stats");
+        lua_pop(L, 1);
+    }
+}
+
+// argv[scriptArg] is the script
+static bool RunScript(lua_State *L, int argc, const char *const *argv, int scriptArg)
+{
+    auto script = argv[scriptArg];
+    lua_pushcfunction(L, Traceback);
+    auto traceback = lua_gettop(L);
+
+    // whole script. nil if --trace is not given
+    lua_pushstring(L, "script");
+    lua_pushstring(L, script);
+    CallClalua(L, "trace_scope", 2, 1);
+    auto scope = lua_gettop(L);
+
+    if (clalua_loadfile(L, script) != LUA_OK)
+    {
+        std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        lua_settop(L, traceback - 1);
+        return false;
+    }
+    int nargs = 0;
+    for (int i = scriptArg + 1; i < argc; ++i, ++nargs)
+    {
+        lua_pushstring(L, argv[i]);
+    }
+    auto ok = lua_pcall(L, nargs, 0, traceback) == LUA_OK;
+    if (!ok)
+    {
+        std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    }
+
+    if (luaL_callmeta(L, scope, "__close"))
+    {
+        lua_pop(L, 1);
+    }
+    lua_settop(L, traceback - 1);
+    return ok;
+}
+
+// require(name) calls open without searching package.cpath
+static void Preload(lua_State *L, const char *name, lua_CFunction open)
+{
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    lua_pushcfunction(L, open);
+    lua_setfield(L, -2, name);
+    lua_pop(L, 1);
+}
+
+// libs, preload, script cache and gc
+static bool SetupState(lua_State *L, const Options &options)
+{
+    luaL_openlibs(L);
+
+    // require "clalua"
+    Preload(L, "clalua", luaopen_clalua);
+    luaL_requiref(L, "clalua", luaopen_clalua, 1);
+    lua_pop(L, 1);
+#if defined(CLALUA_STATIC)
+    Preload(L, "lfs", luaopen_lfs);
+    // loaded only if predefine.lua starts the debugger
+    Preload(L, "lrdb_server", luaopen_lrdb_server);
+#endif
+
+    // require searcher for bytecode
+    auto bytecodeCache = options.BytecodeCache ? options.BytecodeCache : std::getenv("CLALUA_BYTECODE_CACHE");
+    const clalua_embedded_script *embedded = nullptr;
+#if defined(CLALUA_EMBED_SCRIPTS)
+    if (!options.NoEmbedded)
+    {
+        embedded = clalua_embedded_scripts;
+    }
+#endif
+    if (bytecodeCache || embedded)
+    {
+        clalua_script_cache(L, bytecodeCache, embedded);
+    }
+
+    if (options.Debugger)
+    {
+        lua_pushinteger(L, atoi(options.Debugger));
+        lua_setglobal(L, "CLALUA_DEBUGGER");
+    }
+
+    if (options.GcPush || options.GcEmit)
+    {
+        lua_createtable(L, 0, 2);
+        if (options.GcPush)
+        {
+            lua_pushstring(L, options.GcPush);
+            lua_setfield(L, -2, "push");
+        }
+        if (options.GcEmit)
+        {
+            lua_pushstring(L, options.GcEmit);
+            lua_setfield(L, -2, "emit");
+        }
+        if (!CallClalua(L, "gc", 1, 0))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// arg like lua.exe
+static void SetArg(lua_State *L, int argc, const char *const *argv, int scriptArg)
+{
+    lua_createtable(L, argc - scriptArg, scriptArg + 1);
+    for (int i = 0; i < argc; ++i)
+    {
+        lua_pushstring(L, argv[i]);
+        lua_rawseti(L, -2, i - scriptArg);
+    }
+    lua_setglobal(L, "arg");
+}
+
+static bool Run(lua_State *L, const Options &options, int argc, char **argv)
+{
+    if (!SetupState(L, options))
+    {
+        return false;
+    }
+    SetArg(L, argc, argv, options.ScriptArg);
+
+    if (options.Trace)
+    {
+        lua_pushstring(L, options.Trace);
+        CallClalua(L, "trace_begin", 1, 0);
+    }
+
+    if (options.LuaProfile)
+    {
+        lua_pushinteger(L, options.LuaProfilePeriod ? atoi(options.LuaProfilePeriod) : 1000);
+        if (!CallClalua(L, "profile_begin", 1, 0))
+        {
+            return false;
+        }
+    }
+
+    auto ok = RunScript(L, argc, argv, options.ScriptArg);
+
+    if (options.LuaProfile)
+    {
+        lua_pushstring(L, options.LuaProfile);
+        if (CallClalua(L, "profile_end", 1, 1))
+        {
+            std::fprintf(stderr, "%s", lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+
+    if (options.Trace)
+    {
+        if (CallClalua(L, "trace_end", 0, 1))
+        {
+            lua_pop(L, 1);
+        }
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    if (options.AllocStats)
+    {
+        PrintStats(L);
+    }
+    if (options.Stats)
+    {
+        PrintPipelineStats(L);
+    }
+    return true;
+}
+
+//
+// --batch
+//
+struct BatchJob
+{
+    std::string Script;
+    // {argv[0], script, args...}
+    std::vector<std::string> Argv;
+
+    bool Ok = false;
+    double Seconds = 0;
+    // clalua.phases() of the last clalua.parse
+    bool Parsed = false;
+    bool Cached = false;
+    double ParseMs = 0;
+};
+
+// manifest.lua returns {{script = "x.lua", args = {"a", "b"}}, ...}
+static bool LoadManifest(lua_State *L, const char *path, const char *argv0, std::vector<BatchJob> *jobs)
+{
+    if (clalua_loadfile(L, path) != LUA_OK || lua_pcall(L, 0, 1, 0) != LUA_OK)
+    {
+        std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+    if (!lua_istable(L, -1))
+    {
+        std::fprintf(stderr, "%s: manifest must return a table of jobs\n", path);
+        lua_pop(L, 1);
+        return false;
+    }
+
+    auto ok = true;
+    auto n = lua_rawlen(L, -1);
+    for (lua_Unsigned i = 1; i <= n && ok; ++i)
+    {
+        lua_rawgeti(L, -1, i);
+        if (lua_istable(L, -1))
+        {
+            lua_getfield(L, -1, "script");
+        }
+        else
+        {
+            lua_pushnil(L);
+        }
+        if (lua_type(L, -1) == LUA_TSTRING)
+        {
+            BatchJob job;
+            job.Script = lua_tostring(L, -1);
+            job.Argv = {argv0, job.Script};
+            if (lua_getfield(L, -2, "args") == LUA_TTABLE)
+            {
+                auto argn = lua_rawlen(L, -1);
+                for (lua_Unsigned j = 1; j <= argn; ++j)
+                {
+                    lua_rawgeti(L, -1, j);
+                    job.Argv.push_back(luaL_tolstring(L, -1, nullptr));
+                    lua_pop(L, 2);
+                }
+            }
+            lua_pop(L, 1);
+            jobs->push_back(std::move(job));
+        }
+        else
+        {
+            std::fprintf(stderr, "%s: job %d has no script\n", path, static_cast<int>(i));
+            ok = false;
+        }
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+    return ok;
+}
+
+static std::mutex g_printMutex;
+
+static void RunJob(const Options &options, BatchJob *job)
+{
+    auto begin = std::chrono::steady_clock::now();
+    auto L = clalua_newstate(options.Pooled);
+    if (!L)
+    {
+        std::fprintf(stderr, "cannot create state: not enough memory\n");
+        return;
+    }
+    if (SetupState(L, options))
+    {
+        std::vector<const char *> argv;
+        for (auto &arg : job->Argv)
+        {
+            argv.push_back(arg.c_str());
+        }
+        auto argc = static_cast<int>(argv.size());
+        SetArg(L, argc, argv.data(), 1);
+        job->Ok = RunScript(L, argc, argv.data(), 1);
+
+        if (CallClalua(L, "phases", 0, 1))
+        {
+            lua_getfield(L, -1, "cached");
+            job->Cached = lua_toboolean(L, -1);
+            lua_getfield(L, -2, "decls");
+            job->Parsed = job->Cached || lua_tointeger(L, -1) > 0;
+            lua_getfield(L, -3, "parse_ms");
+            job->ParseMs = lua_tonumber(L, -1);
+            lua_getfield(L, -4, "traverse_ms");
+            job->ParseMs += lua_tonumber(L, -1);
+            lua_pop(L, 5);
+        }
+
+        if (job->Ok && (options.AllocStats || options.Stats))
+        {
+            // job の出力が混ざらないように
+            std::lock_guard<std::mutex> lock(g_printMutex);
+            std::fprintf(stderr, "== %s\n", job->Script.c_str());
+            if (options.AllocStats)
+            {
+                PrintStats(L);
+            }
+            if (options.Stats)
+            {
+                PrintPipelineStats(L);
+            }
+        }
+    }
+    clalua_close(L);
+    job->Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static bool RunBatch(lua_State *L, const Options &options, const char *argv0)
+{
+    if (!SetupState(L, options))
+    {
+        return false;
+    }
+    std::vector<BatchJob> jobs;
+    if (!LoadManifest(L, options.Batch, argv0, &jobs))
+    {
+        return false;
+    }
+
+    int threads = options.Jobs ? atoi(options.Jobs) : static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::clamp(threads, 1, std::max(static_cast<int>(jobs.size()), 1));
+
+    if (options.Trace)
+    {
+        lua_pushstring(L, options.Trace);
+        CallClalua(L, "trace_begin", 1, 0);
+    }
+
+    // 同じ headers, includes, defines の job は graph を共有する(read only)
+    clalua_parse_cache(1);
+    auto begin = std::chrono::steady_clock::now();
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&options, &jobs, &next]() {
+            for (size_t j = next++; j < jobs.size(); j = next++)
+            {
+                RunJob(options, &jobs[j]);
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    clalua_parse_cache(0);
+
+    if (options.Trace)
+    {
+        if (CallClalua(L, "trace_end", 0, 1))
+        {
+            lua_pop(L, 1);
+        }
+    }
+
+    auto ok = true;
+    std::fprintf(stderr, "[batch] %d jobs, %d threads, %.2fs\n", static_cast<int>(jobs.size()), threads, seconds);
+    for (auto &job : jobs)
+    {
+        std::string parse = "-";
+        if (job.Cached)
+        {
+            parse = "shared";
+        }
+        else if (job.Parsed)
+        {
+            parse = std::to_string(static_cast<int>(job.ParseMs)) + "ms";
+        }
+        std::fprintf(stderr, "    %-6s %8.2fs  parse %-10s %s\n", job.Ok ? "ok" : "failed", job.Seconds, parse.c_str(),
+                     job.Script.c_str());
+        ok = ok && job.Ok;
+    }
+    return ok;
+}
+
+//
+// --daemon / --connect
+//
+// request: {cwd, command, args...}
+// reply: {"ok" or "error", output}
+//
+// daemon の current directory は変えない。request の相対 path は cwd から解決する
+// run は任意の script を daemon の権限で実行する。socket は作った user だけが connect できる
+//
+
+// print => reply
+static int CapturePrint(lua_State *L)
+{
+    auto out = static_cast<std::string *>(lua_touserdata(L, lua_upvalueindex(1)));
+    auto n = lua_gettop(L);
+    for (int i = 1; i <= n; ++i)
+    {
+        if (i > 1)
+        {
+            out->push_back('\t');
+        }
+        size_t size;
+        auto text = luaL_tolstring(L, i, &size);
+        out->append(text, size);
+        lua_pop(L, 1);
+    }
+    out->push_back('\n');
+    return 0;
+}
+
+// parse / query. ... = cwd, command, args
+static const char *DAEMON_LUA = R"(
+local cwd, command = ...
+local args = {select(3, ...)}
+local function resolve(path)
+    if not path or string.sub(path, 1, 1) == "/" then
+        return path
+    end
+    return cwd .. "/" .. path
+end
+local headers, includes, defines, query, sort = {}, {}, {}, {}, nil
+local i = 1
+while i <= #args do
+    local a = args[i]
+    if a == "-I" then
+        i = i + 1
+        table.insert(includes, resolve(args[i]))
+    elseif a == "-D" then
+        i = i + 1
+        table.insert(defines, args[i])
+    elseif a == "--sort" then
+        i = i + 1
+        sort = args[i]
+    elseif string.sub(a, 1, 2) == "--" then
+        i = i + 1
+        query[string.sub(a, 3)] = args[i]
+    else
+        table.insert(headers, resolve(a))
+    end
+    i = i + 1
+end
+if #headers == 0 then
+    error("no headers")
+end
+
+local sourceMap = clalua.parse(headers, includes, defines, false, false, {sort = sort})
+local phases = clalua.phases()
+if command == "parse" then
+    print(string.format("session=%s decls=%d sources=%d parse_ms=%.1f traverse_ms=%.1f closure_ms=%.1f push_ms=%.1f",
+        phases.session or "-", phases.decls, phases.sources, phases.parse_ms, phases.traverse_ms, phases.closure_ms,
+        phases.push_ms))
+elseif sourceMap then
+    for _, decl in ipairs(clalua.query(sourceMap, query)) do
+        print(string.format("%s\t%s", decl.class or decl.canonical, decl.qualifiedName))
+    end
+end
+)";
+
+struct DaemonStats
+{
+    size_t Requests = 0;
+    size_t Failed = 0;
+    // clalua.phases().session
+    size_t Parsed = 0;
+    size_t Reparsed = 0;
+    size_t Reused = 0;
+    size_t Closures = 0;
+};
+
+// cwd からの path
+static std::string ResolvePath(const std::string &cwd, const std::string &path)
+{
+    std::filesystem::path p(path);
+    if (cwd.empty() || p.is_absolute())
+    {
+        return path;
+    }
+    return (std::filesystem::path(cwd) / p).lexically_normal().string();
+}
+
+// run / parse / query on a new lua_State. the TUs are in the process wide session
+static bool HandleRequest(const Options &options, const std::string &command, const std::vector<std::string> &words,
+                          std::string *out, DaemonStats *stats)
+{
+    auto L = clalua_newstate(options.Pooled);
+    if (!L)
+    {
+        *out = "cannot create state: not enough memory\n";
+        return false;
+    }
+    auto ok = false;
+    if (SetupState(L, options))
+    {
+        lua_pushlightuserdata(L, out);
+        lua_pushcclosure(L, CapturePrint, 1);
+        lua_setglobal(L, "print");
+
+        lua_pushcfunction(L, Traceback);
+        auto traceback = lua_gettop(L);
+        int status;
+        int nargs = 0;
+        const auto &cwd = words[0];
+        if (command == "run")
+        {
+            // {argv[0], script, args...}. script だけ cwd から解決する。
+            // 引数は推測しない. path の引数は script が argPath(predefine.lua)で CLALUA_CWD から解決する
+            std::vector<std::string> resolved;
+            for (size_t i = 2; i < words.size(); ++i)
+            {
+                resolved.push_back(i == 2 ? ResolvePath(cwd, words[i]) : words[i]);
+            }
+            std::vector<const char *> argv = {"clalua_driver"};
+            for (auto &arg : resolved)
+            {
+                argv.push_back(arg.c_str());
+            }
+            auto argc = static_cast<int>(argv.size());
+            if (argc < 2)
+            {
+                *out = "usage: run script.lua [args...]\n";
+                clalua_close(L);
+                return false;
+            }
+            SetArg(L, argc, argv.data(), 1);
+            // require は cwd から. script は CLALUA_CWD(argPath)で他の相対 path を解決できる
+            lua_pushstring(L, cwd.c_str());
+            lua_setglobal(L, "CLALUA_CWD");
+            lua_getglobal(L, "package");
+            lua_getfield(L, -1, "path");
+            lua_pushfstring(L, "%s/?.lua;%s/?/init.lua;%s", cwd.c_str(), cwd.c_str(), lua_tostring(L, -1));
+            lua_setfield(L, -3, "path");
+            lua_pop(L, 2);
+            status = clalua_loadfile(L, argv[1]);
+            for (int i = 2; status == LUA_OK && i < argc; ++i, ++nargs)
+            {
+                lua_pushstring(L, argv[i]);
+            }
+        }
+        else
+        {
+            status = luaL_loadbuffer(L, DAEMON_LUA, std::strlen(DAEMON_LUA), "=daemon");
+            for (size_t i = 0; status == LUA_OK && i < words.size(); ++i, ++nargs)
+            {
+                lua_pushstring(L, words[i].c_str());
+            }
+        }
+        if (status == LUA_OK)
+        {
+            status = lua_pcall(L, nargs, 0, traceback);
+        }
+        if (status == LUA_OK)
+        {
+            ok = true;
+        }
+        else
+        {
+            out->append(lua_tostring(L, -1));
+            out->push_back('\n');
+        }
+        lua_settop(L, traceback - 1);
+
+        if (CallClalua(L, "phases", 0, 1))
+        {
+            lua_getfield(L, -1, "session");
+            if (auto session = lua_tostring(L, -1))
+            {
+                auto &count = std::strcmp(session, "reused") == 0     ? stats->Reused
+                              : std::strcmp(session, "reparsed") == 0 ? stats->Reparsed
+                              : std::strcmp(session, "closure") == 0  ? stats->Closures
+                                                                      : stats->Parsed;
+                ++count;
+            }
+            lua_pop(L, 2);
+        }
+    }
+    clalua_close(L);
+    return ok;
+}
+
+static bool RunDaemon(lua_State *L, const Options &options)
+{
+    if (!SetupState(L, options))
+    {
+        return false;
+    }
+#if !defined(_WIN32)
+    // client が先に閉じても落ちない
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    std::string error;
+    std::string path;
+    FrameSocket server;
+    if (SocketPath(options.Daemon, true, &path, &error))
+    {
+        server = FrameSocket::Listen(path, &error);
+    }
+    if (!server.Valid())
+    {
+        std::fprintf(stderr, "%s: %s\n", options.Daemon, error.c_str());
+        return false;
+    }
+    if (options.Trace)
+    {
+        lua_pushstring(L, options.Trace);
+        CallClalua(L, "trace_begin", 1, 0);
+    }
+    clalua_parse_session(options.MaxTus ? std::max(atoi(options.MaxTus), 1) : 8);
+    std::fprintf(stderr, "[daemon] listening on %s\n", path.c_str());
+
+    DaemonStats stats;
+    auto running = true;
+    while (running)
+    {
+        auto client = server.Accept();
+        if (!client.Valid())
+        {
+            continue;
+        }
+        // 1 connection で複数の request を順に処理する
+        std::string payload;
+        while (running && client.Read(&payload))
+        {
+            auto words = SplitWords(payload);
+            auto command = words.size() >= 2 ? words[1] : "";
+            auto begin = std::chrono::steady_clock::now();
+            std::string out;
+            auto ok = true;
+            if (command == "run" || command == "parse" || command == "query")
+            {
+                ok = HandleRequest(options, command, words, &out, &stats);
+            }
+            else if (command == "stats")
+            {
+                char buf[256];
+                std::snprintf(buf, sizeof(buf),
+                              "requests=%zu failed=%zu parsed=%zu reparsed=%zu reused=%zu closures=%zu\n",
+                              stats.Requests, stats.Failed, stats.Parsed, stats.Reparsed, stats.Reused,
+                              stats.Closures);
+                out = buf;
+            }
+            else if (command == "shutdown")
+            {
+                running = false;
+            }
+            else
+            {
+                out = "unknown command: " + command + "\n";
+                ok = false;
+            }
+            ++stats.Requests;
+            if (!ok)
+            {
+                ++stats.Failed;
+            }
+            auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            std::fprintf(stderr, "[daemon] %s %s %.1fms\n", command.c_str(), ok ? "ok" : "error", ms);
+            if (!client.Write(JoinWords({ok ? "ok" : "error", out})))
+            {
+                break;
+            }
+        }
+    }
+
+    clalua_parse_session(0);
+    if (options.Trace)
+    {
+        if (CallClalua(L, "trace_end", 0, 1))
+        {
+            lua_pop(L, 1);
+        }
+    }
+    return true;
+}
+
+static bool RunClient(const Options &options, int argc, char **argv)
+{
+    std::string error;
+    std::string path;
+    FrameSocket socket;
+    if (SocketPath(options.Connect, false, &path, &error))
+    {
+        socket = FrameSocket::Connect(path, &error);
+    }
+    if (!socket.Valid())
+    {
+        std::fprintf(stderr, "%s: %s\n", options.Connect, error.c_str());
+        return false;
+    }
+
+    // 相対 path は client の current directory から
+    std::vector<std::string> words = {std::filesystem::current_path().string()};
+    for (int i = options.ScriptArg; i < argc; ++i)
+    {
+        words.push_back(argv[i]);
+    }
+    std::string payload;
+    if (!socket.Write(JoinWords(words)) || !socket.Read(&payload))
+    {
+        std::fprintf(stderr, "%s: connection closed\n", options.Connect);
+        return false;
+    }
+    // output may contain '\0'
+    auto pos = payload.find('\0');
+    auto ok = payload.substr(0, pos) == "ok";
+    if (pos != std::string::npos)
+    {
+        std::fwrite(payload.data() + pos + 1, 1, payload.size() - pos - 1, ok ? stdout : stderr);
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        std::fputs(USAGE, stderr);
+        return 1;
+    }
+    if (options.Connect)
+    {
+        return RunClient(options, argc, argv) ? 0 : 1;
+    }
+
+    auto L = clalua_newstate(options.Pooled);
+    if (!L)
+    {
+        std::fprintf(stderr, "cannot create state: not enough memory\n");
+        return 1;
+    }
+    auto ok = options.Daemon  ? RunDaemon(L, options)
+              : options.Batch ? RunBatch(L, options, argv[0])
+                              : Run(L, options, argc, argv);
+    clalua_close(L);
+    return ok ? 0 : 1;
+}
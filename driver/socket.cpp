@@ -0,0 +1,317 @@
+#include "socket.h"
+#include <stdint.h>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+std::string JoinWords(const std::vector<std::string> &words)
+{
+    std::string payload;
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        if (i)
+        {
+            payload.push_back('\0');
+        }
+        payload += words[i];
+    }
+    return payload;
+}
+
+std::vector<std::string> SplitWords(std::string_view payload)
+{
+    std::vector<std::string> words;
+    if (payload.empty())
+    {
+        return words;
+    }
+    while (true)
+    {
+        auto pos = payload.find('\0');
+        words.emplace_back(payload.substr(0, pos));
+        if (pos == std::string_view::npos)
+        {
+            break;
+        }
+        payload.remove_prefix(pos + 1);
+    }
+    return words;
+}
+
+FrameSocket::FrameSocket(FrameSocket &&rhs) noexcept
+    : m_fd(std::exchange(rhs.m_fd, -1)), m_path(std::move(rhs.m_path))
+{
+}
+
+FrameSocket &FrameSocket::operator=(FrameSocket &&rhs) noexcept
+{
+    if (this != &rhs)
+    {
+        Close();
+        m_fd = std::exchange(rhs.m_fd, -1);
+        m_path = std::move(rhs.m_path);
+    }
+    return *this;
+}
+
+FrameSocket::~FrameSocket()
+{
+    Close();
+}
+
+#if defined(_WIN32)
+
+void FrameSocket::Close()
+{
+}
+
+bool SocketPath(const std::string &name, bool, std::string *path, std::string *)
+{
+    *path = name;
+    return true;
+}
+
+FrameSocket FrameSocket::Listen(const std::string &, std::string *error)
+{
+    *error = "unix domain socket is not supported on this platform";
+    return {};
+}
+
+FrameSocket FrameSocket::Connect(const std::string &, std::string *error)
+{
+    *error = "unix domain socket is not supported on this platform";
+    return {};
+}
+
+FrameSocket FrameSocket::Accept()
+{
+    return {};
+}
+
+bool FrameSocket::Read(std::string *)
+{
+    return false;
+}
+
+bool FrameSocket::Write(std::string_view)
+{
+    return false;
+}
+
+#else
+
+void FrameSocket::Close()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+    if (!m_path.empty())
+    {
+        unlink(m_path.c_str());
+        m_path.clear();
+    }
+}
+
+bool SocketPath(const std::string &name, bool create, std::string *path, std::string *error)
+{
+    if (name.find('/') != std::string::npos)
+    {
+        *path = name;
+        return true;
+    }
+    std::string dir;
+    if (auto runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime)
+    {
+        dir = runtime;
+    }
+    else
+    {
+        dir = "/tmp/clalua-" + std::to_string(getuid());
+        if (create && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+        {
+            *error = dir + ": " + std::strerror(errno);
+            return false;
+        }
+    }
+    // 他の user が作った directory や、他の user が書ける directory の socket は使わない
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0)
+    {
+        *error = dir + ": " + std::strerror(errno);
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0)
+    {
+        *error = dir + ": not a directory owned by the user with mode 0700";
+        return false;
+    }
+    *path = dir + "/" + name;
+    return true;
+}
+
+static bool MakeAddress(const std::string &path, sockaddr_un *addr, std::string *error)
+{
+    *addr = {};
+    addr->sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr->sun_path))
+    {
+        *error = "socket path is too long: " + path;
+        return false;
+    }
+    std::memcpy(addr->sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+FrameSocket FrameSocket::Listen(const std::string &path, std::string *error)
+{
+    sockaddr_un addr;
+    if (!MakeAddress(path, &addr, error))
+    {
+        return {};
+    }
+    FrameSocket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!socket.Valid())
+    {
+        *error = std::strerror(errno);
+        return {};
+    }
+
+    // 前の daemon が残した file. 動いている daemon があれば connect できる
+    std::string ignore;
+    if (Connect(path, &ignore).Valid())
+    {
+        *error = "already listening: " + path;
+        return {};
+    }
+    unlink(path.c_str());
+
+    // 他の user から connect できないように、bind の時点で 0600 で作る
+    auto mask = umask(0177);
+    auto bound = bind(socket.m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+    umask(mask);
+    if (!bound)
+    {
+        *error = std::strerror(errno);
+        return {};
+    }
+    socket.m_path = path;
+    if (chmod(path.c_str(), 0600) != 0 || listen(socket.m_fd, 16) != 0)
+    {
+        *error = std::strerror(errno);
+        return {};
+    }
+    return socket;
+}
+
+FrameSocket FrameSocket::Connect(const std::string &path, std::string *error)
+{
+    sockaddr_un addr;
+    if (!MakeAddress(path, &addr, error))
+    {
+        return {};
+    }
+    FrameSocket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!socket.Valid() || connect(socket.m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        *error = std::strerror(errno);
+        return {};
+    }
+    return socket;
+}
+
+FrameSocket FrameSocket::Accept()
+{
+    while (true)
+    {
+        auto fd = accept(m_fd, nullptr, nullptr);
+        if (fd >= 0 || errno != EINTR)
+        {
+            return FrameSocket(fd);
+        }
+    }
+}
+
+static bool ReadAll(int fd, void *dst, size_t size)
+{
+    auto p = static_cast<char *>(dst);
+    while (size)
+    {
+        auto n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool WriteAll(int fd, const void *src, size_t size)
+{
+    auto p = static_cast<const char *>(src);
+    while (size)
+    {
+        auto n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool FrameSocket::Read(std::string *payload)
+{
+    uint8_t header[4];
+    if (!ReadAll(m_fd, header, sizeof(header)))
+    {
+        return false;
+    }
+    auto size = static_cast<uint32_t>(header[0]) | static_cast<uint32_t>(header[1]) << 8 |
+                static_cast<uint32_t>(header[2]) << 16 | static_cast<uint32_t>(header[3]) << 24;
+    if (size > MAX_FRAME)
+    {
+        return false;
+    }
+    payload->resize(size);
+    return ReadAll(m_fd, payload->data(), size);
+}
+
+bool FrameSocket::Write(std::string_view payload)
+{
+    if (payload.size() > MAX_FRAME)
+    {
+        return false;
+    }
+    auto size = static_cast<uint32_t>(payload.size());
+    uint8_t header[4] = {
+        static_cast<uint8_t>(size),
+        static_cast<uint8_t>(size >> 8),
+        static_cast<uint8_t>(size >> 16),
+        static_cast<uint8_t>(size >> 24),
+    };
+    return WriteAll(m_fd, header, sizeof(header)) && WriteAll(m_fd, payload.data(), payload.size());
+}
+
+#endif
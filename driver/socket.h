@@ -0,0 +1,55 @@
+//
+// clalua_driver --daemon / --connect の unix domain socket
+//
+// frame: [payload size: uint32 little endian][payload]
+// payload: '\0' separated words
+//
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class FrameSocket
+{
+    int m_fd = -1;
+    // listening socket removes the path
+    std::string m_path;
+
+    void Close();
+
+public:
+    // refuse a frame larger than this
+    static constexpr uint32_t MAX_FRAME = 256 * 1024 * 1024;
+
+    FrameSocket() = default;
+    explicit FrameSocket(int fd) : m_fd(fd)
+    {
+    }
+    ~FrameSocket();
+    FrameSocket(FrameSocket &&rhs) noexcept;
+    FrameSocket &operator=(FrameSocket &&rhs) noexcept;
+    FrameSocket(const FrameSocket &) = delete;
+    FrameSocket &operator=(const FrameSocket &) = delete;
+
+    bool Valid() const
+    {
+        return m_fd >= 0;
+    }
+
+    // a stale socket file at path is replaced. the socket file is 0600
+    static FrameSocket Listen(const std::string &path, std::string *error);
+    static FrameSocket Connect(const std::string &path, std::string *error);
+    FrameSocket Accept();
+
+    // false: closed or broken frame
+    bool Read(std::string *payload);
+    bool Write(std::string_view payload);
+};
+
+// a name without '/' is placed in $XDG_RUNTIME_DIR or /tmp/clalua-{uid}.
+// the directory must be owned by the user and not accessible by others. create: mkdir 0700
+bool SocketPath(const std::string &name, bool create, std::string *path, std::string *error);
+
+std::string JoinWords(const std::vector<std::string> &words);
+std::vector<std::string> SplitWords(std::string_view payload);
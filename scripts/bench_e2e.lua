@@ -0,0 +1,293 @@
+require "predefine"
+local D = require "dlang"
+local CS = require "csharp"
+
+------------------------------------------------------------------------------
+-- command line
+------------------------------------------------------------------------------
+local args = {...}
+print_table(args)
+
+local USAGE = "clalua_driver bench_e2e.lua {result.json} {lua_source_dir} [{llvm_include_dir}] [{repeat}]"
+local result_path = argPath(args[1])
+local lua_src = argPath(args[2])
+local llvm_include = argPath(args[3])
+local repeat_count = tonumber(args[4]) or 3
+if not lua_src then
+    error(USAGE)
+end
+
+-- /usr/lib/llvm-{version}/include
+local function find_llvm_include()
+    local found
+    if not file.exists("/usr/lib") then
+        return nil
+    end
+    for entry in lfs.dir("/usr/lib") do
+        if startswith(entry, "llvm%-") then
+            local include = string.format("/usr/lib/%s/include", entry)
+            if file.exists(include .. "/clang-c/Index.h") and (not found or include > found) then
+                found = include
+            end
+        end
+    end
+    return found
+end
+if not llvm_include or llvm_include == "" then
+    llvm_include = find_llvm_include()
+end
+
+local work_dir = result_path .. ".work"
+
+------------------------------------------------------------------------------
+-- cases
+------------------------------------------------------------------------------
+local function prefix(dir, files)
+    local headers = {}
+    for i, f in ipairs(files) do
+        headers[i] = string.format("%s/%s", dir, f)
+    end
+    return headers
+end
+
+local function dllExportOnly(decl)
+    if decl.class == "Function" then
+        return decl.dllExport
+    else
+        return true
+    end
+end
+
+local cases = {
+    {
+        name = "d_liblua",
+        parse = {
+            isD = true,
+            defines = {"LUA_BUILD_AS_DLL=1"},
+            externC = true,
+            headers = prefix(lua_src, {"lua.h", "lauxlib.h", "lualib.h"})
+        },
+        generate = function(sourceMap, dir, fragments)
+            return D.Generate(sourceMap, dir, {filter = dllExportOnly, clean = not fragments, fragments = fragments})
+        end,
+        fragments = true
+    }
+}
+if llvm_include then
+    local clang_headers = prefix(llvm_include, {"clang-c/Index.h", "clang-c/CXString.h"})
+    table.insert(
+        cases,
+        {
+            name = "d_libclang",
+            parse = {
+                isD = true,
+                headers = clang_headers,
+                includes = {llvm_include}
+            },
+            generate = function(sourceMap, dir, fragments)
+                return D.Generate(
+                    sourceMap,
+                    dir,
+                    {omitEnumPrefix = true, filter = dllExportOnly, clean = not fragments, fragments = fragments}
+                )
+            end,
+            fragments = true
+        }
+    )
+    table.insert(
+        cases,
+        {
+            name = "cs_libclang",
+            parse = {
+                headers = clang_headers,
+                includes = {llvm_include}
+            },
+            generate = function(sourceMap, dir)
+                return CS.Generate(
+                    sourceMap,
+                    {
+                        omitEnumPrefix = true,
+                        macro_map = {},
+                        dir = dir,
+                        const = {},
+                        overload = {},
+                        dll_map = {},
+                        clean = true
+                    }
+                )
+            end
+        }
+    )
+else
+    print("clang-c/Index.h not found. skip libclang cases")
+end
+
+------------------------------------------------------------------------------
+-- run
+------------------------------------------------------------------------------
+local PHASES = {"parse_ms", "traverse_ms", "closure_ms", "push_ms", "generate_ms", "total_ms"}
+
+local function run_once(case)
+    local dir = string.format("%s/%s", work_dir, case.name)
+    local begin = clalua.now()
+    local sourceMap = ClangParse(case.parse)
+    if not sourceMap then
+        error(case.name .. ": fail to parse")
+    end
+    local phases = clalua.phases()
+    local generate_begin = clalua.now()
+    local stats = case.generate(sourceMap, dir)
+    local finish = clalua.now()
+
+    phases.generate_ms = (finish - generate_begin) * 1000
+    phases.total_ms = (finish - begin) * 1000
+    phases.files = stats.written + stats.unchanged
+    phases.output_bytes = stats.bytes
+    return phases
+end
+
+local results = {}
+for _, case in ipairs(cases) do
+    local best
+    for i = 1, repeat_count do
+        local r = run_once(case)
+        if not best then
+            best = r
+        else
+            for _, k in ipairs(PHASES) do
+                best[k] = math.min(best[k], r[k])
+            end
+        end
+        collectgarbage()
+    end
+    best.name = case.name
+    table.insert(results, best)
+end
+
+------------------------------------------------------------------------------
+-- fragments = true の出力が無しの出力と同じか(cold と warm の両方)
+------------------------------------------------------------------------------
+local function read_all(path)
+    local f = assert(io.open(path, "rb"))
+    local text = f:read("a")
+    f:close()
+    return text
+end
+
+-- {[relative path] = path}. outdir と fragments の管理 file は除く
+local function list_outputs(root, dir, out)
+    out = out or {}
+    dir = dir or root
+    for entry in lfs.dir(dir) do
+        if entry ~= "." and entry ~= ".." and entry ~= ".clalua_outputs" and entry ~= ".clalua_fragments" then
+            local path = string.format("%s/%s", dir, entry)
+            if lfs.attributes(path, "mode") == "directory" then
+                list_outputs(root, path, out)
+            else
+                out[path:sub(#root + 2)] = path
+            end
+        end
+    end
+    return out
+end
+
+local function compare_outputs(name, expected_dir, actual_dir)
+    local expected = list_outputs(expected_dir)
+    local actual = list_outputs(actual_dir)
+    for k, path in pairs(expected) do
+        if not actual[k] then
+            error(string.format("%s: %s is missing with fragments", name, k))
+        end
+        if read_all(path) ~= read_all(actual[k]) then
+            error(string.format("%s: %s differs with fragments", name, k))
+        end
+    end
+    for k, _ in pairs(actual) do
+        if not expected[k] then
+            error(string.format("%s: %s is extra with fragments", name, k))
+        end
+    end
+end
+
+for _, case in ipairs(cases) do
+    if case.fragments then
+        local plain_dir = string.format("%s/%s.plain", work_dir, case.name)
+        local fragments_dir = string.format("%s/%s.fragments", work_dir, case.name)
+        if file.exists(fragments_dir) then
+            file.rmdirRecurse(fragments_dir)
+        end
+        local sourceMap = ClangParse(case.parse)
+        if not sourceMap then
+            error(case.name .. ": fail to parse")
+        end
+        case.generate(sourceMap, plain_dir)
+        for _, run in ipairs({"cold", "warm"}) do
+            local stats = case.generate(sourceMap, fragments_dir, true)
+            compare_outputs(string.format("%s(%s)", case.name, run), plain_dir, fragments_dir)
+            printf("%-12s fragments %s: same output, %d hits", case.name, run, stats.fragments.hits)
+        end
+        collectgarbage()
+    end
+end
+
+------------------------------------------------------------------------------
+-- result json
+------------------------------------------------------------------------------
+local function json_value(v)
+    if type(v) == "number" then
+        if math.type(v) == "integer" then
+            return tostring(v)
+        end
+        return string.format("%.3f", v)
+    elseif type(v) == "string" then
+        return '"' .. (v:gsub('[\\"]', "\\%0")) .. '"'
+    elseif v == nil then
+        return "null"
+    end
+    return tostring(v)
+end
+
+local function git_commit()
+    local p = io.popen("git rev-parse --short HEAD 2>/dev/null")
+    if not p then
+        return nil
+    end
+    local commit = p:read("l")
+    p:close()
+    return commit
+end
+
+local f = clalua.writer(result_path)
+f:line("{")
+f:linef('    "commit": %s,', json_value(git_commit()))
+f:linef('    "date": %s,', json_value(os.date("!%Y-%m-%dT%H:%M:%SZ")))
+f:linef('    "repeat": %d,', repeat_count)
+f:line('    "cases": [')
+for i, r in ipairs(results) do
+    local fields = {string.format('"name": %s', json_value(r.name))}
+    for _, k in ipairs(
+        {"parse_ms", "traverse_ms", "closure_ms", "push_ms", "generate_ms", "total_ms", "decls", "sources", "source_decls", "files", "output_bytes"}
+    ) do
+        table.insert(fields, string.format('"%s": %s', k, json_value(r[k])))
+    end
+    f:linef("        {%s}%s", table.concat(fields, ", "), i < #results and "," or "")
+end
+f:line("    ]")
+f:line("}")
+assert(f:close())
+
+for _, r in ipairs(results) do
+    printf(
+        "%-12s parse %8.1f traverse %8.1f closure %8.1f push %8.1f generate %8.1f total %8.1f ms, %d decls, %d bytes",
+        r.name,
+        r.parse_ms,
+        r.traverse_ms,
+        r.closure_ms,
+        r.push_ms,
+        r.generate_ms,
+        r.total_ms,
+        r.decls,
+        r.output_bytes
+    )
+end
+printf("write %s", result_path)
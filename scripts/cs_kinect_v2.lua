@@ -5,6 +5,7 @@ local CS = require 'csharp'
 -- command line
 ------------------------------------------------------------------------------
 local src, dir = table.unpack {...}
+src, dir = argPath(src), argPath(dir)
 
 print_table({...})
 local USAGE = 'clalua.exe cs_kinect_v2.lua {KINECT20SDK_DIR} {cs_dst_dir}'
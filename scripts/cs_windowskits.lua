@@ -4,7 +4,7 @@ local CS = require "csharp"
 ------------------------------------------------------------------------------
 -- command line
 ------------------------------------------------------------------------------
-local dir = table.unpack {...}
+local dir = argPath(...)
 
 local USAGE = "clalua.exe cs_windowskits.lua {cs_dst_dir}"
 if not dir then
@@ -63,7 +63,8 @@ end
 local sourceMap =
     ClangParse {
     headers = headers,
-    defines = {"UNICODE=1"}
+    defines = {"UNICODE=1"},
+    progress = ClangProgress
 }
 if not sourceMap then
     error("no sourceMap")
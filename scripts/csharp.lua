@@ -128,17 +128,21 @@ local function isPointer(name)
     end
 end
 
+local USER_TYPES = {
+    Enum = true,
+    Struct = true,
+    TypeDef = true,
+    Function = true
+}
+
 local function isUserType(t)
-    for i, u in ipairs {'Enum', 'Struct', 'TypeDef', 'Function'} do
-        if u == t.class then
-            return true
-        end
-    end
+    return USER_TYPES[t.class]
 end
 
 local function resolveTypedef(t)
     if t.class == 'TypeDef' then
-        local resolved = resolveTypedef(t.ref.type)
+        -- clalua.parse が typedef の先を計算済み
+        local resolved = t.resolved or resolveTypedef(t.ref.type)
         if isUserType(resolved) then
             if t.useCount == 1 and resolved.name ~= t.name then
             -- rename
@@ -355,7 +359,7 @@ local function CSEnumDecl(sourceDir, decl, option, indent)
     end
 
     local path = string.format('%s/%s.cs', sourceDir, decl.name)
-    local f = io.open(path, 'w')
+    local f = clalua.writer(path, option)
     writeln(f, HEADLINE)
     writefln(f, 'namespace %s {', option.packageName)
 
@@ -370,7 +374,7 @@ local function CSEnumDecl(sourceDir, decl, option, indent)
     end
     writefln(f, '%s}', indent)
     writeln(f, '}')
-    io.close(f)
+    assert(f:close())
 end
 
 local function CSGlobalFunction(f, decl, indent, option, sourceName)
@@ -542,7 +546,7 @@ local function CSComInterface(sourceDir, decl, option)
     local name = decl.name
 
     local path = string.format('%s/%s.cs', sourceDir, decl.name)
-    local f = io.open(path, 'w')
+    local f = clalua.writer(path, option)
     writeln(f, HEADLINE)
     writefln(f, 'namespace %s {', option.packageName)
 
@@ -600,7 +604,7 @@ local function CSComInterface(sourceDir, decl, option)
     end
     writeln(f, '    }')
     writeln(f, '}')
-    io.close(f)
+    assert(f:close())
 end
 
 local function CSStructDecl(f, decl, option, i)
@@ -770,6 +774,9 @@ local function CSMacro(f, macro, macro_map)
 end
 
 local function CSSource(f, source, option)
+    -- source 毎に独立させる(clalua.emit で別の lua_State から呼ばれても同じ出力にする)
+    anonymousMap = {}
+
     -- dir
     local sourceDir = string.format('%s/%s', option.dir, source.name)
     file.mkdirRecurse(sourceDir)
@@ -777,7 +784,7 @@ local function CSSource(f, source, option)
     -- open
     local path = sourceDir .. '.cs'
     printf('writeTo: %s', path)
-    local f = io.open(path, 'w')
+    local f = clalua.writer(path, option)
 
     macro_map = option['macro_map'] or {}
     declFilter = option['filter']
@@ -804,7 +811,7 @@ local function CSSource(f, source, option)
             local type = const_option.type or 'int'
             local pred = const_option.value
 
-            local f = io.open(path, 'w')
+            local f = clalua.writer(path, option)
             writeln(f, HEADLINE)
             writefln(f, 'namespace %s {', option.packageName)
 
@@ -829,39 +836,32 @@ local function CSSource(f, source, option)
             writeln(f, '    }')
 
             writeln(f, '}')
-            io.close(f)
+            assert(f:close())
         end
 
         writeln(f, '    public static partial class Constants {')
         local macros = source.macros
 
         -- option.constに設定があるものだけ、定数宣言を別ファイルに分離する
-        local used = {}
+        -- 各 macro は一致する全部の prefix の group に入る(DXGI_ と DXGI_USAGE_ の両方など. native の trie で 1 pass)
+        local matches = {}
         for prefix, const in pairs(option.const) do
-            local group = {}
-            local match = prefix .. '_'
-            if const.match then
-                match = const.match
-            end
-            for i, macro in ipairs(macros) do
-                if startswith(macro.name, match) then
-                    table.insert(group, macro)
-                    used[i] = true
-                end
-            end
+            table.insert(matches, const.match or (prefix .. '_'))
+        end
+        local groups, rest = clalua.group_prefix(macros, matches, "name", true)
+        for prefix, const in pairs(option.const) do
+            local group = groups[const.match or (prefix .. '_')]
             local path = string.format('%s/%s.cs', sourceDir, prefix)
             CSMacroEnum(path, prefix, group, const)
         end
 
         local constants = {}
-        for i, macro in ipairs(macros) do
-            if not used[i] then
-                if constants[macro.name] then
-                    writefln(f, '// duplicate: %s = %s', macro.name, table.concat(macro.tokens, ' '))
-                else
-                    CSMacro(f, macro, macro_map)
-                    constants[macro.name] = true
-                end
+        for i, macro in ipairs(rest) do
+            if constants[macro.name] then
+                writefln(f, '// duplicate: %s = %s', macro.name, table.concat(macro.tokens, ' '))
+            else
+                CSMacro(f, macro, macro_map)
+                constants[macro.name] = true
             end
         end
         writeln(f, '    }')
@@ -903,13 +903,13 @@ local function CSSource(f, source, option)
 
     writeln(f, '}')
 
-    io.close(f)
+    assert(f:close())
     return hasComInterface
 end
 
 local function ComUtil(option)
     local path = string.format('%s/ComUtil.cs', option.dir)
-    local f = io.open(path, 'w')
+    local f = clalua.writer(path, option)
     writeln(f, HEADLINE)
     f:write(
         string.format(
@@ -1198,7 +1198,7 @@ namespace %s
             option.packageName
         )
     )
-    io.close(f)
+    assert(f:close())
 end
 
 local function CSProj(f)
@@ -1219,20 +1219,50 @@ local function CSProj(f)
     )
 end
 
+--- write a source. clalua.emit からは worker thread の lua_State で呼ばれる
+local function CSEmitSource(k, source, option)
+    if source.empty then
+        return false
+    end
+    return CSSource(nil, source, option)
+end
+
 local function CSGenerate(sourceMap, option)
+    local trace <close> = clalua.trace_scope('generate', option.dir)
+
     -- clear dir
-    if file.exists(option.dir) then
+    if option.clean and file.exists(option.dir) then
         printf('rmdir %s', option.dir)
         file.rmdirRecurse(option.dir)
     end
     option.packageName = basename(option.dir)
     file.mkdirRecurse(option.dir)
+    -- 内容が変わったファイルだけ書き換える
+    option.outdir = clalua.outdir(option.dir)
 
     local hasComInterface = false
-    for k, source in pairs(sourceMap) do
-        -- write each source
-        if not source.empty then
-            if CSSource(f, source, option) then
+    if option.jobs and option.jobs > 1 then
+        -- write each source in parallel
+        local results =
+            clalua.emit(
+            sourceMap,
+            {
+                module = 'csharp',
+                entry = 'EmitSource',
+                jobs = option.jobs,
+                args = {option}
+            }
+        )
+        for k, result in pairs(results) do
+            if result then
+                hasComInterface = true
+            end
+        end
+    else
+        for k, source in pairs(sourceMap) do
+            -- write each source
+            local scope <close> = clalua.trace_scope('emit.source', k)
+            if CSEmitSource(k, source, option) then
                 hasComInterface = true
             end
         end
@@ -1246,12 +1276,19 @@ local function CSGenerate(sourceMap, option)
     do
         -- csproj
         local path = string.format('%s/%s.csproj', option.dir, option.packageName)
-        local f = io.open(path, 'w')
+        local f = clalua.writer(path, option)
         CSProj(f)
-        io.close(f)
+        assert(f:close())
     end
+
+    -- remove stale files
+    local stats = assert(option.outdir:finish())
+    option.outdir = nil
+    printf('%s: %d written, %d unchanged, %d removed', option.dir, stats.written, stats.unchanged, stats.removed)
+    return stats
 end
 
 return {
-    Generate = CSGenerate
+    Generate = CSGenerate,
+    EmitSource = CSEmitSource
 }
@@ -8,8 +8,8 @@ local args = {...}
 print_table(args)
 
 local USAGE = "clalua.exe d_imgui.lua {imgui_dir} {d_dst_dir}"
-local src = args[1]
-local dir = args[2]
+local src = argPath(args[1])
+local dir = argPath(args[2])
 if not dir then
     error(USAGE)
 end
@@ -33,7 +33,10 @@ local sourceMap =
     ClangParse {
     isD = true,
     headers = headers,
-    defines = defines
+    defines = defines,
+    sort = "namespace",
+    -- option.filter と同じ。落とした関数だけが使う型を marshal しない
+    prune = {dllExport = true}
 }
 if sourceMap.empty then
     error("empty")
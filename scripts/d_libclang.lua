@@ -11,8 +11,8 @@ local args = {
 print_table(args)
 
 local USAGE = "clalua.exe d_libclang.lua {lua_source_dir} {d_dst_dir}"
-local src = args[1]
-local dir = args[2]
+local src = argPath(args[1])
+local dir = argPath(args[2])
 if not dir then
     error(USAGE)
 end
@@ -8,7 +8,7 @@ local args = {...}
 print_table(args)
 
 local USAGE = "clalua.exe d_d3d11.lua {d_dst_dir}"
-local dir = args[1]
+local dir = argPath(args[1])
 if not dir then
     error(USAGE)
 end
@@ -64,7 +64,8 @@ end
 local sourceMap =
     ClangParse {
     headers = headers,
-    isD = true
+    isD = true,
+    progress = ClangProgress
 }
 if sourceMap.empty then
     error("empty")
@@ -100,6 +101,8 @@ local param_map = {
 local option = {
     filter = filter,
     omitEnumPrefix = true,
+    -- 1 header の編集で変わった decl だけ出力しなおす
+    fragments = true,
     macro_map = {
         D3D_COMPILE_STANDARD_FILE_INCLUDE = "enum D3D_COMPILE_STANDARD_FILE_INCLUDE = cast(void*)1;",
         DWRITE_EXPORT = "// enum DWRITE_EXPORT = __declspec ( dllimport ) WINAPI;"
@@ -35,7 +35,9 @@ local DTYPE_MAP = {
 }
 
 local function isInterface(decl)
-    decl = decl.typedefSource
+    if decl.class == "TypeDef" then
+        decl = decl.resolved or decl
+    end
 
     if decl.class ~= "Struct" then
         return false
@@ -197,27 +199,21 @@ end
 local function DFunctionDecl(f, decl, indent, isMethod, option)
     indent = indent or ""
 
-    f:write(indent)
+    local extern = ""
     if not isMethod then
         if decl.isExternC then
-            f:write("extern(C) ")
+            extern = "extern(C) "
         else
-            f:write(string.format("extern(C++) ", ns))
+            extern = "extern(C++) "
         end
     end
 
     local retType = DType(decl.ret.type, "RETURN")
     -- printf("%s %s", retType, decl.name)
-    f:write(retType)
-    f:write(" ")
-    f:write(decl.name)
-    f:write("(")
+    f:write(indent, extern, retType, " ", decl.name, "(")
 
-    local isFirst = true
     for i, param in ipairs(decl.params) do
-        if isFirst then
-            isFirst = false
-        else
+        if i > 1 then
             f:write(", ")
         end
 
@@ -225,8 +221,8 @@ local function DFunctionDecl(f, decl, indent, isMethod, option)
         if param.ref.isConst then
             dst = string.format("const(%s)", dst)
         end
-        f:write(string.format("%s %s%s", dst, DEscapeName(param.name, i),
-                              getValue(param, option.param_map, param.ref.type.class)))
+        writef(f, "%s %s%s", dst, DEscapeName(param.name, i),
+               getValue(param, option.param_map, param.ref.type.class))
     end
     if decl.isVariadic then
         f:write(", ...")
@@ -370,6 +366,66 @@ local function DDecl(f, decl, option, i)
     end
 end
 
+--- option.fragments の key. nil なら cache しない
+---
+--- deepFingerprint は参照先まで含むので、DType が参照先(isInterface など)を見ても同じ出力になる。
+--- counter, anonymousMap, param_map に依存する decl は source 毎に出力が変わるので毎回生成する
+local function DFragmentKey(decl, option)
+    local deep = decl.deepFingerprint
+    if not deep or deep == 0 then
+        return nil
+    end
+
+    if decl.class == "TypeDef" then
+        return string.format("T%x", deep)
+    elseif decl.class == "Enum" then
+        return string.format("E%x%s", deep, option.omitEnumPrefix and "o" or "")
+    elseif decl.class == "Struct" then
+        if decl.isInterface or not decl.name or #decl.name == 0 then
+            return nil
+        end
+        for _, field in ipairs(decl.fields) do
+            local t = field.ref.type
+            if #field.name == 0 or (t.class == "Struct" and (not t.name or #t.name == 0)) then
+                return nil
+            end
+        end
+        return string.format("S%x", deep)
+    elseif decl.class == "Function" then
+        if option.param_map then
+            return nil
+        end
+        -- fingerprint に入らないもの
+        local key = {string.format("F%x%s", deep, decl.isExternC and "c" or "")}
+        for _, param in ipairs(decl.params) do
+            if #param.name == 0 then
+                return nil
+            end
+            table.insert(key, table.concat(param.values or {}, " "))
+        end
+        return table.concat(key, "|")
+    end
+end
+
+--- DDecl. option.fragmentCache があれば同じ key の前回の出力を使う
+local function DDeclCached(f, decl, option, i)
+    local fragments = option.fragmentCache
+    local key = fragments and DFragmentKey(decl, option)
+    if not key then
+        DDecl(f, decl, option, i)
+        return
+    end
+
+    local text = fragments:get(key)
+    if text then
+        f:write(text)
+        return
+    end
+    local offset = f:size()
+    DDecl(f, decl, option, i)
+    fragments:put(key, f:tail(offset))
+end
+
 local function DImport(f, packageName, source)
     writeln(f, HEADLINE)
     local self = string.format("%s.%s", packageName, source.name)
@@ -432,6 +488,10 @@ local function DConstant(f, macroDefinition, macro_map)
 end
 
 local function DSource(f, packageName, source, option)
+    -- source 毎に独立させる(clalua.emit で別の lua_State から呼ばれても同じ出力にする)
+    counter = 1
+    anonymousMap = {}
+
     local macro_map = option["macro_map"] or {}
     local declFilter = option["filter"]
     local omitEnumPrefix = option["omitEnumPrefix"]
@@ -455,7 +515,7 @@ local function DSource(f, packageName, source, option)
     for i, decl in ipairs(source.types) do
         if not declFilter or declFilter(decl) then
             if decl.class == "Struct" and #decl.name == 0 then
-                DDecl(f, decl, option, i)
+                DDeclCached(f, decl, option, i)
             end
         end
     end
@@ -467,31 +527,42 @@ local function DSource(f, packageName, source, option)
             if decl.class == "Function" then
                 table.insert(funcs, decl)
             else
-                DDecl(f, decl, option, i)
+                DDeclCached(f, decl, option, i)
             end
         end
     end
-    local function pred(a, b)
-        return table.concat(a.namespace, ",") < table.concat(b.namespace, ".")
+    if source.sorted ~= "namespace" then
+        -- ClangParse{sort = "namespace"} なら source.types の関数が namespace 順なので不要
+        local order = {}
+        for i, decl in ipairs(funcs) do
+            order[decl] = i
+        end
+        local function pred(a, b)
+            if a.namespaceId ~= b.namespaceId then
+                return a.namespaceId < b.namespaceId
+            end
+            return order[a] < order[b]
+        end
+        table.sort(funcs, pred)
     end
-    table.sort(funcs, pred)
     local lastNS = ""
+    local lastNamespaceId = 0
     for i, decl in ipairs(funcs) do
-        if not option.externC then
+        if not option.externC and decl.namespaceId ~= lastNamespaceId then
+            lastNamespaceId = decl.namespaceId
+            -- namespace が変わる時だけ文字列にする
             local ns = table.concat(decl.namespace, ".")
-            if ns ~= lastNS then
-                if #lastNS > 0 then
-                    writefln(f, "} // %s", lastNS)
-                end
-                if string.match(ns, "^%s*$") then
-                    writefln(f, "extern(C++) {", ns)
-                else
-                    writefln(f, "extern(C++, %s) {", ns)
-                end
-                lastNS = ns
+            if #lastNS > 0 then
+                writefln(f, "} // %s", lastNS)
+            end
+            if string.match(ns, "^%s*$") then
+                writefln(f, "extern(C++) {", ns)
+            else
+                writefln(f, "extern(C++, %s) {", ns)
             end
+            lastNS = ns
         end
-        DDecl(f, decl, option)
+        DDeclCached(f, decl, option)
     end
     if #lastNS > 0 then
         writefln(f, "} // %s", lastNS)
@@ -548,37 +619,117 @@ GUID toGUID(immutable std.uuid.UUID uuid)
 ]])
 end
 
+--- write a source. clalua.emit からは worker thread の lua_State で呼ばれる
+local function DEmitSource(k, source, dir, option)
+    local packageName = basename(dir)
+    local path = string.format("%s/%s.d", dir, basename(k))
+    printf("writeTo: %s", path)
+
+    local f = clalua.writer(path, option)
+    local hasComInterface = DSource(f, packageName, source, option)
+    assert(f:close())
+    return hasComInterface
+end
+
+--- dlang.lua の chunk の bytecode(strip). 変われば fragments を全部捨てる
+--- 埋め込み script や bytecode cache から読んだときも同じになる. comment だけの変更では変わらない
+local SCRIPT_SALT = string.dump(debug.getinfo(1, "f").func, true)
+
+--- 出力に効く option の値を key 順に直列化する. function は bytecode(upvalue の値は入らない)
+local function DSaltValue(out, v)
+    local t = type(v)
+    if t == "table" then
+        local keys = {}
+        for k, _ in pairs(v) do
+            table.insert(keys, k)
+        end
+        table.sort(
+            keys,
+            function(a, b)
+                return tostring(a) < tostring(b)
+            end
+        )
+        table.insert(out, "{")
+        for _, k in ipairs(keys) do
+            DSaltValue(out, k)
+            table.insert(out, "=")
+            DSaltValue(out, v[k])
+            table.insert(out, ";")
+        end
+        table.insert(out, "}")
+    elseif t == "function" then
+        local ok, dump = pcall(string.dump, v, true)
+        table.insert(out, ok and dump or tostring(v))
+    else
+        table.insert(out, t .. ":" .. tostring(v))
+    end
+end
+
+--- fragments の salt. dlang.lua, predefine.lua の bytecode と option の表
+local function DFragmentSalt(option)
+    local out = {SCRIPT_SALT, PREDEFINE_BYTECODE or ""}
+    for _, name in ipairs({"macro_map", "param_map", "omitEnumPrefix", "externC"}) do
+        table.insert(out, name)
+        DSaltValue(out, option[name])
+    end
+    return table.concat(out, "\0")
+end
+
 function DGenerate(sourceMap, dir, option)
+    local trace <close> = clalua.trace_scope("generate", dir)
+
     -- clear dir
-    if file.exists(dir) then
+    if option.clean and file.exists(dir) then
         printf("rmdir %s", dir)
         file.rmdirRecurse(dir)
     end
 
     local packageName = basename(dir)
     local hasComInterface = false
-    for k, source in pairs(sourceMap) do
-        -- write each source
-        local path = string.format("%s/%s.d", dir, basename(k))
-        printf("writeTo: %s", path)
-        file.mkdirRecurse(dir)
-
-        do
-            -- open
-            local f = io.open(path, "w")
-            if DSource(f, packageName, source, option) then
+    file.mkdirRecurse(dir)
+    -- 内容が変わったファイルだけ書き換える
+    option.outdir = clalua.outdir(dir)
+    if option.fragments then
+        -- decl 毎の出力を再利用する. true なら dir に置く(OutputDir は MANIFEST 以外を消さない)
+        local path = option.fragments
+        if path == true then
+            path = string.format("%s/.clalua_fragments", dir)
+        end
+        option.fragmentCache = clalua.fragments(path, DFragmentSalt(option))
+    end
+    if option.jobs and option.jobs > 1 then
+        -- write each source in parallel
+        local results =
+            clalua.emit(
+            sourceMap,
+            {
+                module = "dlang",
+                entry = "EmitSource",
+                jobs = option.jobs,
+                args = {dir, option}
+            }
+        )
+        for k, result in pairs(results) do
+            if result then
+                hasComInterface = true
+            end
+        end
+    else
+        for k, source in pairs(sourceMap) do
+            -- write each source
+            local scope <close> = clalua.trace_scope("emit.source", k)
+            if DEmitSource(k, source, dir, option) then
                 hasComInterface = true
             end
-            io.close(f)
         end
     end
 
     if hasComInterface then
         -- write utility
         local path = string.format("%s/guidutil.d", dir)
-        local f = io.open(path, "w")
+        local f = clalua.writer(path, option)
         DGuidUtil(f, packageName)
-        io.close(f)
+        assert(f:close())
     end
 
     do
@@ -589,13 +740,30 @@ function DGenerate(sourceMap, dir, option)
 
         do
             -- open
-            local f = io.open(path, "w")
+            local f = clalua.writer(path, option)
             DPackage(f, packageName, sourceMap)
-            io.close(f)
+            assert(f:close())
+        end
+    end
+
+    -- remove stale files
+    local stats = assert(option.outdir:finish())
+    option.outdir = nil
+    printf("%s: %d written, %d unchanged, %d removed", dir, stats.written, stats.unchanged, stats.removed)
+    if option.fragmentCache then
+        local cache = option.fragmentCache
+        option.fragmentCache = nil
+        local ok, message = cache:save()
+        if not ok then
+            printf("%s", message)
         end
+        stats.fragments = cache:stats()
+        printf("fragments: %d hits, %d misses", stats.fragments.hits, stats.fragments.misses)
     end
+    return stats
 end
 
 return {
-    Generate = DGenerate
+    Generate = DGenerate,
+    EmitSource = DEmitSource
 }
@@ -0,0 +1,38 @@
+#!/bin/sh
+# two stage PGO + LTO release build.
+# 1. instrumented build (CLALUA_PGO=GENERATE)
+# 2. train with scripts/bench_e2e.lua (lua headers + clang-c/Index.h)
+# 3. optimized build (CLALUA_PGO=USE)
+#
+# usage: scripts/pgo_build.sh [build_dir] [llvm_include_dir]
+# env: CC / CXX, LLVM_PROFDATA (clang only, default llvm-profdata)
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${1:-$ROOT/build-pgo}
+LLVM_INCLUDE=${2:-}
+PGO_DIR=$BUILD/pgo
+CONFIG="-DCMAKE_BUILD_TYPE=Release -DCLALUA_LTO=ON -DCLALUA_PGO_DIR=$PGO_DIR"
+
+rm -rf "$PGO_DIR"
+mkdir -p "$PGO_DIR"
+
+echo "== [1/3] instrumented build"
+cmake -S "$ROOT" -B "$BUILD" $CONFIG -DCLALUA_PGO=GENERATE
+cmake --build "$BUILD" -j
+
+echo "== [2/3] training"
+(
+    cd "$ROOT/scripts"
+    LUA_CPATH="$BUILD/lib/?.so;;" "$BUILD/bin/clalua_driver" bench_e2e.lua "$BUILD/pgo_train.json" "$ROOT/_external/lua" "$LLVM_INCLUDE" 1
+)
+if ls "$PGO_DIR"/*.profraw >/dev/null 2>&1; then
+    # clang writes raw profiles
+    ${LLVM_PROFDATA:-llvm-profdata} merge -output="$PGO_DIR/clalua.profdata" "$PGO_DIR"/*.profraw
+fi
+
+echo "== [3/3] optimized build"
+cmake -S "$ROOT" -B "$BUILD" $CONFIG -DCLALUA_PGO=USE
+cmake --build "$BUILD" -j
+
+echo "done: $BUILD/bin/clalua_driver"
@@ -1,7 +1,16 @@
 clalua = require "clalua"
 
-lrdb = require("lrdb_server")
-lrdb.activate(21110) --21110 is using port number. waiting for connection by debug client.
+-- この chunk の bytecode(strip). dlang.lua の fragments の salt に入れる
+PREDEFINE_BYTECODE = string.dump(debug.getinfo(1, "f").func, true)
+
+-- debugger は clalua_driver --debugger PORT か 環境変数 CLALUA_DEBUGGER=PORT の時だけ起動する
+CLALUA_DEBUGGER = CLALUA_DEBUGGER or tonumber(os.getenv("CLALUA_DEBUGGER") or "")
+if CLALUA_DEBUGGER and not CLALUA_WORKER and not debug.gethook() then
+    -- clalua.emit の worker では debugger を起動しない
+    -- hook を使う clalua.profile_begin(--lua-profile)中も起動しない
+    lrdb = require("lrdb_server")
+    lrdb.activate(CLALUA_DEBUGGER) -- e.g. 21110. waiting for connection by debug client.
+end
 
 function printf(fmt, ...)
     print(string.format(fmt, ...))
@@ -81,18 +90,27 @@ function writeln(f, text)
         error("no f: " .. text)
     end
     if text then
-        f:write(text)
+        f:write(text, "\n")
+    else
+        f:write("\n")
     end
-    f:write("\n")
 end
 
+-- clalua.writer は native で format する
 function writef(f, fmt, ...)
-    f:write(string.format(fmt, ...))
+    if f.writef then
+        f:writef(fmt, ...)
+    else
+        f:write(string.format(fmt, ...))
+    end
 end
 
 function writefln(f, fmt, ...)
-    f:write(string.format(fmt, ...))
-    f:write("\n")
+    if f.writefln then
+        f:writefln(fmt, ...)
+    else
+        f:write(string.format(fmt, ...), "\n")
+    end
 end
 
 function rfind(src, pred)
@@ -138,14 +156,30 @@ function isFirstAlpha(src)
     return string.match(src, "^%a")
 end
 
+-- ClangParse{progress = ClangProgress}: 進捗を stderr に出す
+function ClangProgress(p)
+    io.stderr:write(string.format("[%s] %.1fs files=%d cursors=%d decls=%d closure=%d %.0f/s\n", p.phase,
+        p.elapsed_ms / 1000, p.files, p.cursors, p.decls, p.closure_decls, p.per_s))
+end
+
 function ClangParse(option)
     local headers = option.headers or {}
     local includes = option.includes or {}
     local defines = option.defines or {}
     local externC = option.externC or false
     local isD = option.isD or false
-    local sourceMap = clalua.parse(headers, includes, defines, externC, isD)
-    if sourceMap.empty then
+    -- sort = "namespace": source.types を namespace 順にする(source.sorted)
+    -- session = clalua.session{}: TU を保持して次の parse で再利用する
+    -- progress = function(p), progress_ms = 500: phase が変わったときと progress_ms 毎に呼ぶ
+    -- prune = {dllExport = true, names = {...}}: headers の decl を絞ってから closure を作る
+    local sourceMap = clalua.parse(headers, includes, defines, externC, isD, {
+        sort = option.sort,
+        session = option.session,
+        progress = option.progress,
+        progress_ms = option.progress_ms,
+        prune = option.prune
+    })
+    if not sourceMap or sourceMap.empty then
         return nil
     end
     return sourceMap
@@ -171,6 +205,14 @@ end
 
 lfs = require "lfs"
 
+-- script が path と宣言した引数. --connect の run なら相対 path を client の current directory(CLALUA_CWD)から解決する
+function argPath(path)
+    if not path or path == "" or not CLALUA_CWD or path:match("^[/\\]") or path:match("^%a:[/\\]") then
+        return path
+    end
+    return string.format("%s/%s", CLALUA_CWD, path)
+end
+
 function getPath(str)
     local m = str:match("(.*)[/\\]")
     return m